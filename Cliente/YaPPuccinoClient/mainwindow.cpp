@@ -7,6 +7,11 @@
 #include <QStringListModel>
 #include <QHostAddress>
 #include <QNetworkInterface>
+#include <QTimer>
+#include <QRegularExpression>
+
+static const int MAX_RECONNECT_ATTEMPTS = 5;
+static const int SEARCH_RESULTS = 10; // Coincidencias pedidas al buscar por prefijo
 
 QString getLocalIPAddress() {
     const QList<QHostAddress> &addresses = QNetworkInterface::allAddresses();
@@ -57,6 +62,9 @@ MainWindow::MainWindow(QWidget *parent)
 
     connect(ui->buscarNombreBtn, &QPushButton::clicked, this, &MainWindow::onSearchNameClicked);
 
+    // Búsqueda mientras se escribe: el servidor responde las coincidencias por prefijo
+    connect(ui->buscarNombreInput, &QTextEdit::textChanged, this, &MainWindow::onSearchTextChanged);
+
     connect(ui->userListPriv, &QListView::clicked, this, &MainWindow::onUserItemClicked);
 
     connect(ui->enviarMsgPriv, &QPushButton::clicked, this, &MainWindow::on_enviarMsgPriv_clicked);
@@ -88,37 +96,27 @@ void MainWindow::on_connectButton_clicked()
         return;
     }
 
-    ui->statusbar->showMessage("Verificando usuario...");
-    QUrl httpUrl = QUrl(QString("http://3.134.168.244:5000?name=%1").arg(username));
-
-    auto *reply = http.get(QNetworkRequest(httpUrl));
-    connect(reply, &QNetworkReply::finished, this, [this, reply, username]() {
-        int code = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-        reply->deleteLater();
-        if(code == 400) {
-            ui->statusbar->showMessage("Error 400: El nombre de ya está en uso.");
-            QMessageBox::warning(this, "Error 400", "El nombre ya está en uso.");
-        } else if(code >= 200 && code < 300) {
-            ui->statusbar->showMessage("Conectando WebSocket...");
-            currentUser = username;
-            socket.open(QUrl(QString("ws://3.134.168.244:5000?name=%1").arg(username)));
-
-            QString ipUsuario = getLocalIPAddress();
-            ui->ip->setText(ipUsuario);
+    // Sin consulta previa por HTTP: si el nombre está en uso el servidor rechaza el propio
+    // handshake y el error llega por onErrorOccurred
+    ui->statusbar->showMessage("Conectando WebSocket...");
+    if (username != currentUser) {
+        // Otro usuario: no hay sesión que reanudar
+        sessionStarted = false;
+        lastSeq = 0;
+    }
+    currentUser = username;
+    manualExit = false;
+    reconnectAttempts = 0;
+    socket.open(QUrl(socketUrl()));
 
-        } else {
-            ui->statusbar->showMessage("Error HTTP " + QString::number(code));
-            QMessageBox::critical(this, "Error HTTP", "Código: " + QString::number(code));
-        }
-    });
+    QString ipUsuario = getLocalIPAddress();
+    ui->ip->setText(ipUsuario);
 }
 
 void MainWindow::onrefreshUserListClick()
 {
     if (socket.isValid() && socket.state() == QAbstractSocket::ConnectedState) {
-        QByteArray message;
-        message.append(char(1));
-        socket.sendBinaryMessage(message);
+        requestUserLists();
         ui->statusbar->showMessage(" Solicitando lista de usuarios...");
     } else {
         QMessageBox::warning(this, "Error", "No estás conectado al servidor.");
@@ -145,38 +143,126 @@ void MainWindow::onSearchNameClicked()
     ui->statusbar->showMessage("Solicitando historial de: " + target);
 }
 
+void MainWindow::onSearchTextChanged()
+{
+    QString prefix = ui->buscarNombreInput->toPlainText().trimmed();
+    if (prefix.isEmpty() || socket.state() != QAbstractSocket::ConnectedState) return;
+
+    QByteArray raw = prefix.toUtf8().left(255);
+
+    QByteArray request;
+    request.append(char(9));                 // SEARCH_USERS
+    request.append(char(raw.length()));      // Len prefijo
+    request.append(raw);
+    request.append(char(SEARCH_RESULTS));    // Máximo de resultados
+    socket.sendBinaryMessage(request);
+}
+
+
+// URL del WebSocket; si ya hubo sesión se manda la última secuencia recibida para reanudarla
+QString MainWindow::socketUrl() const
+{
+    QString url = QString("ws://3.134.168.244:5000?name=%1").arg(currentUser);
+    if (sessionStarted) {
+        url += QString("&lastSeq=%1").arg(lastSeq);
+    }
+    return url;
+}
 
 void MainWindow::onConnected()
 {
     ui->statusbar->showMessage("¡Estas conectado! ✅");
-    QMessageBox::information(this, "Conexión", "Conectado correctamente al servidor.");
+    if (reconnectAttempts == 0) {
+        QMessageBox::information(this, "Conexión", "Conectado correctamente al servidor.");
+    }
+    reconnectAttempts = 0;
 
-    qDebug() << "[DEBUG] useCode57 está en:" << (useCode57 ? "true (usando código 57)" : "false (usando código 51)");
+    // Las listas de usuarios se piden al recibir SESSION_INFO (código 58), solo si
+    // el servidor no pudo reanudar la sesión anterior.
+}
 
+// Pide al servidor los cambios de estado de estos usuarios (código 10). El servidor
+// responde con su estado actual (código 62) y luego solo avisa de los usuarios seguidos.
+void MainWindow::subscribePresence(const QStringList &names)
+{
     QByteArray request;
-    request.append(char(1));
-    socket.sendBinaryMessage(request);
+    request.append(char(10));
+    for (const QString &name : names) {
+        QByteArray raw = name.toUtf8();
+        if (name == currentUser || raw.isEmpty() || raw.size() > 255) continue;
+        request.append(char(raw.size()));
+        request.append(raw);
+    }
+    if (request.size() > 1) {
+        socket.sendBinaryMessage(request);
+    }
+}
 
+void MainWindow::requestUserLists()
+{
+    qDebug() << "[DEBUG] useCode57 está en:" << (useCode57 ? "true (usando código 57)" : "false (usando código 51)");
+
+    // Un solo BATCH (código 8) con LIST_USERS y, si corresponde, LIST_ALL_USERS: una sola
+    // ida y vuelta, y la respuesta (código 60) trae las dos listas
+    QList<QByteArray> requests;
+    requests.append(QByteArray(1, char(1)));
     if (useCode57) {
-        QByteArray listAll;
-        listAll.append(char(6));
-        socket.sendBinaryMessage(listAll);
-        qDebug() << "[DEBUG] Enviado code 6 para obtener lista completa (esperando respuesta code 57)";
+        requests.append(QByteArray(1, char(6)));
+        qDebug() << "[DEBUG] Pidiendo code 6 para obtener lista completa (esperando respuesta code 57)";
     } else {
         qDebug() << "[DEBUG] Solo se usará la lista de usuarios conectados (code 51)";
     }
+
+    QByteArray batch;
+    batch.append(char(8));
+    batch.append(char(requests.size()));
+    for (const QByteArray &req : requests) {
+        batch.append(char(req.size() >> 8));
+        batch.append(char(req.size() & 0xFF));
+        batch.append(req);
+    }
+    socket.sendBinaryMessage(batch);
+}
+
+// Código HTTP con el que el servidor rechazó el handshake, o 0 si el error fue otro.
+// QWebSocket lo informa como "... Unhandled http status code: 409 (Name In Use)."
+static int handshakeStatus(const QString &err)
+{
+    static const QRegularExpression re("status code: (\\d{3})");
+    QRegularExpressionMatch match = re.match(err);
+    return match.hasMatch() ? match.captured(1).toInt() : 0;
 }
 
 void MainWindow::onErrorOccurred(QAbstractSocket::SocketError)
 {
     QString err = socket.errorString();
+    int status = handshakeStatus(err);
 
     qDebug() << "[DEBUG] WebSocket errorString() =" << err;
 
-    if (err.contains("400")) {
-        QMessageBox::warning(this, "Error de conexión",
-                             "El nombre de usuario ya está en uso.");
-    } else {
+    // Un nombre inválido no se arregla reintentando
+    if (reconnectAttempts > 0 && status != 400) {
+        // Falló un intento de reconexión automática: se reintenta sin molestar al usuario
+        ui->statusbar->showMessage("Reintentando conexión... (" + err + ")");
+        scheduleReconnect();
+        return;
+    }
+    reconnectAttempts = 0;
+
+    switch (status) {
+    case 409:
+        ui->statusbar->showMessage("Error 409: El nombre ya está en uso.");
+        QMessageBox::warning(this, "Error de conexión", "El nombre de usuario ya está en uso.");
+        return;
+    case 400:
+        ui->statusbar->showMessage("Error 400: Nombre de usuario inválido.");
+        QMessageBox::warning(this, "Error de conexión", "El nombre de usuario no es válido.");
+        return;
+    case 503:
+        ui->statusbar->showMessage("Error 503: El servidor se está apagando.");
+        QMessageBox::warning(this, "Error de conexión", "El servidor se está apagando, intenta más tarde.");
+        return;
+    default:
         QMessageBox::critical(this, "Error de conexión", err);
     }
     ui->statusbar->showMessage("Estado: Error");
@@ -184,10 +270,36 @@ void MainWindow::onErrorOccurred(QAbstractSocket::SocketError)
 
 void MainWindow::onDisconnected()
 {
+    if (!manualExit && sessionStarted) {
+        // Corte inesperado: se intenta reanudar la sesión con la última secuencia recibida
+        ui->statusbar->showMessage("Conexión perdida, reconectando...");
+        scheduleReconnect();
+        return;
+    }
     ui->statusbar->showMessage("Desconectado");
     QMessageBox::information(this, "Desconexión", "Se ha desconectado del servidor.");
 }
 
+void MainWindow::scheduleReconnect()
+{
+    if (manualExit || currentUser.isEmpty() || reconnectPending) return;
+    if (reconnectAttempts >= MAX_RECONNECT_ATTEMPTS) {
+        reconnectAttempts = 0;
+        ui->statusbar->showMessage("No se pudo reconectar con el servidor.");
+        return;
+    }
+    reconnectPending = true;
+    ++reconnectAttempts;
+    QTimer::singleShot(2000, this, &MainWindow::reconnectSocket);
+}
+
+void MainWindow::reconnectSocket()
+{
+    reconnectPending = false;
+    qDebug() << "[DEBUG] Reconectando, intento" << reconnectAttempts << "lastSeq =" << lastSeq;
+    socket.open(QUrl(socketUrl()));
+}
+
 void MainWindow::on_enviarMsgGeneral_clicked()
 {
     QString text = ui->msgGeneralTextEdit->toPlainText().trimmed();
@@ -230,6 +342,78 @@ void MainWindow::onBinaryMessageReceived(const QByteArray &data)
     int pos = 0;
     uint8_t code = bytes[pos++];
 
+    if (code == 58) {
+        // SESSION_INFO: secuencia desde la que continúa el flujo + bandera de reanudación
+        if (data.size() < 10) return;
+        quint64 seq = 0;
+        for (int i = 0; i < 8; ++i) {
+            seq = (seq << 8) | bytes[pos++];
+        }
+        bool resumed = bytes[pos++] != 0;
+        lastSeq = seq;
+        sessionStarted = true;
+
+        qDebug() << "[DEBUG] SESSION_INFO seq =" << seq << "reanudada =" << resumed;
+        if (!resumed) {
+            requestUserLists();
+        }
+        return;
+    }
+
+    // Cada trama binaria (excepto SESSION_INFO) tiene el siguiente número de secuencia
+    ++lastSeq;
+
+    handleServerFrame(data);
+}
+
+// Procesa una respuesta o notificación del servidor. Las respuestas agrupadas de un
+// RESPONSE_BATCH pasan por aquí una por una, sin contar como tramas aparte.
+void MainWindow::handleServerFrame(const QByteArray &data)
+{
+    if (data.isEmpty()) return;
+    const auto bytes = reinterpret_cast<const unsigned char*>(data.constData());
+    int pos = 0;
+    uint8_t code = bytes[pos++];
+
+    if (code == 60) {
+        // RESPONSE_BATCH: cantidad + (2 bytes de longitud + trama) por cada respuesta
+        if (pos >= data.size()) return;
+        uint8_t count = bytes[pos++];
+        for (int i = 0; i < count; ++i) {
+            if (pos + 2 > data.size()) break;
+            int len = (bytes[pos] << 8) | bytes[pos + 1];
+            pos += 2;
+            if (pos + len > data.size()) break;
+            handleServerFrame(data.mid(pos, len));
+            pos += len;
+        }
+        return;
+    }
+
+    if (code == 62) {
+        // RESPONSE_PRESENCE: (len + nombre + estado) hasta el final; cada uno se aplica
+        // igual que un cambio de estado (código 54)
+        while (pos < data.size()) {
+            int len = bytes[pos];
+            if (pos + 1 + len + 1 > data.size()) break;
+            QByteArray change(1, char(54));
+            change.append(data.mid(pos, len + 2));
+            handleServerFrame(change);
+            pos += len + 2;
+        }
+        return;
+    }
+
+    if (code == 53) {
+        // USER_REGISTERED: se sigue al usuario nuevo para ver sus cambios de estado
+        if (pos >= data.size()) return;
+        uint8_t nameLen = bytes[pos++];
+        if (pos + nameLen > data.size()) return;
+        QByteArray rawName(reinterpret_cast<const char*>(bytes + pos), nameLen);
+        subscribePresence({QString::fromUtf8(rawName)});
+        return;
+    }
+
     if (code == 51) {
         if (pos >= data.size()) return;
 
@@ -281,6 +465,7 @@ void MainWindow::onBinaryMessageReceived(const QByteArray &data)
         }
 
         userModel->setStringList(rows);
+        subscribePresence(userStates.keys());
 
         qDebug() << "[DEBUG] Procesando respuesta con código 51 (usuarios conectados)";
 
@@ -325,6 +510,15 @@ void MainWindow::onBinaryMessageReceived(const QByteArray &data)
                 ui->chatPriv->clear();
             }
 
+            break;
+        case 5:
+            errorMsg = "⚠️ El servidor no admite ese pedido agrupado.";
+            break;
+        case 6:
+            errorMsg = "⚠️ El mensaje no es texto UTF-8 válido.";
+            break;
+        case 7:
+            errorMsg = "⚠️ El mensaje es demasiado largo.";
             break;
         default:
             errorMsg = "Error desconocido del servidor.";
@@ -336,40 +530,49 @@ void MainWindow::onBinaryMessageReceived(const QByteArray &data)
         return;
     }
 
-    if (code == 52) {
-        // Validar que al menos hay un byte para len
+    if (code == 52 || code == 61) {
+        // RESPONSE_GET_USER (uno o varios usuarios) o RESPONSE_SEARCH_USERS (cantidad + usuarios)
         if (pos >= data.size()) {
             ui->mostrarNombre->setText("Error: mensaje incompleto.");
             return;
         }
+        int expected = code == 61 ? bytes[pos++] : -1;
 
-        uint8_t nameLen = bytes[pos++];
-        if (pos + nameLen > data.size()) {
-            ui->mostrarNombre->setText("Error: nombre inválido.");
-            return;
-        }
+        QStringList rows;
+        while (pos < data.size() && (expected < 0 || rows.size() < expected)) {
+            uint8_t nameLen = bytes[pos++];
+            if (pos + nameLen > data.size()) {
+                ui->mostrarNombre->setText("Error: nombre inválido.");
+                return;
+            }
 
-        QByteArray rawName(reinterpret_cast<const char*>(bytes + pos), nameLen);
-        QString username = QUrl::fromPercentEncoding(rawName);
-        pos += nameLen;
+            QByteArray rawName(reinterpret_cast<const char*>(bytes + pos), nameLen);
+            QString username = QUrl::fromPercentEncoding(rawName);
+            pos += nameLen;
 
-        if (pos >= data.size()) {
-            ui->mostrarNombre->setText("¡Ups! Usuario no existe.");
-            return;
-        }
+            if (pos >= data.size()) {
+                ui->mostrarNombre->setText("¡Ups! Usuario no existe.");
+                return;
+            }
 
-        uint8_t status = bytes[pos++];
+            uint8_t status = bytes[pos++];
 
-        QString estado;
-        switch (status) {
-        case 0: estado = "DESACTIVADO"; break;
-        case 1: estado = "ACTIVO"; break;
-        case 2: estado = "OCUPADO"; break;
-        case 3: estado = "INACTIVO"; break;
-        default: estado = "DESCONOCIDO";
+            QString estado;
+            switch (status) {
+            case 0: estado = "DESACTIVADO"; break;
+            case 1: estado = "ACTIVO"; break;
+            case 2: estado = "OCUPADO"; break;
+            case 3: estado = "INACTIVO"; break;
+            default: estado = "DESCONOCIDO";
+            }
+            rows << QString("%1 → %2").arg(username, estado);
         }
 
-        ui->mostrarNombre->setText(QString("%1 → %2").arg(username, estado));
+        if (code == 61 && rows.isEmpty()) {
+            ui->mostrarNombre->setText("Sin coincidencias.");
+            return;
+        }
+        ui->mostrarNombre->setText(rows.join("\n"));
         return;
     }
 
@@ -503,9 +706,11 @@ void MainWindow::onBinaryMessageReceived(const QByteArray &data)
 
         if (sender == "~") {
             // Mensaje general
-            ui->chatGeneralTextEdit->append(
-                "<p align='left'><i>(Mensaje general)</i> " + message.toHtmlEscaped() + "</p>"
-                );
+            QString html = "<p align='left'><i>(Mensaje general)</i> " + message.toHtmlEscaped() + "</p>";
+            ui->chatGeneralTextEdit->append(html);
+            if (historyPending) {
+                liveWhileHistoryPending.append({sender, message, html, true});
+            }
             return; // No seguir procesando como mensaje privado
         }
 
@@ -538,18 +743,21 @@ void MainWindow::onBinaryMessageReceived(const QByteArray &data)
         // Actualizar la lista de usuarios para reordenar y agregar asterisco
         updateUserListModel();
 
+        QString html;
         if (sender == selectedPrivateUser) {
             // Mensaje recibido: izquierda
-            ui->chatPriv->appendHtml(
-                "<p align='left' style='margin: 30px 0;'>"
-                "<b>" + sender + ":</b> " + message.toHtmlEscaped() + "</p>"
-                );
+            html = "<p align='left' style='margin: 30px 0;'>"
+                   "<b>" + sender + ":</b> " + message.toHtmlEscaped() + "</p>";
         } else if (sender == currentUser && !selectedPrivateUser.isEmpty()) {
             // Tu mensaje: derecha
-            ui->chatPriv->appendHtml(
-                "<p align='right' style='margin: 30px 0;'>"
-                "<b>Tú:</b> " + message.toHtmlEscaped() + "</p>"
-                );
+            html = "<p align='right' style='margin: 30px 0;'>"
+                   "<b>Tú:</b> " + message.toHtmlEscaped() + "</p>";
+        }
+        if (!html.isEmpty()) {
+            ui->chatPriv->appendHtml(html);
+            if (historyPending) {
+                liveWhileHistoryPending.append({sender, message, html, false});
+            }
         }
 
     }
@@ -574,6 +782,7 @@ void MainWindow::onBinaryMessageReceived(const QByteArray &data)
         }
 
         // 2) Recorrer los N mensajes
+        QList<QPair<QString, QString>> entries;
         for (int i = 0; i < num; i++) {
             if (pos >= data.size()) break;
             uint8_t lenUser = data[pos++];
@@ -588,6 +797,7 @@ void MainWindow::onBinaryMessageReceived(const QByteArray &data)
             pos += lenMsg;
 
             qDebug() << "[HISTORIAL] Mensaje" << i << ":" << user << ":" << msg;
+            entries.append({user, msg});
             QString line = user + ": " + msg.toHtmlEscaped();
             if (isGeneral) {
                 ui->chatGeneralTextEdit->append(line);
@@ -596,7 +806,62 @@ void MainWindow::onBinaryMessageReceived(const QByteArray &data)
             }
         }
 
-        ui->statusbar->showMessage("Historial recibido: " + QString::number(num) + " mensajes.");
+        // 3) Volver a mostrar los mensajes en vivo que llegaron antes que el historial
+        historyTail = entries;
+        historyReceived = num;
+        finishHistory(isGeneral);
+    }
+
+    else if (code == 59) { // RESPONSE_HISTORY_CHUNK: banderas + N mensajes
+        if (data.size() < 3) return;
+        uint8_t flags = bytes[1];
+        uint8_t num = bytes[2];
+        int pos = 3;
+
+        bool isGeneral = selectedPrivateUser.isEmpty();
+        if (flags & 1) { // Primera parte
+            if (isGeneral) {
+                ui->chatGeneralTextEdit->clear();
+            } else {
+                ui->chatPriv->clear();
+            }
+            historyReceived = 0;
+            historyTail.clear();
+        }
+
+        for (int i = 0; i < num; i++) {
+            if (pos >= data.size()) break;
+            uint8_t lenUser = bytes[pos++];
+            if (pos + lenUser > data.size()) break;
+            QString user = QString::fromUtf8(data.constData() + pos, lenUser);
+            pos += lenUser;
+
+            if (pos >= data.size()) break;
+            uint8_t lenMsg = bytes[pos++];
+            if (pos + lenMsg > data.size()) break;
+            QString msg = QString::fromUtf8(data.constData() + pos, lenMsg);
+            pos += lenMsg;
+
+            if (isGeneral) {
+                ui->chatGeneralTextEdit->append(user + ": " + msg.toHtmlEscaped());
+            } else {
+                ui->chatPriv->appendHtml("<p><b>" + user + ":</b> " + msg.toHtmlEscaped() + "</p>");
+            }
+            historyTail.append({user, msg});
+            ++historyReceived;
+        }
+
+        // Solo hace falta el final para compararlo con los mensajes en vivo
+        const int tailKeep = 64;
+        if (historyTail.size() > tailKeep) {
+            historyTail.erase(historyTail.begin(), historyTail.end() - tailKeep);
+        }
+
+        if (flags & 2) { // Última parte
+            finishHistory(isGeneral);
+        } else {
+            ui->statusbar->showMessage("Recibiendo historial: " + QString::number(historyReceived) + " mensajes...");
+        }
     }
 
     if (code == 57) {
@@ -650,6 +915,7 @@ void MainWindow::onBinaryMessageReceived(const QByteArray &data)
         }
 
         fullUserModel->setStringList(fullRows);
+        subscribePresence(allUserStates.keys());
 
         qDebug() << "[DEBUG] Lista cargada para userListPriv desde code 57:";
         for (const QString &row : fullRows) {
@@ -732,6 +998,52 @@ void MainWindow::on_enviarMsgPriv_clicked()
     ui->privMsgTextEdit->clear();
 }
 
+// Pide un historial por partes (GET_HISTORY_STREAM); target "~" es el chat general
+void MainWindow::requestHistory(const QString &target)
+{
+    QByteArray req;
+    req.append(char(7)); // GET_HISTORY_STREAM
+    QByteArray name = target.toUtf8();
+    req.append(char(name.size()));
+    req.append(name);
+
+    historyPending = true;
+    liveWhileHistoryPending.clear();
+    socket.sendBinaryMessage(req);
+}
+
+// Termina de mostrar un historial: vuelve a agregar los mensajes en vivo que llegaron antes
+// que el historial. Los primeros pueden estar ya al final del historial; esos no se repiten.
+void MainWindow::finishHistory(bool isGeneral)
+{
+    if (historyPending) {
+        int skip = 0;
+        for (int k = qMin(historyTail.size(), liveWhileHistoryPending.size()); k > 0 && skip == 0; --k) {
+            bool same = true;
+            for (int j = 0; j < k && same; ++j) {
+                const auto &entry = historyTail[historyTail.size() - k + j];
+                same = entry.first == liveWhileHistoryPending[j].sender
+                    && entry.second == liveWhileHistoryPending[j].message;
+            }
+            if (same) skip = k;
+        }
+        for (int i = skip; i < liveWhileHistoryPending.size(); ++i) {
+            const LiveLine &line = liveWhileHistoryPending[i];
+            if (line.general != isGeneral) continue;
+            if (isGeneral) {
+                ui->chatGeneralTextEdit->append(line.html);
+            } else {
+                ui->chatPriv->appendHtml(line.html);
+            }
+        }
+        historyPending = false;
+        liveWhileHistoryPending.clear();
+    }
+    historyTail.clear();
+
+    ui->statusbar->showMessage("Historial recibido: " + QString::number(historyReceived) + " mensajes.");
+}
+
 // Slot para solicitar historial general
 void MainWindow::on_historyGeneral_clicked()
 {
@@ -739,13 +1051,7 @@ void MainWindow::on_historyGeneral_clicked()
     selectedPrivateUser.clear();
     ui->chatPriv->clear(); // Opcional: limpiar el chat privado
 
-    // Construir request: code = 5 (GET_HISTORY), campo[0] = "~"
-    QByteArray req;
-    req.append(char(5)); // GET_HISTORY
-    req.append(char(1)); // longitud = 1
-    req.append("~");     // "~" indica historial general
-
-    socket.sendBinaryMessage(req);
+    requestHistory("~"); // "~" indica historial general
     ui->statusbar->showMessage("Solicitando historial general...");
 }
 
@@ -757,13 +1063,7 @@ void MainWindow::on_historyPriv_clicked()
         QMessageBox::warning(this, "Error", "No has seleccionado un usuario para chat privado.");
         return;
     }
-    QByteArray req;
-    req.append(char(5)); // GET_HISTORY
-    QByteArray other = selectedPrivateUser.toUtf8();
-    req.append(char(other.size()));
-    req.append(other);
-
-    socket.sendBinaryMessage(req);
+    requestHistory(selectedPrivateUser);
     ui->statusbar->showMessage("Solicitando historial privado con " + selectedPrivateUser + "...");
 }
 
@@ -801,6 +1101,7 @@ void MainWindow::updateUserListModel() {
 void MainWindow::on_exit_clicked()
 {
     if (socket.isValid() && socket.state() == QAbstractSocket::ConnectedState) {
+        manualExit = true;
         socket.close();  // Cierra el WebSocket
         ui->statusbar->showMessage("Desconectado manualmente.");
         QMessageBox::information(this, "Desconexión", "Has salido del servidor.");
@@ -3,8 +3,6 @@
 
 #include <QMainWindow>
 #include <QtWebSockets/QtWebSockets>
-#include <QNetworkAccessManager>
-#include <QNetworkReply>
 #include <QDateTime>
 #include <QSet>
 #include <QStringListModel>
@@ -35,6 +33,7 @@ private slots:
     void onManualStatusChange(int index);
     void onrefreshUserListClick();
     void onSearchNameClicked();
+    void onSearchTextChanged();
     void onUserItemClicked(const QModelIndex &index);
     void on_enviarMsgPriv_clicked();
     void on_historyGeneral_clicked();
@@ -43,11 +42,19 @@ private slots:
     void notificationMessage(const QString &title, const QString &message);
     void on_exit_clicked();
     void on_help_clicked();
+    void reconnectSocket();
 
 private:
+    void requestUserLists();
+    void subscribePresence(const QStringList &names);
+    void handleServerFrame(const QByteArray &data);
+    void requestHistory(const QString &target);
+    void finishHistory(bool isGeneral);
+    void scheduleReconnect();
+    QString socketUrl() const;
+
     Ui::MainWindow *ui;
     QWebSocket socket;
-    QNetworkAccessManager http;
     QString currentUser;
     QStringListModel *userModel;
     QStringListModel *fullUserModel;
@@ -59,6 +66,30 @@ private:
     bool useCode57 = true;
     QString currentUserStatus = "ACTIVO";
     QSystemTrayIcon *trayIcon;
+
+    // Reanudación de sesión: secuencia de la última trama binaria recibida
+    quint64 lastSeq = 0;
+    bool sessionStarted = false;
+    bool manualExit = false;
+    bool reconnectPending = false;
+    int reconnectAttempts = 0;
+
+    // Mensajes en vivo recibidos mientras se espera un historial. El servidor puede enviarlos
+    // antes que el historial (va por un carril de menor prioridad), y al llegar este limpia
+    // la vista, así que se vuelven a mostrar después.
+    struct LiveLine {
+        QString sender;
+        QString message;
+        QString html;
+        bool general;
+    };
+    bool historyPending = false;
+    QList<LiveLine> liveWhileHistoryPending;
+
+    // Historial por partes (código 59): registros recibidos y los últimos, para compararlos
+    // con los mensajes en vivo al terminar
+    int historyReceived = 0;
+    QList<QPair<QString, QString>> historyTail;
 };
 
 #endif // MAINWINDOW_H
@@ -0,0 +1,102 @@
+#include "AppendFile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <algorithm>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+AppendFile::~AppendFile()
+{
+    close();
+}
+
+#ifdef _WIN32
+
+bool AppendFile::open(const std::string &path, bool truncate)
+{
+    close();
+    HANDLE h = CreateFileA(path.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                           nullptr, truncate ? CREATE_ALWAYS : OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE)
+        return false;
+    handle = h;
+    return true;
+}
+
+bool AppendFile::isOpen() const
+{
+    return handle != nullptr;
+}
+
+bool AppendFile::write(std::string_view bytes)
+{
+    while (!bytes.empty())
+    {
+        DWORD written = 0;
+        DWORD chunk = static_cast<DWORD>(std::min<size_t>(bytes.size(), 1u << 30));
+        if (!handle || !WriteFile(handle, bytes.data(), chunk, &written, nullptr))
+            return false;
+        bytes.remove_prefix(written);
+    }
+    return true;
+}
+
+bool AppendFile::sync()
+{
+    return handle && FlushFileBuffers(handle);
+}
+
+void AppendFile::close()
+{
+    if (handle)
+        CloseHandle(handle);
+    handle = nullptr;
+}
+
+#else
+
+bool AppendFile::open(const std::string &path, bool truncate)
+{
+    close();
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (truncate ? O_TRUNC : 0), 0644);
+    return fd >= 0;
+}
+
+bool AppendFile::isOpen() const
+{
+    return fd >= 0;
+}
+
+bool AppendFile::write(std::string_view bytes)
+{
+    while (!bytes.empty())
+    {
+        ssize_t written = ::write(fd, bytes.data(), bytes.size());
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        bytes.remove_prefix(static_cast<size_t>(written));
+    }
+    return true;
+}
+
+bool AppendFile::sync()
+{
+    return fd >= 0 && ::fdatasync(fd) == 0;
+}
+
+void AppendFile::close()
+{
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+}
+
+#endif
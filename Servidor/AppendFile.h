@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief Archivo abierto solo para agregar al final, sin buffer propio.
+ *
+ * Cada write() llega al sistema operativo en una sola llamada (o las que hagan falta si la
+ * escritura es parcial) y sync() lo baja al disco, cosa que std::ofstream no permite.
+ */
+class AppendFile
+{
+public:
+    AppendFile() = default;
+    ~AppendFile();
+
+    AppendFile(const AppendFile &) = delete;
+    AppendFile &operator=(const AppendFile &) = delete;
+
+    // Abre (o crea) @p path; con @p truncate descarta lo que tuviera
+    bool open(const std::string &path, bool truncate);
+
+    bool isOpen() const;
+
+    // Escribe todo @p bytes al final; false si falló
+    bool write(std::string_view bytes);
+
+    // Baja al disco lo escrito (fdatasync / FlushFileBuffers)
+    bool sync();
+
+    void close();
+
+private:
+#ifdef _WIN32
+    void *handle = nullptr; // HANDLE; nullptr si está cerrado
+#else
+    int fd = -1;
+#endif
+};
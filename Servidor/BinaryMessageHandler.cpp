@@ -26,82 +26,154 @@ std::string urlDecode(const std::string &value)
 
 // Función para construir un mensaje binario:
 // Se inserta primero el código (1 byte), luego para cada campo se agrega 1 byte con la longitud y finalmente los datos.
-std::vector<unsigned char> buildBinaryMessage(uint8_t code, 
-    const std::vector<std::vector<unsigned char>>& fields, bool omitFirstLength) {
-    
-    std::vector<unsigned char> message;
+PooledBytes buildBinaryMessage(uint8_t code, std::initializer_list<std::string_view> fields) {
+    size_t total = 1;
+    for (const auto &field : fields)
+        total += 1 + field.size();
+
+    PooledBytes message;
+    message.reserve(total);
     message.push_back(code);
-    
-    for (size_t i = 0; i < fields.size(); ++i) {
-        if (i == 0 && omitFirstLength) {
-            // Para el primer campo, omitir el byte de longitud
-            message.insert(message.end(), fields[i].begin(), fields[i].end());
-        } else {
-            if (fields[i].size() > 255)
-                throw std::runtime_error("El tamaño del campo excede 255 bytes.");
-            message.push_back(static_cast<unsigned char>(fields[i].size()));
-            message.insert(message.end(), fields[i].begin(), fields[i].end());
-        }
+
+    for (const auto &field : fields) {
+        appendField(message, field);
     }
     return message;
 }
 
-std::vector<unsigned char> buildRawBinaryMessage(
-    uint8_t code,
-    const std::vector<std::vector<unsigned char>>& fields
-) {
-    std::vector<unsigned char> message;
-    message.push_back(code); 
-
-    for (const auto& field : fields) {
-        message.insert(message.end(), field.begin(), field.end());
-    }
-
+PooledBytes buildRawBinaryMessage(uint8_t code, std::initializer_list<uint8_t> bytes) {
+    PooledBytes message;
+    message.reserve(1 + bytes.size());
+    message.push_back(code);
+    message.insert(message.end(), bytes.begin(), bytes.end());
     return message;
 }
 
+void appendField(PooledBytes &message, std::string_view field) {
+    if (field.size() > 255)
+        throw std::runtime_error("El tamaño del campo excede 255 bytes.");
+    message.push_back(static_cast<unsigned char>(field.size()));
+    message.insert(message.end(), field.begin(), field.end());
+}
+
 // Función para parsear un mensaje binario:
 // Lee el primer byte como código y luego recorre el buffer para extraer cada campo usando el byte de longitud.
-ParsedMessage parseBinaryMessage(const std::vector<unsigned char>& buffer) {
-    if (buffer.empty()) {
+// Se parsea directo desde el buffer de lectura, sin copiar la trama completa.
+ParsedMessage parseBinaryMessage(const unsigned char *buffer, size_t size) {
+    if (size == 0) {
         throw std::runtime_error("Buffer vacío.");
     }
     ParsedMessage parsed;
+    parsed.fields.reserve(4);
     size_t pos = 0;
     parsed.code = buffer[pos++];
 
+    // Los sub-pedidos de un BATCH no usan campos de 1 byte; se leen con parseBatchMessage
+    if (parsed.code == MessageCode::BATCH) {
+        return parsed;
+    }
+
     if (parsed.code == 3) { 
-        if (pos >= buffer.size()) {
+        if (pos >= size) {
             throw std::runtime_error("Faltan datos para username.");
         }
 
         uint8_t len = buffer[pos++];
-        if (pos + len > buffer.size()) {
+        if (pos + len > size) {
             throw std::runtime_error("Longitud de username inválida.");
         }
 
-        std::vector<unsigned char> username(buffer.begin() + pos, buffer.begin() + pos + len);
-        parsed.fields.push_back(username);
+        parsed.fields.emplace_back(buffer + pos, buffer + pos + len);
         pos += len;
 
-        if (pos >= buffer.size()) {
+        if (pos >= size) {
             throw std::runtime_error("Falta el byte de estado.");
         }
 
-        std::vector<unsigned char> status = { buffer[pos++] };
-        parsed.fields.push_back(status);
+        parsed.fields.emplace_back(1, buffer[pos++]);
+
+        return parsed;
+    }
+
+    // SEARCH_USERS: prefijo y, si viene, un byte con la cantidad máxima de resultados
+    if (parsed.code == MessageCode::SEARCH_USERS) {
+        if (pos >= size) {
+            throw std::runtime_error("Falta el prefijo.");
+        }
+
+        uint8_t len = buffer[pos++];
+        if (pos + len > size) {
+            throw std::runtime_error("Longitud de prefijo inválida.");
+        }
+
+        parsed.fields.emplace_back(buffer + pos, buffer + pos + len);
+        pos += len;
+
+        if (pos < size) {
+            parsed.fields.emplace_back(1, buffer[pos++]);
+        }
+        return parsed;
+    }
+
+    // SEARCH_HISTORY: conversación ("~" para el general), texto a buscar y, si viene, un byte
+    // con la cantidad máxima de resultados
+    if (parsed.code == MessageCode::SEARCH_HISTORY) {
+        for (const char *what : {"conversación", "texto"}) {
+            if (pos >= size) {
+                throw std::runtime_error(std::string("Falta el campo de ") + what + ".");
+            }
+            uint8_t len = buffer[pos++];
+            if (pos + len > size) {
+                throw std::runtime_error(std::string("Longitud de ") + what + " inválida.");
+            }
+            parsed.fields.emplace_back(buffer + pos, buffer + pos + len);
+            pos += len;
+        }
 
+        if (pos < size) {
+            parsed.fields.emplace_back(1, buffer[pos++]);
+        }
         return parsed;
     }
 
-    while (pos < buffer.size()) {
+    while (pos < size) {
         uint8_t len = buffer[pos++];
-        if (pos + len > buffer.size()) {
+        if (pos + len > size) {
             throw std::runtime_error("Longitud de campo inválida.");
         }
-        std::vector<unsigned char> field(buffer.begin() + pos, buffer.begin() + pos + len);
-        parsed.fields.push_back(field);
+        parsed.fields.emplace_back(buffer + pos, buffer + pos + len);
         pos += len;
     }
     return parsed;
-}
\ No newline at end of file
+}
+
+PooledVector<BatchItem> parseBatchMessage(const unsigned char *buffer, size_t size) {
+    if (size < 2) {
+        throw std::runtime_error("Falta la cantidad de sub-pedidos.");
+    }
+    PooledVector<BatchItem> items;
+    uint8_t count = buffer[1];
+    items.reserve(count);
+    size_t pos = 2;
+    for (uint8_t i = 0; i < count; ++i) {
+        if (pos + 2 > size) {
+            throw std::runtime_error("Falta la longitud de un sub-pedido.");
+        }
+        size_t len = (static_cast<size_t>(buffer[pos]) << 8) | buffer[pos + 1];
+        pos += 2;
+        if (len == 0 || pos + len > size) {
+            throw std::runtime_error("Longitud de sub-pedido inválida.");
+        }
+        items.push_back({buffer + pos, len});
+        pos += len;
+    }
+    return items;
+}
+
+void appendBatchItem(PooledBytes &message, const PooledBytes &frame) {
+    if (frame.size() > 0xFFFF)
+        throw std::runtime_error("La respuesta excede 65535 bytes.");
+    message.push_back(static_cast<unsigned char>(frame.size() >> 8));
+    message.push_back(static_cast<unsigned char>(frame.size()));
+    message.insert(message.end(), frame.begin(), frame.end());
+}
@@ -4,6 +4,10 @@
 #include <vector>
 #include <cstdint>
 #include <stdexcept>
+#include <string>
+#include <string_view>
+#include <initializer_list>
+#include "BufferPool.h"
 
 // Función para decodificar una cadena URL
 std::string urlDecode(const std::string &value);
@@ -11,18 +15,34 @@ std::string urlDecode(const std::string &value);
 // Estructura para representar un mensaje binario parseado
 struct ParsedMessage {
     uint8_t code;
-    // Cada campo es un vector de bytes
-    std::vector<std::vector<unsigned char>> fields;
+    // Cada campo es un vector de bytes (reservado en el pool del hilo)
+    PooledVector<PooledBytes> fields;
 };
 
 // Construye un mensaje binario a partir de un código y una lista de campos
-std::vector<unsigned char> buildBinaryMessage(uint8_t code, const std::vector<std::vector<unsigned char>>& fields, bool omitFirstLength = false);
+PooledBytes buildBinaryMessage(uint8_t code, std::initializer_list<std::string_view> fields);
 
 // Construye un mensaje binario sin longitud de campo
-std::vector<unsigned char> buildRawBinaryMessage( uint8_t code, const std::vector<std::vector<unsigned char>>& fields);
+PooledBytes buildRawBinaryMessage(uint8_t code, std::initializer_list<uint8_t> bytes);
+
+// Agrega un campo (1 byte de longitud + datos) al final de un mensaje en construcción
+void appendField(PooledBytes &message, std::string_view field);
+
+// Un sub-pedido dentro de un BATCH; apunta al buffer original
+struct BatchItem {
+    const unsigned char *data;
+    size_t size;
+};
+
+// Separa los sub-pedidos de un BATCH: cantidad (1 byte) y, por cada uno, 2 bytes de longitud
+// (big endian) más el mensaje completo con su código. Lanza si el formato es inválido.
+PooledVector<BatchItem> parseBatchMessage(const unsigned char *buffer, size_t size);
+
+// Agrega una trama como elemento de un RESPONSE_BATCH (2 bytes de longitud + trama)
+void appendBatchItem(PooledBytes &message, const PooledBytes &frame);
 
 // Parsea un buffer de mensaje binario y devuelve la estructura ParsedMessage
-ParsedMessage parseBinaryMessage(const std::vector<unsigned char>& buffer);
+ParsedMessage parseBinaryMessage(const unsigned char *data, size_t size);
 
 // Códigos de mensaje según el protocolo
 namespace MessageCode {
@@ -33,6 +53,12 @@ namespace MessageCode {
     const uint8_t SEND_MESSAGE   = 4;
     const uint8_t GET_HISTORY    = 5;
     const uint8_t LIST_ALL_USERS = 6;
+    const uint8_t GET_HISTORY_STREAM = 7; // Como GET_HISTORY pero la respuesta llega por partes
+    const uint8_t BATCH          = 8; // Cantidad + sub-pedidos (2 bytes de longitud + mensaje)
+    const uint8_t SEARCH_USERS   = 9; // Prefijo + máximo de resultados (1 byte, opcional)
+    const uint8_t SUBSCRIBE_PRESENCE   = 10; // Nombres cuyos cambios de estado se quieren recibir
+    const uint8_t UNSUBSCRIBE_PRESENCE = 11; // Nombres a dejar de seguir (sin nombres: todos)
+    const uint8_t SEARCH_HISTORY = 12; // Conversación ("~" = general) + texto + máximo de resultados (1 byte, opcional)
 
     // Respuestas y notificaciones del servidor
     const uint8_t ERROR_RESPONSE       = 50;
@@ -43,6 +69,18 @@ namespace MessageCode {
     const uint8_t MESSAGE_RECEIVED     = 55;
     const uint8_t RESPONSE_HISTORY     = 56;
     const uint8_t RESPONSE_ALL_USERS   = 57;
+    const uint8_t SESSION_INFO         = 58; // Secuencia de la sesión al conectar (8 bytes) + bandera de reanudación
+    const uint8_t RESPONSE_HISTORY_CHUNK = 59; // Banderas (1 byte) + cantidad + pares usuario/mensaje
+    const uint8_t RESPONSE_BATCH       = 60; // Cantidad + respuestas (2 bytes de longitud + trama), en orden
+    const uint8_t RESPONSE_SEARCH_USERS = 61; // Cantidad + usuarios (como RESPONSE_LIST_USERS), en orden alfabético
+    const uint8_t RESPONSE_PRESENCE    = 62; // Estado actual de los usuarios suscritos: (len + nombre + estado) hasta el final
+    const uint8_t RESPONSE_SEARCH_HISTORY = 63; // Cantidad + pares usuario/mensaje, del más relevante al menos
+}
+
+// Banderas de RESPONSE_HISTORY_CHUNK
+namespace HistoryChunkFlag {
+    const uint8_t FIRST = 1; // Primera parte: el cliente limpia la vista
+    const uint8_t LAST  = 2; // Última parte del historial
 }
 
 // Códigos de error definidos en el protocolo
@@ -51,6 +89,9 @@ namespace ErrorCode {
     const uint8_t INVALID_STATUS     = 2;
     const uint8_t EMPTY_MESSAGE      = 3;
     const uint8_t USER_DISCONNECTED  = 4;
+    const uint8_t UNSUPPORTED_REQUEST = 5; // Sub-pedido que no se puede agrupar en un BATCH
+    const uint8_t INVALID_TEXT       = 6; // El mensaje no es UTF-8 válido
+    const uint8_t MESSAGE_TOO_LONG   = 7; // Mensaje de texto que no entra en un campo (255 bytes)
 }
 
 #endif // BINARY_MESSAGE_HANDLER_H
\ No newline at end of file
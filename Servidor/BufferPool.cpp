@@ -0,0 +1,203 @@
+#include "BufferPool.h"
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+
+namespace {
+
+// Clases de tamaño de los bloques
+const size_t CLASS_SIZES[] = {64, 256, 1024, 4096, 16384, 65536};
+const size_t NUM_CLASSES = sizeof(CLASS_SIZES) / sizeof(CLASS_SIZES[0]);
+
+// Cuando el depósito se queda sin bloques de una clase reserva un slab de este tamaño y lo
+// parte en bloques de esa clase
+const size_t SLAB_BYTES = 256 * 1024;
+
+// Un hilo toma del depósito de a REFILL_BLOCKS bloques, sin pasar de REFILL_BYTES por vez, y
+// guarda libres hasta el doble antes de devolver la mitad. Así ningún hilo se queda con un
+// slab entero de una clase que casi no usa.
+const size_t REFILL_BLOCKS = 32;
+const size_t REFILL_BYTES = 128 * 1024;
+
+struct FreeBlock
+{
+    FreeBlock *next;
+};
+
+struct FreeList
+{
+    FreeBlock *head = nullptr;
+    size_t count = 0;
+
+    void push(FreeBlock *b)
+    {
+        b->next = head;
+        head = b;
+        ++count;
+    }
+
+    FreeBlock *pop()
+    {
+        FreeBlock *b = head;
+        head = b->next;
+        --count;
+        return b;
+    }
+};
+
+std::atomic<uint64_t> statAllocations{0};
+std::atomic<uint64_t> statReused{0};
+std::atomic<uint64_t> statSlabRefills{0};
+std::atomic<uint64_t> statOversize{0};
+std::atomic<uint64_t> statBytesReserved{0};
+
+// Depósito compartido: reserva los slabs y reparte sus bloques de a pocos entre los hilos,
+// que le devuelven los sobrantes y todo lo suyo al terminar. Los slabs nunca se liberan, así
+// un bloque puede pasar de un hilo a otro sin problema.
+struct Depot
+{
+    std::mutex mutex;
+    FreeList lists[NUM_CLASSES];
+
+    // Parte un slab nuevo en bloques de la clase; llamar con mutex tomado
+    void carveSlab(size_t cls)
+    {
+        size_t size = CLASS_SIZES[cls];
+        char *slab = static_cast<char *>(std::malloc(SLAB_BYTES));
+        if (!slab)
+            throw std::bad_alloc();
+        statSlabRefills.fetch_add(1, std::memory_order_relaxed);
+        statBytesReserved.fetch_add(SLAB_BYTES, std::memory_order_relaxed);
+        for (size_t i = SLAB_BYTES / size; i-- > 0;)
+            lists[cls].push(reinterpret_cast<FreeBlock *>(slab + i * size));
+    }
+};
+
+Depot depot;
+
+size_t classIndex(size_t bytes)
+{
+    for (size_t i = 0; i < NUM_CLASSES; ++i)
+    {
+        if (bytes <= CLASS_SIZES[i])
+            return i;
+    }
+    return NUM_CLASSES;
+}
+
+size_t refillBlocks(size_t cls)
+{
+    size_t blocks = REFILL_BYTES / CLASS_SIZES[cls];
+    return blocks > REFILL_BLOCKS ? REFILL_BLOCKS : blocks;
+}
+
+size_t cacheLimit(size_t cls)
+{
+    return 2 * refillBlocks(cls);
+}
+
+// Mueve hasta `n` bloques de una lista a otra
+void transfer(FreeList &from, FreeList &to, size_t n)
+{
+    while (n-- > 0 && from.head)
+        to.push(from.pop());
+}
+
+thread_local bool cacheDestroyed = false;
+
+struct ThreadCache
+{
+    FreeList lists[NUM_CLASSES];
+
+    ~ThreadCache()
+    {
+        std::lock_guard<std::mutex> lock(depot.mutex);
+        for (size_t i = 0; i < NUM_CLASSES; ++i)
+            transfer(lists[i], depot.lists[i], lists[i].count);
+        cacheDestroyed = true;
+    }
+
+    // Recarga la lista de una clase con unos pocos bloques del depósito
+    void refill(size_t cls)
+    {
+        std::lock_guard<std::mutex> lock(depot.mutex);
+        if (!depot.lists[cls].head)
+            depot.carveSlab(cls);
+        transfer(depot.lists[cls], lists[cls], refillBlocks(cls));
+    }
+};
+
+thread_local ThreadCache cache;
+
+} // namespace
+
+void *poolAllocate(size_t bytes)
+{
+    statAllocations.fetch_add(1, std::memory_order_relaxed);
+
+    size_t cls = classIndex(bytes);
+    if (cls == NUM_CLASSES)
+    {
+        statOversize.fetch_add(1, std::memory_order_relaxed);
+        void *p = std::malloc(bytes);
+        if (!p)
+            throw std::bad_alloc();
+        return p;
+    }
+
+    if (cacheDestroyed)
+    {
+        // El hilo está terminando: se atiende directo desde el depósito
+        std::lock_guard<std::mutex> lock(depot.mutex);
+        if (!depot.lists[cls].head)
+            depot.carveSlab(cls);
+        return depot.lists[cls].pop();
+    }
+
+    if (cache.lists[cls].head)
+        statReused.fetch_add(1, std::memory_order_relaxed);
+    else
+        cache.refill(cls);
+    return cache.lists[cls].pop();
+}
+
+void poolDeallocate(void *p, size_t bytes)
+{
+    if (!p)
+        return;
+
+    size_t cls = classIndex(bytes);
+    if (cls == NUM_CLASSES)
+    {
+        std::free(p);
+        return;
+    }
+
+    FreeBlock *block = static_cast<FreeBlock *>(p);
+    if (cacheDestroyed)
+    {
+        std::lock_guard<std::mutex> lock(depot.mutex);
+        depot.lists[cls].push(block);
+        return;
+    }
+
+    FreeList &list = cache.lists[cls];
+    list.push(block);
+    if (list.count > cacheLimit(cls))
+    {
+        // Un hilo que libera bloques ajenos (p. ej. el que escribe a los sockets) no debe acapararlos
+        std::lock_guard<std::mutex> lock(depot.mutex);
+        transfer(list, depot.lists[cls], list.count / 2);
+    }
+}
+
+BufferPoolStats bufferPoolStats()
+{
+    return BufferPoolStats{
+        statAllocations.load(std::memory_order_relaxed),
+        statReused.load(std::memory_order_relaxed),
+        statSlabRefills.load(std::memory_order_relaxed),
+        statOversize.load(std::memory_order_relaxed),
+        statBytesReserved.load(std::memory_order_relaxed)};
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Estadísticas acumuladas de los pools de buffers de todos los hilos.
+ */
+struct BufferPoolStats
+{
+    uint64_t allocations;   // Pedidos atendidos por el pool
+    uint64_t reused;        // Pedidos atendidos con un bloque libre (sin tocar el heap)
+    uint64_t slabRefills;   // Slabs nuevos reservados (única llamada a malloc del pool)
+    uint64_t oversize;      // Pedidos más grandes que la clase mayor (van directo al heap)
+    uint64_t bytesReserved; // Memoria total reservada en slabs
+};
+
+/**
+ * @brief Reserva un bloque del pool del hilo actual.
+ *
+ * Los pedidos se redondean a la clase de tamaño más cercana (64 B a 64 KiB). Cada hilo
+ * mantiene su propia lista libre por clase, así que en estado estable los mensajes
+ * reutilizan bloques sin llamar a malloc/free.
+ *
+ * @param bytes Tamaño pedido.
+ * @return void* Bloque de al menos @p bytes bytes.
+ */
+void *poolAllocate(size_t bytes);
+
+/**
+ * @brief Devuelve un bloque al pool del hilo actual (puede venir de otro hilo).
+ *
+ * @param p     Bloque obtenido con poolAllocate.
+ * @param bytes El mismo tamaño con el que se pidió.
+ */
+void poolDeallocate(void *p, size_t bytes);
+
+/**
+ * @brief Devuelve una copia de las estadísticas globales del pool.
+ */
+BufferPoolStats bufferPoolStats();
+
+// Allocator estándar sobre el pool por hilo, para usarlo en contenedores STL y Beast
+template <typename T>
+struct PoolAllocator
+{
+    using value_type = T;
+
+    PoolAllocator() noexcept = default;
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U> &) noexcept {}
+
+    T *allocate(size_t n) { return static_cast<T *>(poolAllocate(n * sizeof(T))); }
+    void deallocate(T *p, size_t n) noexcept { poolDeallocate(p, n * sizeof(T)); }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U> &) const noexcept { return true; }
+    template <typename U>
+    bool operator!=(const PoolAllocator<U> &) const noexcept { return false; }
+};
+
+template <typename T>
+using PooledVector = std::vector<T, PoolAllocator<T>>;
+
+// Buffer de bytes de una trama (entrante o saliente)
+using PooledBytes = PooledVector<unsigned char>;
@@ -0,0 +1,333 @@
+#include "ClusterLink.h"
+#include "BinaryMessageHandler.h"
+#include <deque>
+#include <iostream>
+
+namespace asio = boost::asio;
+using tcp = asio::ip::tcp;
+
+// Tramas encoladas hacia un nodo que no lee; pasado esto se corta el enlace y, al volver,
+// el nodo recibe de nuevo el estado de todos los usuarios
+static const size_t MAX_QUEUED_BYTES = 64 * 1024 * 1024;
+static const auto REDIAL_DELAY = std::chrono::seconds(1);
+// Un enlace que no se identifica en este tiempo se cierra
+static const auto HELLO_TIMEOUT = std::chrono::seconds(5);
+
+struct ClusterLink::Link
+{
+    explicit Link(tcp::socket s) : socket(std::move(s)), helloTimer(socket.get_executor()) {}
+
+    tcp::socket socket;
+    asio::steady_timer helloTimer;
+    std::unique_ptr<ClusterPeer> dialed; // Solo en los enlaces que abrió este nodo: a quién volver a llamar
+    uint16_t node = 0;                   // 0 hasta recibir su HELLO
+    unsigned char header[2];
+    PooledBytes body;
+    std::deque<PooledBytes> queue;       // Tramas con su longitud delante, en orden
+    size_t queuedBytes = 0;
+    bool writing = false;
+    bool closed = false;
+};
+
+ClusterLink::~ClusterLink()
+{
+    stop();
+}
+
+bool ClusterLink::start(uint16_t id, const std::string &bindAddress, uint16_t port, const std::string &sharedSecret,
+                        const std::vector<ClusterPeer> &peers, FrameHandler frameHandler, PeerHandler peerHandler)
+{
+    nodeId = id;
+    secret = sharedSecret;
+    onFrame = std::move(frameHandler);
+    onPeer = std::move(peerHandler);
+    try {
+        acceptor = std::make_unique<tcp::acceptor>(io, tcp::endpoint(asio::ip::make_address(bindAddress), port));
+    } catch (const std::exception &e) {
+        std::cerr << "[ERROR] ClusterLink: No se pudo escuchar en " << bindAddress << ":" << port << ": " << e.what() << std::endl;
+        return false;
+    }
+
+    acceptNext();
+    for (const auto &peer : peers)
+        if (peer.id < nodeId)
+            dial(peer);
+
+    thread = std::thread([this] {
+        while (true)
+        {
+            try {
+                io.run();
+                return;
+            } catch (const std::exception &e) {
+                std::cerr << "[ERROR] ClusterLink: " << e.what() << std::endl;
+            }
+        }
+    });
+    return true;
+}
+
+void ClusterLink::stop()
+{
+    if (!thread.joinable())
+        return;
+    io.stop();
+    thread.join();
+}
+
+void ClusterLink::send(uint16_t node, PooledBytes frame)
+{
+    asio::post(io, [this, node, frame = std::move(frame)] {
+        auto it = links.find(node);
+        if (it != links.end())
+            queueFrame(it->second, frame);
+    });
+}
+
+void ClusterLink::broadcast(const PooledBytes &frame)
+{
+    asio::post(io, [this, frame] {
+        for (auto &[node, link] : links)
+            queueFrame(link, frame);
+    });
+}
+
+bool ClusterLink::sameSecret(const unsigned char *data, size_t size) const
+{
+    // Se recorre entero aunque difiera al principio, así el tiempo no dice cuánto coincidió
+    if (size != secret.size())
+        return false;
+    unsigned char diff = 0;
+    for (size_t i = 0; i < size; ++i)
+        diff |= data[i] ^ static_cast<unsigned char>(secret[i]);
+    return diff == 0;
+}
+
+void ClusterLink::acceptNext()
+{
+    acceptor->async_accept([this](const boost::system::error_code &ec, tcp::socket socket) {
+        if (ec)
+        {
+            if (ec != asio::error::operation_aborted)
+                acceptNext();
+            return;
+        }
+        startLink(std::make_shared<Link>(std::move(socket)));
+        acceptNext();
+    });
+}
+
+void ClusterLink::dial(const ClusterPeer &peer)
+{
+    auto resolver = std::make_shared<tcp::resolver>(io);
+    resolver->async_resolve(peer.host, std::to_string(peer.port),
+        [this, peer, resolver](const boost::system::error_code &ec, tcp::resolver::results_type endpoints) {
+            if (ec)
+            {
+                redialLater(peer);
+                return;
+            }
+            auto socket = std::make_shared<tcp::socket>(io);
+            asio::async_connect(*socket, endpoints,
+                [this, peer, socket](const boost::system::error_code &ec, const tcp::endpoint &) {
+                    // El otro nodo puede no haber arrancado todavía: se reintenta sin avisar
+                    if (ec)
+                    {
+                        redialLater(peer);
+                        return;
+                    }
+                    auto link = std::make_shared<Link>(std::move(*socket));
+                    link->dialed = std::make_unique<ClusterPeer>(peer);
+                    startLink(link);
+                });
+        });
+}
+
+void ClusterLink::redialLater(const ClusterPeer &peer)
+{
+    auto timer = std::make_shared<asio::steady_timer>(io, REDIAL_DELAY);
+    timer->async_wait([this, peer, timer](const boost::system::error_code &ec) {
+        if (!ec)
+            dial(peer);
+    });
+}
+
+void ClusterLink::startLink(std::shared_ptr<Link> link)
+{
+    boost::system::error_code ignored;
+    link->socket.set_option(tcp::no_delay(true), ignored);
+    link->socket.set_option(asio::socket_base::keep_alive(true), ignored);
+
+    // Quien llama se presenta primero; quien acepta responde recién cuando la clave coincide,
+    // así una conexión cualquiera al puerto no se lleva la clave
+    if (link->dialed)
+        sendHello(link);
+
+    link->helloTimer.expires_after(HELLO_TIMEOUT);
+    link->helloTimer.async_wait([this, link](const boost::system::error_code &ec) {
+        if (!ec && link->node == 0)
+            closeLink(link, "sin HELLO");
+    });
+    readNext(std::move(link));
+}
+
+void ClusterLink::sendHello(const std::shared_ptr<Link> &link)
+{
+    unsigned char id[2] = {static_cast<unsigned char>(nodeId >> 8), static_cast<unsigned char>(nodeId)};
+    queueFrame(link, buildBinaryMessage(ClusterCode::HELLO, {std::string_view(reinterpret_cast<const char *>(id), 2), secret}));
+}
+
+void ClusterLink::readNext(std::shared_ptr<Link> link)
+{
+    asio::async_read(link->socket, asio::buffer(link->header),
+        [this, link](const boost::system::error_code &ec, size_t) {
+            if (ec)
+            {
+                closeLink(link, ec.message().c_str());
+                return;
+            }
+            size_t len = (static_cast<size_t>(link->header[0]) << 8) | link->header[1];
+            if (len == 0)
+            {
+                closeLink(link, "trama vacía");
+                return;
+            }
+            link->body.resize(len);
+            asio::async_read(link->socket, asio::buffer(link->body),
+                [this, link](const boost::system::error_code &ec, size_t) {
+                    if (ec)
+                    {
+                        closeLink(link, ec.message().c_str());
+                        return;
+                    }
+                    if (link->node == 0)
+                    {
+                        onHello(link, link->body.data(), link->body.size());
+                    }
+                    else
+                    {
+                        try {
+                            onFrame(link->node, link->body.data(), link->body.size());
+                        } catch (const std::exception &e) {
+                            std::cerr << "[ERROR] ClusterLink: Trama " << static_cast<int>(link->body[0])
+                                      << " del nodo " << link->node << ": " << e.what() << std::endl;
+                        }
+                    }
+                    if (!link->closed)
+                        readNext(link);
+                });
+        });
+}
+
+void ClusterLink::onHello(const std::shared_ptr<Link> &link, const unsigned char *data, size_t size)
+{
+    uint16_t node = 0;
+    try {
+        ParsedMessage pm = parseBinaryMessage(data, size);
+        if (pm.code == ClusterCode::HELLO && pm.fields.size() == 2 && pm.fields[0].size() == 2
+            && sameSecret(pm.fields[1].data(), pm.fields[1].size()))
+            node = static_cast<uint16_t>((pm.fields[0][0] << 8) | pm.fields[0][1]);
+    } catch (const std::exception &) {}
+
+    // Quien abre el enlace es siempre el de ID mayor; el que llama sabe a quién llamó
+    bool expected = link->dialed ? node == link->dialed->id : node > nodeId;
+    if (node == 0 || !expected)
+    {
+        boost::system::error_code ignored;
+        std::cerr << "[CLUSTER] HELLO inválido desde " << link->socket.remote_endpoint(ignored) << std::endl;
+        closeLink(link, "HELLO inválido");
+        return;
+    }
+
+    link->node = node;
+    link->helloTimer.cancel();
+    if (!link->dialed)
+        sendHello(link);
+    auto it = links.find(node);
+    if (it != links.end())
+    {
+        // El nodo volvió a conectarse antes de que se notara el corte del enlace anterior
+        it->second->closed = true;
+        boost::system::error_code ignored;
+        it->second->socket.close(ignored);
+        it->second = link;
+    }
+    else
+    {
+        links.emplace(node, link);
+    }
+    std::cout << "[CLUSTER] Enlace con el nodo " << node << " establecido" << std::endl;
+    onPeer(node, true);
+}
+
+void ClusterLink::queueFrame(const std::shared_ptr<Link> &link, const PooledBytes &frame)
+{
+    if (link->closed)
+        return;
+    if (frame.size() > 0xFFFF)
+    {
+        std::cerr << "[ERROR] ClusterLink: La trama " << static_cast<int>(frame[0]) << " excede 65535 bytes" << std::endl;
+        return;
+    }
+    if (link->queuedBytes + frame.size() > MAX_QUEUED_BYTES)
+    {
+        closeLink(link, "cola de salida llena");
+        return;
+    }
+
+    PooledBytes framed;
+    framed.reserve(2 + frame.size());
+    framed.push_back(static_cast<unsigned char>(frame.size() >> 8));
+    framed.push_back(static_cast<unsigned char>(frame.size()));
+    framed.insert(framed.end(), frame.begin(), frame.end());
+    link->queuedBytes += framed.size();
+    link->queue.push_back(std::move(framed));
+    if (!link->writing)
+        writeNext(link);
+}
+
+void ClusterLink::writeNext(std::shared_ptr<Link> link)
+{
+    if (link->queue.empty() || link->closed)
+    {
+        link->writing = false;
+        return;
+    }
+    link->writing = true;
+    asio::async_write(link->socket, asio::buffer(link->queue.front()),
+        [this, link](const boost::system::error_code &ec, size_t) {
+            if (ec)
+            {
+                closeLink(link, ec.message().c_str());
+                return;
+            }
+            // closeLink ya vació la cola aunque la escritura haya terminado bien
+            if (link->closed)
+                return;
+            link->queuedBytes -= link->queue.front().size();
+            link->queue.pop_front();
+            writeNext(link);
+        });
+}
+
+void ClusterLink::closeLink(const std::shared_ptr<Link> &link, const char *why)
+{
+    if (link->closed)
+        return;
+    link->closed = true;
+    link->helloTimer.cancel();
+    boost::system::error_code ignored;
+    link->socket.close(ignored);
+    link->queue.clear();
+    link->queuedBytes = 0;
+
+    auto it = link->node ? links.find(link->node) : links.end();
+    if (it != links.end() && it->second == link)
+    {
+        links.erase(it);
+        std::cerr << "[CLUSTER] Enlace con el nodo " << link->node << " cortado: " << why << std::endl;
+        onPeer(link->node, false);
+    }
+    if (link->dialed)
+        redialLater(*link->dialed);
+}
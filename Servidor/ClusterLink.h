@@ -0,0 +1,96 @@
+#pragma once
+
+// boost 1.74 usa std::exchange en awaitable.hpp sin incluir <utility>
+#include <utility>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include "BufferPool.h"
+#include "ServerConfig.h"
+
+// Tramas entre nodos del cluster. Usan el mismo formato que las de los clientes (código y
+// campos con 1 byte de longitud) y en el socket van precedidas por 2 bytes de longitud
+// (big endian), como los sub-pedidos de un BATCH.
+namespace ClusterCode {
+    const uint8_t HELLO        = 100; // ID del nodo que habla (2 bytes, big endian) + cluster_secret
+    const uint8_t USER_STATUS  = 101; // Nombre + estado (1 byte): el usuario está en el nodo que lo envía
+    const uint8_t USER_JOINED  = 102; // Nombre + IP: el usuario se acaba de conectar (USER_REGISTERED)
+    const uint8_t CHAT_GENERAL = 103; // Remitente + mensaje del chat general
+    const uint8_t CHAT_PRIVATE = 104; // Remitente + destinatario + mensaje
+}
+
+/**
+ * @brief Enlaces TCP entre los nodos del cluster.
+ *
+ * Cada par de nodos comparte una sola conexión: la abre el de ID mayor y la acepta el de ID
+ * menor, que se identifican con HELLO al conectar y deben traer el mismo cluster_secret;
+ * la que no lo manda en 5 segundos se cierra. Si se corta, el que la abrió reintenta cada
+ * segundo. Todo corre en un hilo propio; send() y broadcast() se pueden llamar desde
+ * cualquier hilo y las tramas salen en el orden en que se pidieron.
+ *
+ * La clase solo transporta tramas: qué significan lo decide quien la usa (server.cpp) con
+ * los callbacks de start(), que se llaman desde el hilo del enlace.
+ */
+class ClusterLink
+{
+public:
+    // Trama completa (código + campos) recibida del nodo @p node
+    using FrameHandler = std::function<void(uint16_t node, const unsigned char *data, size_t size)>;
+    // El enlace con @p node quedó listo (up) o se cortó
+    using PeerHandler = std::function<void(uint16_t node, bool up)>;
+
+    ~ClusterLink();
+
+    /**
+     * @brief Empieza a escuchar en @p bindAddress:@p port y a conectarse con los nodos de ID menor.
+     *
+     * @param secret Clave compartida que todos los nodos mandan en su HELLO.
+     * @return bool false si no se pudo abrir el puerto (ya reportado por std::cerr).
+     */
+    bool start(uint16_t nodeId, const std::string &bindAddress, uint16_t port, const std::string &secret,
+               const std::vector<ClusterPeer> &peers, FrameHandler onFrame, PeerHandler onPeer);
+
+    // Cierra los enlaces y espera al hilo. No se llama a onPeer por los cierres.
+    void stop();
+
+    // Hay cluster configurado (start() se llamó y todavía no se llamó a stop())
+    bool enabled() const { return thread.joinable(); }
+
+    uint16_t localNode() const { return nodeId; }
+
+    // Envía una trama a un nodo; si no hay enlace con él se descarta
+    void send(uint16_t node, PooledBytes frame);
+
+    // Envía una trama a todos los nodos conectados
+    void broadcast(const PooledBytes &frame);
+
+private:
+    struct Link;
+
+    // Todo lo que sigue se usa solo desde el hilo del enlace
+    void acceptNext();
+    void dial(const ClusterPeer &peer);
+    void redialLater(const ClusterPeer &peer);
+    void startLink(std::shared_ptr<Link> link);
+    void sendHello(const std::shared_ptr<Link> &link);
+    void readNext(std::shared_ptr<Link> link);
+    void onHello(const std::shared_ptr<Link> &link, const unsigned char *data, size_t size);
+    bool sameSecret(const unsigned char *data, size_t size) const;
+    void queueFrame(const std::shared_ptr<Link> &link, const PooledBytes &frame);
+    void writeNext(std::shared_ptr<Link> link);
+    void closeLink(const std::shared_ptr<Link> &link, const char *why);
+
+    uint16_t nodeId = 0;
+    std::string secret;
+    boost::asio::io_context io;
+    std::unique_ptr<boost::asio::ip::tcp::acceptor> acceptor;
+    std::map<uint16_t, std::shared_ptr<Link>> links; // Enlaces ya identificados, por nodo
+    FrameHandler onFrame;
+    PeerHandler onPeer;
+    std::thread thread;
+};
@@ -0,0 +1,173 @@
+#include "CompressedSegment.h"
+#include "AppendFile.h"
+#include <boost/beast/zlib.hpp>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+namespace zlib = boost::beast::zlib;
+
+static const char MAGIC[8] = {'Y', 'A', 'P', 'P', 'S', 'E', 'G', 'Z'};
+static const uint32_t VERSION = 1;
+static const size_t HEADER_BYTES = sizeof MAGIC + 2 * sizeof(uint32_t) + sizeof(uint64_t);
+static const size_t BLOCK_ENTRY_BYTES = 2 * sizeof(uint64_t) + 2 * sizeof(uint32_t);
+
+template <typename T>
+static void putRaw(std::string &out, T value)
+{
+    out.append(reinterpret_cast<const char *>(&value), sizeof value);
+}
+
+template <typename T>
+static T getRaw(const char *data)
+{
+    T value;
+    std::memcpy(&value, data, sizeof value);
+    return value;
+}
+
+size_t CompressedSegment::write(std::string_view raw, const uint64_t *recordEnds, size_t records,
+                                size_t blockBytes, const std::string &path)
+{
+    // Bloques: se cortan en el último fin de registro que no pase blockBytes (un registro
+    // más grande que el bloque va solo)
+    std::vector<Block> table;
+    std::vector<std::string> compressed;
+    zlib::deflate_stream deflater;
+    uint64_t start = 0;
+    size_t next = 0;
+    while (start < raw.size() && next < records)
+    {
+        uint64_t end = recordEnds[next++];
+        while (next < records && recordEnds[next] - start <= blockBytes)
+            end = recordEnds[next++];
+
+        std::string out;
+        deflater.reset(6, 15, 8, zlib::Strategy::normal);
+        out.resize(deflater.upper_bound(end - start));
+        zlib::z_params zs;
+        zs.next_in = raw.data() + start;
+        zs.avail_in = end - start;
+        zs.next_out = &out[0];
+        zs.avail_out = out.size();
+        boost::system::error_code ec;
+        deflater.write(zs, zlib::Flush::finish, ec);
+        if ((ec && ec != zlib::error::end_of_stream) || zs.avail_in != 0)
+        {
+            std::cerr << "[ERROR] CompressedSegment: No se pudo comprimir un bloque de " << path << std::endl;
+            return 0;
+        }
+        out.resize(zs.total_out);
+        table.push_back({start, static_cast<uint32_t>(end - start), 0, static_cast<uint32_t>(out.size())});
+        compressed.push_back(std::move(out));
+        start = end;
+    }
+
+    std::string head;
+    head.append(MAGIC, sizeof MAGIC);
+    putRaw(head, VERSION);
+    putRaw(head, static_cast<uint32_t>(table.size()));
+    putRaw(head, static_cast<uint64_t>(start));
+    uint64_t fileOffset = HEADER_BYTES + table.size() * BLOCK_ENTRY_BYTES;
+    for (auto &b : table)
+    {
+        b.fileOffset = fileOffset;
+        fileOffset += b.compressedSize;
+        putRaw(head, b.rawOffset);
+        putRaw(head, b.rawSize);
+        putRaw(head, b.fileOffset);
+        putRaw(head, b.compressedSize);
+    }
+
+    // Se baja al disco antes del rename: después el segmento original se borra
+    std::string tmp = path + ".tmp";
+    AppendFile out;
+    bool ok = out.open(tmp, true) && out.write(head);
+    for (size_t i = 0; ok && i < compressed.size(); ++i)
+        ok = out.write(compressed[i]);
+    ok = ok && out.sync();
+    out.close();
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        std::cerr << "[ERROR] CompressedSegment: No se pudo escribir " << path << std::endl;
+        std::remove(tmp.c_str());
+        return 0;
+    }
+    return static_cast<size_t>(fileOffset);
+}
+
+bool CompressedSegment::open(std::shared_ptr<const MappedFile> mapped)
+{
+    file = std::move(mapped);
+    if (!file || file->size() < HEADER_BYTES || std::memcmp(file->data(), MAGIC, sizeof MAGIC) != 0)
+        return false;
+    const char *p = file->data() + sizeof MAGIC;
+    if (getRaw<uint32_t>(p) != VERSION)
+        return false;
+    blocks = getRaw<uint32_t>(p + 4);
+    rawBytes = getRaw<uint64_t>(p + 8);
+    if (HEADER_BYTES + uint64_t{blocks} * BLOCK_ENTRY_BYTES > file->size())
+        return false;
+    for (size_t i = 0; i < blocks; ++i)
+    {
+        Block b = block(i);
+        if (b.fileOffset + b.compressedSize > file->size())
+            return false;
+    }
+    return true;
+}
+
+CompressedSegment::Block CompressedSegment::block(size_t i) const
+{
+    const char *p = file->data() + HEADER_BYTES + i * BLOCK_ENTRY_BYTES;
+    return {getRaw<uint64_t>(p), getRaw<uint32_t>(p + 8), getRaw<uint64_t>(p + 12), getRaw<uint32_t>(p + 20)};
+}
+
+bool CompressedSegment::inflateBlock(const Block &b, char *out) const
+{
+    zlib::inflate_stream inflater;
+    zlib::z_params zs;
+    zs.next_in = file->data() + b.fileOffset;
+    zs.avail_in = b.compressedSize;
+    zs.next_out = out;
+    zs.avail_out = b.rawSize;
+    boost::system::error_code ec;
+    inflater.write(zs, zlib::Flush::finish, ec);
+    // Con la salida justa puede quedar sin leer la marca de fin de bloque (need_buffers)
+    return (!ec || ec == zlib::error::end_of_stream || ec == zlib::error::need_buffers) && zs.total_out == b.rawSize;
+}
+
+bool CompressedSegment::readBlockAt(uint64_t offset, std::string &out, uint64_t &start) const
+{
+    // Búsqueda binaria del último bloque que empieza antes de offset
+    size_t lo = 0, hi = blocks;
+    while (hi - lo > 1)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (block(mid).rawOffset <= offset)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    if (blocks == 0)
+        return false;
+    Block b = block(lo);
+    if (offset < b.rawOffset || offset >= b.rawOffset + b.rawSize)
+        return false;
+    out.resize(b.rawSize);
+    start = b.rawOffset;
+    return inflateBlock(b, &out[0]);
+}
+
+bool CompressedSegment::readAll(std::string &out) const
+{
+    out.resize(rawBytes);
+    for (size_t i = 0; i < blocks; ++i)
+    {
+        Block b = block(i);
+        if (b.rawOffset + b.rawSize > rawBytes || !inflateBlock(b, &out[b.rawOffset]))
+            return false;
+    }
+    return true;
+}
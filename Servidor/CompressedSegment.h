@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include "MappedFile.h"
+
+/**
+ * @brief Segmento sellado del historial comprimido por bloques (deflate).
+ *
+ * El contenido original se corta en bloques de a lo sumo history_block_bytes sin partir
+ * registros y cada bloque se comprime por separado, así leer un registro solo descomprime
+ * su bloque. Las posiciones siguen siendo las del segmento sin comprimir: las ubicaciones
+ * del índice no cambian al comprimir.
+ *
+ * Archivo: "YAPPSEGZ", versión (u32), cantidad de bloques (u32), tamaño original (u64) y
+ * una tabla con, por bloque, su posición original (u64), tamaño original (u32), posición
+ * en el archivo (u64) y tamaño comprimido (u32); después los bloques comprimidos.
+ */
+class CompressedSegment
+{
+public:
+    /**
+     * @brief Comprime @p raw en @p path (se escribe aparte y se renombra).
+     *
+     * @param recordEnds Posiciones donde termina cada registro, en orden; los bloques solo
+     * se cortan en ellas.
+     * @return size_t Tamaño del archivo escrito, 0 si falló.
+     */
+    static size_t write(std::string_view raw, const uint64_t *recordEnds, size_t records,
+                        size_t blockBytes, const std::string &path);
+
+    // Lee el encabezado de un archivo ya proyectado; false si no es un segmento válido
+    bool open(std::shared_ptr<const MappedFile> file);
+
+    uint64_t rawSize() const { return rawBytes; }
+
+    /**
+     * @brief Descomprime el bloque que contiene la posición original @p offset.
+     *
+     * @param out Contenido del bloque.
+     * @param start Posición original donde empieza el bloque.
+     */
+    bool readBlockAt(uint64_t offset, std::string &out, uint64_t &start) const;
+
+    // Descomprime el segmento completo
+    bool readAll(std::string &out) const;
+
+private:
+    struct Block
+    {
+        uint64_t rawOffset;
+        uint32_t rawSize;
+        uint64_t fileOffset;
+        uint32_t compressedSize;
+    };
+
+    Block block(size_t i) const;
+    bool inflateBlock(const Block &b, char *out) const;
+
+    std::shared_ptr<const MappedFile> file;
+    uint32_t blocks = 0;
+    uint64_t rawBytes = 0;
+};
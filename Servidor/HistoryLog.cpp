@@ -0,0 +1,832 @@
+#include "HistoryLog.h"
+#include "CompressedSegment.h"
+#include "ServerConfig.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+// Largo fijo del registro antes del usuario: longitud + verificación + secuencia +
+// conversación + fecha + largo del usuario
+static const size_t RECORD_PREFIX = 2 * sizeof(uint32_t);
+static const size_t RECORD_FIXED = 3 * sizeof(uint64_t) + sizeof(uint16_t);
+static const uint32_t MAX_RECORD_PAYLOAD = 64 * 1024 * 1024;
+
+HistorySegment::~HistorySegment()
+{
+    // Primero se suelta la proyección: en Windows un archivo proyectado no se puede borrar
+    mapping.reset();
+    if (obsolete)
+        std::remove(path.c_str());
+}
+
+std::shared_ptr<const MappedFile> HistorySegment::map(uint64_t size)
+{
+    std::lock_guard<std::mutex> lock(mapMutex);
+    if (!mapping || mapping->size() < size)
+    {
+        auto fresh = std::make_shared<MappedFile>();
+        if (!fresh->open(path) || fresh->size() < size)
+            return nullptr;
+        mapping = std::move(fresh);
+    }
+    return mapping;
+}
+
+// FNV-1a de 32 bits: alcanza para detectar un registro cortado o pisado
+static uint32_t checksum(const char *data, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+template <typename T>
+static void putRaw(std::string &out, T value)
+{
+    out.append(reinterpret_cast<const char *>(&value), sizeof value);
+}
+
+template <typename T>
+static T getRaw(const char *data)
+{
+    T value;
+    std::memcpy(&value, data, sizeof value);
+    return value;
+}
+
+static uint64_t nowSeconds()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+// Arma un registro con secuencia 0 y sin suma de verificación; sealRecord() las completa
+static std::string buildRecord(uint64_t conversation, uint64_t time, std::string_view user, std::string_view msg)
+{
+    user = user.substr(0, 0xFFFF);
+    std::string bytes;
+    bytes.reserve(RECORD_PREFIX + RECORD_FIXED + user.size() + msg.size());
+    bytes.resize(RECORD_PREFIX);
+    putRaw(bytes, uint64_t{0});
+    putRaw(bytes, conversation);
+    putRaw(bytes, time);
+    putRaw(bytes, static_cast<uint16_t>(user.size()));
+    bytes.append(user);
+    bytes.append(msg);
+    return bytes;
+}
+
+static void sealRecord(std::string &bytes, uint64_t seq)
+{
+    uint32_t length = static_cast<uint32_t>(bytes.size() - RECORD_PREFIX);
+    std::memcpy(&bytes[RECORD_PREFIX], &seq, sizeof seq);
+    uint32_t sum = checksum(bytes.data() + RECORD_PREFIX, length);
+    std::memcpy(&bytes[0], &length, sizeof length);
+    std::memcpy(&bytes[sizeof length], &sum, sizeof sum);
+}
+
+bool HistoryLog::parseRecord(const char *data, size_t size, uint64_t offset, RecordView &rec, bool verify)
+{
+    if (offset + RECORD_PREFIX > size)
+        return false;
+    const char *p = data + offset;
+    uint32_t length = getRaw<uint32_t>(p);
+    if (length < RECORD_FIXED || length > size - offset - RECORD_PREFIX)
+        return false;
+    if (verify && checksum(p + RECORD_PREFIX, length) != getRaw<uint32_t>(p + sizeof(uint32_t)))
+        return false;
+
+    p += RECORD_PREFIX;
+    rec.seq = getRaw<uint64_t>(p);
+    rec.conversation = getRaw<uint64_t>(p + 8);
+    rec.time = getRaw<uint64_t>(p + 16);
+    uint16_t userLen = getRaw<uint16_t>(p + 24);
+    if (RECORD_FIXED + userLen > length)
+        return false;
+    rec.user = std::string_view(p + RECORD_FIXED, userLen);
+    rec.msg = std::string_view(p + RECORD_FIXED + userLen, length - RECORD_FIXED - userLen);
+    rec.size = static_cast<uint32_t>(RECORD_PREFIX + length);
+    return true;
+}
+
+bool HistoryLog::readRecord(const char *data, size_t size, uint32_t offset, std::string_view &user, std::string_view &msg)
+{
+    RecordView rec;
+    if (!parseRecord(data, size, offset, rec, false))
+        return false;
+    user = rec.user;
+    msg = rec.msg;
+    return true;
+}
+
+HistoryLog::~HistoryLog()
+{
+    close();
+}
+
+std::string HistoryLog::segmentPath(uint32_t id, bool compressed) const
+{
+    char name[32];
+    std::snprintf(name, sizeof name, compressed ? "seg-%08u.z" : "seg-%08u.log", id);
+    return dir + "/" + name;
+}
+
+std::string HistoryLog::indexPath(uint32_t id) const
+{
+    char name[32];
+    std::snprintf(name, sizeof name, "seg-%08u.idx", id);
+    return dir + "/" + name;
+}
+
+bool HistoryLog::loadSegment(const std::shared_ptr<HistorySegment> &segment, uint64_t bytes,
+                             std::shared_ptr<const MappedFile> &file, std::string &unpacked, std::string_view &raw)
+{
+    file = segment->map(segment->compressed ? 1 : bytes);
+    if (!file)
+        return false;
+    if (!segment->compressed)
+    {
+        raw = std::string_view(file->data(), file->size());
+        return true;
+    }
+    CompressedSegment archive;
+    if (!archive.open(file) || !archive.readAll(unpacked))
+        return false;
+    raw = unpacked;
+    return true;
+}
+
+bool HistoryLog::open(const std::string &path)
+{
+    std::lock_guard<std::mutex> writeLock(writeMutex);
+    std::unique_lock<std::mutex> lock(mutex);
+    dir = path;
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    if (ec)
+    {
+        std::cerr << "[ERROR] HistoryLog: No se pudo crear " << dir << ": " << ec.message() << std::endl;
+        return false;
+    }
+
+    // Segmentos existentes, en orden de ID, con o sin comprimir
+    std::map<uint32_t, std::pair<bool, bool>> found; // ID → (hay .log, hay .z)
+    std::map<uint32_t, bool> indexes;                // ID → hay .idx
+    for (const auto &entry : fs::directory_iterator(dir, ec))
+    {
+        unsigned id;
+        std::string name = entry.path().filename().string();
+        if (std::sscanf(name.c_str(), "seg-%8u", &id) != 1)
+            continue;
+        if (name == fs::path(segmentPath(id, false)).filename().string())
+            found[id].first = true;
+        else if (name == fs::path(segmentPath(id, true)).filename().string())
+            found[id].second = true;
+        else if (name == fs::path(indexPath(id)).filename().string())
+            indexes[id] = true;
+        else if (name == fs::path(segmentPath(id, true)).filename().string() + ".tmp"
+                 || name == fs::path(indexPath(id)).filename().string() + ".tmp")
+            fs::remove(entry.path(), ec); // Compresión o índice cortados a medias
+    }
+
+    for (const auto &[id, files] : found)
+    {
+        auto [hasLog, hasCompressed] = files;
+        std::shared_ptr<HistorySegment> segment;
+        uint64_t fileSize = 0;
+        {
+            std::shared_ptr<const MappedFile> file;
+            std::string unpacked;
+            std::string_view raw;
+            if (hasCompressed)
+            {
+                segment = std::make_shared<HistorySegment>(id, segmentPath(id, true), true);
+                if (!loadSegment(segment, 0, file, unpacked, raw))
+                {
+                    std::cerr << "[ERROR] HistoryLog: " << segment->path << " no es un segmento comprimido válido." << std::endl;
+                    if (!hasLog)
+                        continue;
+                    segment.reset();
+                }
+                else if (hasLog)
+                {
+                    // Se cortó entre comprimirlo y borrar el original: vale el comprimido
+                    fs::remove(segmentPath(id, false), ec);
+                }
+            }
+            if (!segment)
+            {
+                segment = std::make_shared<HistorySegment>(id, segmentPath(id, false));
+                fileSize = fs::file_size(segment->path, ec);
+                if (fileSize > 0 && !loadSegment(segment, fileSize, file, unpacked, raw))
+                {
+                    std::cerr << "[ERROR] HistoryLog: No se pudo leer " << segment->path << ", se ignora." << std::endl;
+                    continue;
+                }
+            }
+
+            // Con seg-N.idx los términos ya están separados; si no, se separan al recorrerlo
+            segment->indexed = indexes.count(id) && searchIndex.merge(indexPath(id));
+            RecordView rec;
+            while (parseRecord(raw.data(), raw.size(), segment->bytes, rec, true))
+            {
+                index[rec.conversation].refs.push_back({rec.seq, id, static_cast<uint32_t>(segment->bytes), rec.size,
+                                                        static_cast<uint32_t>(rec.time)});
+                if (!segment->indexed)
+                    searchIndex.add(rec.conversation, rec.seq, rec.msg);
+                nextSeq = std::max(nextSeq, rec.seq + 1);
+                segment->bytes += rec.size;
+                ++segment->records;
+            }
+            if (segment->compressed)
+                fileSize = segment->bytes;
+        }
+        if (segment->bytes < fileSize)
+        {
+            // Lo que sigue a un registro inválido no se puede recorrer: se descarta
+            std::cerr << "[ERROR] HistoryLog: " << (fileSize - segment->bytes) << " bytes inválidos al final de "
+                      << segment->path << ", se descartan." << std::endl;
+            fs::resize_file(segment->path, segment->bytes, ec);
+        }
+        segments.emplace(id, segment);
+    }
+
+    // Índices de segmentos que ya no existen (la compactación se cortó antes de borrarlos)
+    for (const auto &[id, present] : indexes)
+        if (segments.count(id) == 0)
+            fs::remove(indexPath(id), ec);
+    searchIndex.finishLoading();
+
+    // Una compactación cortada puede dejar un registro en dos segmentos: vale uno solo
+    for (auto &[conversation, conv] : index)
+    {
+        auto &refs = conv.refs;
+        std::sort(refs.begin(), refs.end(), [](const LogRef &a, const LogRef &b) { return a.seq < b.seq; });
+        refs.erase(std::unique(refs.begin(), refs.end(), [](const LogRef &a, const LogRef &b) { return a.seq == b.seq; }),
+                   refs.end());
+        for (const auto &ref : refs)
+        {
+            ++segments[ref.segment]->liveRecords;
+            conv.bytes += ref.size;
+        }
+    }
+    startedEmpty = index.empty();
+
+    if (!segments.empty() && !segments.rbegin()->second->compressed
+        && segments.rbegin()->second->bytes < serverConfig.historySegmentBytes)
+    {
+        active = segments.rbegin()->second;
+        if (active->indexed)
+        {
+            // Vuelve a recibir mensajes (se subió history_segment_bytes): su .idx queda viejo
+            fs::remove(indexPath(active->id), ec);
+            active->indexed = false;
+        }
+        if (!activeOut.open(active->path, false))
+        {
+            std::cerr << "[ERROR] HistoryLog: No se pudo abrir " << active->path << std::endl;
+            return false;
+        }
+    }
+    else
+    {
+        lock.unlock();
+        if (!rotateLocked())
+            return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> pendingLock(pendingMutex);
+        accepting = true;
+    }
+    writer = std::thread([this] { writerLoop(); });
+    return true;
+}
+
+bool HistoryLog::empty()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return startedEmpty;
+}
+
+bool HistoryLog::rotateLocked()
+{
+    if (activeOut.isOpen())
+    {
+        if (serverConfig.historyFsync)
+            activeOut.sync();
+        activeOut.close();
+    }
+    uint32_t id;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        id = segments.empty() ? 1 : segments.rbegin()->first + 1;
+    }
+    auto fresh = std::make_shared<HistorySegment>(id, segmentPath(id, false));
+    if (!activeOut.open(fresh->path, true))
+    {
+        std::cerr << "[ERROR] HistoryLog: No se pudo crear " << fresh->path << std::endl;
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    active = fresh;
+    segments.emplace(id, fresh);
+    return true;
+}
+
+bool HistoryLog::append(uint64_t conversation, std::string_view user, std::string_view msg)
+{
+    uint64_t now = nowSeconds();
+    // El registro se arma acá; el hilo de escritura solo le pone la secuencia
+    PendingAppend item{conversation, static_cast<uint32_t>(now), 0, buildRecord(conversation, now, user, msg)};
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        if (!accepting)
+            return false;
+        pending.push_back(std::move(item));
+        ++enqueued;
+    }
+    pendingWake.notify_one();
+    return true;
+}
+
+void HistoryLog::waitWritten()
+{
+    std::unique_lock<std::mutex> lock(pendingMutex);
+    uint64_t target = enqueued;
+    pendingWritten.wait(lock, [&] { return written >= target; });
+}
+
+void HistoryLog::writerLoop()
+{
+    std::vector<PendingAppend> batch;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(pendingMutex);
+            pendingWake.wait(lock, [this] { return !pending.empty() || !accepting; });
+            if (pending.empty())
+                return; // Cerrado y sin nada pendiente
+            batch.swap(pending);
+        }
+        writeBatch(batch);
+        {
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            written += batch.size();
+        }
+        pendingWritten.notify_all();
+        batch.clear();
+    }
+}
+
+void HistoryLog::writeBatch(std::vector<PendingAppend> &batch)
+{
+    std::lock_guard<std::mutex> writeLock(writeMutex);
+
+    // Todo el lote sale en una sola escritura
+    batchBytes.clear();
+    for (auto &item : batch)
+    {
+        item.seq = nextSeq++;
+        sealRecord(item.bytes, item.seq);
+        batchBytes += item.bytes;
+    }
+    if (!activeOut.write(batchBytes))
+    {
+        // Lo escrito a medias queda al final del segmento y se descarta al reabrir el log
+        std::cerr << "[ERROR] HistoryLog: No se pudieron escribir " << batch.size() << " mensajes en "
+                  << active->path << std::endl;
+        rotateLocked();
+        return;
+    }
+    if (serverConfig.historyFsync && !activeOut.sync())
+        std::cerr << "[ERROR] HistoryLog: No se pudo sincronizar " << active->path << std::endl;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t offset = active->bytes;
+        for (const auto &item : batch)
+        {
+            uint32_t size = static_cast<uint32_t>(item.bytes.size());
+            auto &conv = index[item.conversation];
+            conv.refs.push_back({item.seq, active->id, static_cast<uint32_t>(offset), size, item.time});
+            conv.bytes += size;
+            offset += size;
+            ++active->records;
+            ++active->liveRecords;
+        }
+        active->bytes = offset;
+    }
+
+    // El índice de búsqueda tiene su propio lock: separar los términos no frena las lecturas
+    RecordView rec;
+    for (const auto &item : batch)
+        if (parseRecord(item.bytes.data(), item.bytes.size(), 0, rec, false))
+            searchIndex.add(rec.conversation, rec.seq, rec.msg);
+    if (active->bytes >= serverConfig.historySegmentBytes)
+        rotateLocked();
+}
+
+void HistoryLog::setRetention(uint64_t conversation, const RetentionPolicy &policy)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    retention[conversation] = policy;
+}
+
+void HistoryLog::setDefaultRetention(const RetentionPolicy &policy)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    defaultRetention = policy;
+}
+
+size_t HistoryLog::expireLocked(uint64_t conversation, ConversationRefs &conv, uint64_t now)
+{
+    auto it = retention.find(conversation);
+    const RetentionPolicy &policy = it != retention.end() ? it->second : defaultRetention;
+    auto &refs = conv.refs;
+
+    // Los registros están en orden: lo que sobra siempre es un prefijo
+    size_t drop = 0;
+    if (policy.maxRecords > 0 && refs.size() > policy.maxRecords)
+        drop = refs.size() - policy.maxRecords;
+    uint64_t bytes = conv.bytes;
+    for (size_t i = 0; i < drop; ++i)
+        bytes -= refs[i].size;
+    while (drop < refs.size()
+           && ((policy.maxAgeSeconds > 0 && refs[drop].time + policy.maxAgeSeconds < now)
+               || (policy.maxBytes > 0 && bytes > policy.maxBytes)))
+        bytes -= refs[drop++].size;
+    if (drop == 0)
+        return 0;
+
+    for (size_t i = 0; i < drop; ++i)
+        --segments[refs[i].segment]->liveRecords;
+    refs.erase(refs.begin(), refs.begin() + drop);
+    conv.bytes = bytes;
+    return drop;
+}
+
+size_t HistoryLog::expire()
+{
+    uint64_t now = nowSeconds();
+    size_t dropped = 0;
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = index.begin(); it != index.end();)
+    {
+        dropped += expireLocked(it->first, it->second, now);
+        // Una conversación vencida entera deja de existir
+        if (it->second.refs.empty())
+        {
+            searchIndex.erase(it->first);
+            it = index.erase(it);
+        }
+        else
+            ++it;
+    }
+    return dropped;
+}
+
+bool HistoryLog::snapshot(uint64_t conversation, Snapshot &out)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(conversation);
+    if (it == index.end())
+        return false;
+    expireLocked(conversation, it->second, nowSeconds());
+    if (it->second.refs.empty())
+        return false;
+    out.refs = it->second.refs;
+    for (const auto &ref : out.refs)
+        if (out.segments.count(ref.segment) == 0)
+        {
+            auto &segment = segments[ref.segment];
+            out.segments.emplace(ref.segment, SnapshotSegment{segment, segment->bytes});
+        }
+    return true;
+}
+
+void HistoryLog::search(uint64_t conversation, std::string_view query, size_t limit, Snapshot &out)
+{
+    uint64_t firstLive;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(conversation);
+        if (it == index.end())
+            return;
+        expireLocked(conversation, it->second, nowSeconds());
+        if (it->second.refs.empty())
+            return;
+        firstLive = it->second.refs.front().seq;
+    }
+
+    auto seqs = searchIndex.search(conversation, query, firstLive, limit);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (uint64_t seq : seqs)
+    {
+        // Entre la búsqueda y acá pudo descartarse por el límite del historial
+        const LogRef *ref = findRefLocked(conversation, seq);
+        if (!ref)
+            continue;
+        out.refs.push_back(*ref);
+        if (out.segments.count(ref->segment) == 0)
+        {
+            auto &segment = segments[ref->segment];
+            out.segments.emplace(ref->segment, SnapshotSegment{segment, segment->bytes});
+        }
+    }
+}
+
+bool HistoryLog::has(uint64_t conversation)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(conversation);
+    return it != index.end() && !it->second.refs.empty();
+}
+
+LogRef *HistoryLog::findRefLocked(uint64_t conversation, uint64_t seq)
+{
+    auto it = index.find(conversation);
+    if (it == index.end())
+        return nullptr;
+    auto &refs = it->second.refs;
+    auto pos = std::lower_bound(refs.begin(), refs.end(), seq,
+                                [](const LogRef &ref, uint64_t s) { return ref.seq < s; });
+    return pos != refs.end() && pos->seq == seq ? &*pos : nullptr;
+}
+
+bool HistoryLog::compactSegment(const std::shared_ptr<HistorySegment> &segment)
+{
+    // El segmento está sellado: se lee sin el lock y cada registro vivo se copia tal cual,
+    // por separado, así las escrituras nuevas nunca esperan más que la copia de un registro
+    std::shared_ptr<const MappedFile> file;
+    std::string unpacked;
+    std::string_view raw;
+    if (!loadSegment(segment, segment->bytes, file, unpacked, raw))
+        return false;
+    RecordView rec;
+    uint64_t offset = 0;
+    while (parseRecord(raw.data(), raw.size(), offset, rec, false))
+    {
+        std::lock_guard<std::mutex> writeLock(writeMutex);
+        auto stillHere = [&] {
+            LogRef *ref = findRefLocked(rec.conversation, rec.seq);
+            return ref && ref->segment == segment->id && ref->offset == offset ? ref : nullptr;
+        };
+        bool live;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            live = stillHere() != nullptr;
+        }
+        if (live)
+        {
+            if (!activeOut.write(raw.substr(offset, rec.size)))
+            {
+                std::cerr << "[ERROR] HistoryLog: No se pudo copiar un registro a " << active->path << std::endl;
+                rotateLocked();
+                return false;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                // Mientras se copiaba pudo descartarse; entonces la copia es basura
+                if (LogRef *ref = stillHere())
+                {
+                    *ref = {rec.seq, active->id, static_cast<uint32_t>(active->bytes), rec.size,
+                            static_cast<uint32_t>(rec.time)};
+                    --segment->liveRecords;
+                    ++active->liveRecords;
+                }
+                active->bytes += rec.size;
+                ++active->records;
+            }
+            if (active->bytes >= serverConfig.historySegmentBytes)
+                rotateLocked();
+        }
+        offset += rec.size;
+    }
+
+    // Antes de borrar el original, las copias tienen que estar en disco
+    if (serverConfig.historyFsync)
+    {
+        std::lock_guard<std::mutex> writeLock(writeMutex);
+        activeOut.sync();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (segment->liveRecords != 0)
+        return false;
+    // Las lecturas en curso conservan el archivo hasta soltar su shared_ptr. Sus términos ya
+    // están en el índice del segmento al que se copiaron los registros.
+    segment->obsolete = true;
+    segments.erase(segment->id);
+    std::remove(indexPath(segment->id).c_str());
+    return true;
+}
+
+size_t HistoryLog::compact()
+{
+    std::vector<std::shared_ptr<HistorySegment>> candidates;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto &[id, segment] : segments)
+            if (segment != active && segment->liveRecords * 2 < segment->records)
+                candidates.push_back(segment);
+    }
+
+    size_t freed = 0;
+    for (const auto &segment : candidates)
+        if (compactSegment(segment))
+            ++freed;
+    return freed;
+}
+
+bool HistoryLog::compressSegment(const std::shared_ptr<HistorySegment> &segment)
+{
+    std::shared_ptr<const MappedFile> file;
+    std::string unpacked;
+    std::string_view raw;
+    if (!loadSegment(segment, segment->bytes, file, unpacked, raw))
+        return false;
+    std::vector<uint64_t> recordEnds;
+    RecordView rec;
+    uint64_t offset = 0;
+    while (parseRecord(raw.data(), raw.size(), offset, rec, false))
+        recordEnds.push_back(offset += rec.size);
+
+    std::string path = segmentPath(segment->id, true);
+    size_t packedBytes = CompressedSegment::write(raw.substr(0, offset), recordEnds.data(), recordEnds.size(),
+                                                  serverConfig.historyBlockBytes, path);
+    if (packedBytes == 0)
+        return false;
+
+    // Las ubicaciones del índice no cambian: el comprimido conserva las posiciones originales
+    auto packed = std::make_shared<HistorySegment>(segment->id, path, true);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = segments.find(segment->id);
+        if (it == segments.end() || it->second != segment)
+        {
+            std::remove(path.c_str());
+            return false;
+        }
+        packed->bytes = segment->bytes;
+        packed->records = segment->records;
+        packed->liveRecords = segment->liveRecords;
+        packed->indexed = segment->indexed;
+        it->second = packed;
+        // El original se borra cuando lo suelte la última lectura
+        segment->obsolete = true;
+    }
+    std::cout << "[HISTORIAL] Segmento " << segment->id << " comprimido: " << offset << " → "
+              << packedBytes << " bytes" << std::endl;
+    return true;
+}
+
+size_t HistoryLog::compress()
+{
+    std::vector<std::shared_ptr<HistorySegment>> candidates;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto &[id, segment] : segments)
+            if (segment != active && !segment->compressed && segment->liveRecords > 0)
+                candidates.push_back(segment);
+    }
+
+    size_t done = 0;
+    for (const auto &segment : candidates)
+        if (compressSegment(segment))
+            ++done;
+    return done;
+}
+
+bool HistoryLog::indexSegment(const std::shared_ptr<HistorySegment> &segment)
+{
+    std::shared_ptr<const MappedFile> file;
+    std::string unpacked;
+    std::string_view raw;
+    if (!loadSegment(segment, segment->bytes, file, unpacked, raw))
+        return false;
+    // Todos los registros, vivos o no: los descartados se podan al buscar
+    SearchIndex::Postings postings;
+    RecordView rec;
+    uint64_t offset = 0;
+    while (parseRecord(raw.data(), raw.size(), offset, rec, false))
+    {
+        SearchIndex::addTo(postings, rec.conversation, rec.seq, rec.msg);
+        offset += rec.size;
+    }
+
+    std::string path = indexPath(segment->id);
+    if (!SearchIndex::save(postings, path))
+        return false;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = segments.find(segment->id);
+    if (it == segments.end())
+    {
+        // Se compactó mientras tanto
+        std::remove(path.c_str());
+        return false;
+    }
+    it->second->indexed = true;
+    return true;
+}
+
+size_t HistoryLog::indexSegments()
+{
+    std::vector<std::shared_ptr<HistorySegment>> candidates;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto &[id, segment] : segments)
+            if (segment != active && !segment->indexed && segment->liveRecords > 0)
+                candidates.push_back(segment);
+    }
+
+    size_t done = 0;
+    for (const auto &segment : candidates)
+        if (indexSegment(segment))
+            ++done;
+    return done;
+}
+
+void HistoryLog::startCompactor()
+{
+    compactor = std::thread([this] {
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(compactorMutex);
+                if (compactorWake.wait_for(lock, std::chrono::seconds(serverConfig.historyCompactIntervalSeconds),
+                                           [this] { return stopping; }))
+                    break;
+            }
+            // Lo vencido queda como basura y la compactación lo libera en la misma pasada
+            size_t expired = expire();
+            if (expired > 0)
+                std::cout << "[HISTORIAL] Retención: " << expired << " mensajes vencidos" << std::endl;
+            size_t freed = compact();
+            if (freed > 0)
+                std::cout << "[HISTORIAL] Compactación: " << freed << " segmentos liberados" << std::endl;
+            // Lo que sobrevivió a la compactación se comprime
+            if (serverConfig.historyCompress)
+                compress();
+            indexSegments();
+        }
+    });
+}
+
+void HistoryLog::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(compactorMutex);
+        stopping = true;
+    }
+    compactorWake.notify_all();
+    if (compactor.joinable())
+        compactor.join();
+
+    // El hilo de escritura termina cuando ya no queda nada encolado
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        accepting = false;
+    }
+    pendingWake.notify_all();
+    if (writer.joinable())
+        writer.join();
+
+    std::lock_guard<std::mutex> writeLock(writeMutex);
+    if (activeOut.isOpen())
+        activeOut.sync();
+}
+
+bool SegmentReader::open(const std::shared_ptr<HistorySegment> &segment, uint64_t bytes)
+{
+    block.clear();
+    compressed = segment->compressed;
+    file = segment->map(compressed ? 1 : bytes);
+    return file && (!compressed || archive.open(file));
+}
+
+bool SegmentReader::read(uint32_t offset, std::string_view &user, std::string_view &msg)
+{
+    if (!file)
+        return false;
+    if (!compressed)
+        return HistoryLog::readRecord(file->data(), file->size(), offset, user, msg);
+    if (block.empty() || offset < blockStart || offset >= blockStart + block.size())
+    {
+        if (!archive.readBlockAt(offset, block, blockStart))
+        {
+            block.clear();
+            return false;
+        }
+    }
+    return HistoryLog::readRecord(block.data(), block.size(), offset - blockStart, user, msg);
+}
@@ -0,0 +1,324 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "AppendFile.h"
+#include "CompressedSegment.h"
+#include "MappedFile.h"
+#include "SearchIndex.h"
+
+// Ubicación de un registro dentro del log
+struct LogRef
+{
+    uint64_t seq;     // Número de secuencia global: ordena los registros de una conversación
+    uint32_t segment; // ID del segmento
+    uint32_t offset;  // Posición del registro dentro del segmento
+    uint32_t size;    // Bytes del registro completo
+    uint32_t time;    // Fecha Unix en segundos
+};
+
+// Cuánto historial conserva una conversación; 0 es sin límite
+struct RetentionPolicy
+{
+    size_t maxRecords = 0;
+    uint64_t maxAgeSeconds = 0;
+    uint64_t maxBytes = 0; // Suma de los registros sin comprimir
+};
+
+/**
+ * @brief Un archivo del log. Mientras alguien tenga un shared_ptr al segmento el archivo
+ * sigue existiendo; si la compactación lo dejó obsoleto se borra al soltar el último.
+ */
+struct HistorySegment
+{
+    HistorySegment(uint32_t id, std::string path, bool compressed = false)
+        : id(id), path(std::move(path)), compressed(compressed) {}
+    ~HistorySegment();
+
+    /**
+     * @brief Proyección en memoria del archivo que cubre al menos sus primeros @p size bytes.
+     *
+     * Un segmento sellado se proyecta una sola vez; el activo se vuelve a proyectar cuando
+     * se pide más de lo que cubre la proyección anterior, que sigue viva mientras alguien la use.
+     *
+     * @return nullptr si no se pudo proyectar.
+     */
+    std::shared_ptr<const MappedFile> map(uint64_t size);
+
+    const uint32_t id;
+    const std::string path;
+    const bool compressed; // Sellado y comprimido por bloques (ver CompressedSegment)
+    std::atomic<bool> obsolete{false};
+
+    // Protegidos por el mutex del log (bytes también cambia solo con writeMutex tomado)
+    uint64_t bytes = 0;       // Tamaño escrito
+    uint64_t records = 0;     // Registros escritos
+    uint64_t liveRecords = 0; // Registros que todavía referencia el índice
+    bool indexed = false;     // Sus términos ya están guardados en seg-N.idx
+
+private:
+    std::mutex mapMutex;
+    std::shared_ptr<const MappedFile> mapping;
+};
+
+/**
+ * @brief Historial de todas las conversaciones en un único log segmentado de solo agregado.
+ *
+ * Cada mensaje se agrega al final del segmento activo (escritura secuencial) y el índice en
+ * memoria guarda, por conversación, la ubicación de sus registros en orden. Leer una
+ * conversación es recorrer su lista de ubicaciones. Las escrituras las hace un hilo propio:
+ * append() solo encola, y el hilo escribe todo lo pendiente de una vez (con un fdatasync si
+ * history_fsync está activo), así que quien recibe el mensaje nunca espera al disco. Al pasar history_segment_bytes el
+ * segmento se sella y se abre otro; la compactación en segundo plano copia los registros
+ * vivos de los segmentos sellados con mucha basura al segmento activo y borra el viejo, y
+ * después comprime por bloques los sellados que quedan (history_compress).
+ *
+ * Cada mensaje escrito también se agrega al índice de búsqueda por palabras (SearchIndex);
+ * las listas de cada segmento sellado se guardan junto a él en seg-N.idx.
+ *
+ * Cada conversación conserva lo que permite su RetentionPolicy (cantidad, antigüedad y
+ * bytes): lo demás se descarta del índice al leerla y en cada pasada de la compactación,
+ * que después libera los segmentos que quedaron con mayoría de basura.
+ *
+ * Registro: longitud (u32) y suma de verificación (u32) del resto, secuencia (u64),
+ * conversación (u64), fecha Unix en segundos (u64), largo del usuario (u16), usuario y
+ * mensaje. Los enteros van en el orden de bytes del equipo.
+ */
+class HistoryLog
+{
+public:
+    // Un segmento referenciado por una instantánea y lo que tenía escrito al tomarla
+    struct SnapshotSegment
+    {
+        std::shared_ptr<HistorySegment> segment;
+        uint64_t bytes;
+    };
+
+    // Lo necesario para leer una conversación sin bloquear las escrituras ni la compactación
+    struct Snapshot
+    {
+        std::vector<LogRef> refs;
+        std::unordered_map<uint32_t, SnapshotSegment> segments;
+    };
+
+    ~HistoryLog();
+
+    /**
+     * @brief Abre (o crea) el log en @p dir y reconstruye el índice leyendo los segmentos.
+     *
+     * Un registro incompleto al final del último segmento (apagado a medias) se descarta.
+     */
+    bool open(const std::string &dir);
+
+    // true si el directorio no tenía ningún registro al abrirlo
+    bool empty();
+
+    /**
+     * @brief Encola un mensaje para agregarlo al final del log.
+     *
+     * El mensaje aparece en las lecturas cuando el hilo de escritura lo baja al archivo.
+     *
+     * @return bool false si el log no está abierto.
+     */
+    bool append(uint64_t conversation, std::string_view user, std::string_view msg);
+
+    // Espera a que todo lo encolado hasta ahora esté escrito e indexado
+    void waitWritten();
+
+    /**
+     * @brief Retención de una conversación en particular; las demás usan setDefaultRetention().
+     *
+     * Llamar al arrancar, antes de startCompactor().
+     */
+    void setRetention(uint64_t conversation, const RetentionPolicy &policy);
+    void setDefaultRetention(const RetentionPolicy &policy);
+
+    /**
+     * @brief Aplica la retención a todas las conversaciones.
+     *
+     * Los registros que exceden su política dejan de referenciarse y quedan como basura
+     * hasta que la compactación libera su segmento. Las lecturas la aplican además a la
+     * conversación que leen, así nunca devuelven mensajes vencidos.
+     *
+     * @return size_t Registros descartados.
+     */
+    size_t expire();
+
+    // Copia las ubicaciones de la conversación (ya aplicada su retención); false si no tiene registros
+    bool snapshot(uint64_t conversation, Snapshot &out);
+
+    bool has(uint64_t conversation);
+
+    /**
+     * @brief Busca en la conversación los mensajes con las palabras de @p query.
+     *
+     * Deja en @p out las ubicaciones de hasta @p limit mensajes, del más relevante al menos
+     * (ver SearchIndex::search), listas para leerse como una instantánea.
+     */
+    void search(uint64_t conversation, std::string_view query, size_t limit, Snapshot &out);
+
+    /**
+     * @brief Lee en el lugar el registro en @p offset de un segmento proyectado.
+     *
+     * No recalcula la suma de verificación: los registros se verificaron al abrir el log o
+     * al escribirse, y un segmento no se modifica después. @p user y @p msg apuntan dentro
+     * de @p data.
+     *
+     * @return bool false si el registro no entra en @p size bytes.
+     */
+    static bool readRecord(const char *data, size_t size, uint32_t offset, std::string_view &user, std::string_view &msg);
+
+    /**
+     * @brief Una pasada de compactación: reescribe los segmentos sellados con menos de la
+     * mitad de sus registros vivos.
+     *
+     * @return size_t Segmentos liberados.
+     */
+    size_t compact();
+
+    /**
+     * @brief Comprime los segmentos sellados que todavía no lo están.
+     *
+     * @return size_t Segmentos comprimidos.
+     */
+    size_t compress();
+
+    /**
+     * @brief Guarda el índice de búsqueda de los segmentos sellados que todavía no lo tienen.
+     *
+     * @return size_t Segmentos indexados.
+     */
+    size_t indexSegments();
+
+    // Lanza el hilo que vence, compacta y comprime cada history_compact_interval segundos
+    void startCompactor();
+
+    // Detiene la compactación, escribe lo pendiente y baja a disco el segmento activo
+    void close();
+
+private:
+    // Un registro leído en el lugar; user y msg apuntan a la proyección del segmento
+    struct RecordView
+    {
+        uint64_t seq;
+        uint64_t conversation;
+        uint64_t time;
+        std::string_view user;
+        std::string_view msg;
+        uint32_t size; // Bytes del registro completo
+    };
+
+    // Lee el registro en @p offset; con @p verify también comprueba la suma de verificación
+    static bool parseRecord(const char *data, size_t size, uint64_t offset, RecordView &rec, bool verify);
+
+    // Un mensaje encolado: el registro ya armado, salvo secuencia y suma de verificación
+    struct PendingAppend
+    {
+        uint64_t conversation;
+        uint32_t time;
+        uint64_t seq;
+        std::string bytes;
+    };
+
+    // Ubicaciones de los registros vivos de una conversación, en orden de secuencia
+    struct ConversationRefs
+    {
+        std::vector<LogRef> refs;
+        uint64_t bytes = 0; // Suma de sus tamaños
+    };
+
+    std::string segmentPath(uint32_t id, bool compressed) const;
+    std::string indexPath(uint32_t id) const;
+
+    // Contenido sin comprimir de los primeros @p bytes de un segmento: apunta a la proyección
+    // (@p file) o, si está comprimido, a @p unpacked
+    static bool loadSegment(const std::shared_ptr<HistorySegment> &segment, uint64_t bytes,
+                            std::shared_ptr<const MappedFile> &file, std::string &unpacked, std::string_view &raw);
+
+    // Sella el segmento activo y abre uno nuevo; llamar con writeMutex tomado (y mutex no)
+    bool rotateLocked();
+
+    // Cuerpo del hilo de escritura
+    void writerLoop();
+
+    // Escribe e indexa un lote de mensajes encolados
+    void writeBatch(std::vector<PendingAppend> &batch);
+
+    // Descarta lo que excede la retención de la conversación; llamar con mutex tomado
+    size_t expireLocked(uint64_t conversation, ConversationRefs &conv, uint64_t now);
+
+    // Busca por secuencia la ubicación de un registro de la conversación (o nullptr)
+    LogRef *findRefLocked(uint64_t conversation, uint64_t seq);
+
+    // Copia los registros vivos de un segmento sellado y lo retira
+    bool compactSegment(const std::shared_ptr<HistorySegment> &segment);
+
+    // Reemplaza un segmento sellado por su versión comprimida
+    bool compressSegment(const std::shared_ptr<HistorySegment> &segment);
+
+    // Escribe seg-N.idx con los términos de un segmento sellado
+    bool indexSegment(const std::shared_ptr<HistorySegment> &segment);
+
+    // mutex protege el índice y los contadores; writeMutex ordena las escrituras al segmento
+    // activo (hilo de escritura y compactación). Si se toman los dos, writeMutex va primero.
+    std::mutex mutex;
+    std::mutex writeMutex;
+    std::string dir;
+    std::map<uint32_t, std::shared_ptr<HistorySegment>> segments;
+    std::unordered_map<uint64_t, ConversationRefs> index;
+    std::unordered_map<uint64_t, RetentionPolicy> retention; // Fija después de arrancar
+    RetentionPolicy defaultRetention;
+    std::shared_ptr<HistorySegment> active;
+    AppendFile activeOut;   // Con writeMutex
+    uint64_t nextSeq = 1;   // Con writeMutex
+    bool startedEmpty = true;
+    std::string batchBytes; // Buffer del hilo de escritura
+    SearchIndex searchIndex;
+
+    std::thread writer;
+    std::mutex pendingMutex;
+    std::condition_variable pendingWake;
+    std::condition_variable pendingWritten;
+    std::vector<PendingAppend> pending;
+    uint64_t enqueued = 0;
+    uint64_t written = 0;
+    bool accepting = false;
+
+    std::thread compactor;
+    std::mutex compactorMutex;
+    std::condition_variable compactorWake;
+    bool stopping = false;
+};
+
+/**
+ * @brief Lee registros de un segmento, comprimido o no, sin copiarlos.
+ *
+ * En un segmento comprimido guarda el último bloque descomprimido: quien lee en orden
+ * descomprime cada bloque una sola vez.
+ */
+class SegmentReader
+{
+public:
+    // Prepara la lectura de los primeros @p bytes del segmento; false si no se pudo abrir
+    bool open(const std::shared_ptr<HistorySegment> &segment, uint64_t bytes);
+
+    // Lee el registro en @p offset; @p user y @p msg valen hasta la próxima llamada
+    bool read(uint32_t offset, std::string_view &user, std::string_view &msg);
+
+private:
+    std::shared_ptr<const MappedFile> file;
+    bool compressed = false;
+    CompressedSegment archive;
+    std::string block;       // Último bloque descomprimido
+    uint64_t blockStart = 0; // Posición original donde empieza
+};
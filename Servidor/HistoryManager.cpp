@@ -1,109 +1,339 @@
+#include "HistoryManager.h"
+#include "ServerConfig.h"
+#include "AppendFile.h"
 #include <fstream>
-#include <sstream>
 #include <vector>
 #include <string>
 #include <iostream>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <filesystem>
+#include <algorithm>
+#include <cstdio>
 
-static const std::string HISTORY_FILE = "/home/ubuntu/YaPPuccino/Servidor/History/general.txt";
+// Todo el historial vive en un único log; cada conversación es una clave dentro de él
+static HistoryLog historyLog;
 
-// Cada línea del archivo: "username|mensaje"
-void appendToHistory(const std::string &user, const std::string &msg)
+// Clave del chat general en el log. Las privadas salen de la tabla de conversaciones y nunca valen 0.
+static const uint64_t GENERAL_CONVERSATION = 0;
+
+// Clave que usaban las versiones anteriores para la conversación entre dos nombres (un hash
+// de los nombres, que podía coincidir para dos pares distintos). Solo se usa para adoptar
+// lo que ya estaba en el log antes de existir la tabla de conversaciones.
+static uint64_t legacyPrivateLogKey(const std::string &u1, const std::string &u2)
 {
-    std::cerr << "[DEBUG] appendToHistory: Iniciando actualización del historial para usuario: " << user << std::endl;
-    
-    // 1) Cargar todo el historial actual
-    std::ifstream fin(HISTORY_FILE);
-    if (!fin) {
-        std::cerr << "[ERROR] appendToHistory: No se pudo abrir " << HISTORY_FILE << " para lectura." << std::endl;
+    std::string pair = std::min(u1, u2) + '\0' + std::max(u1, u2);
+    uint64_t hash = 14695981039346656037ull; // FNV-1a de 64 bits
+    for (unsigned char c : pair)
+    {
+        hash ^= c;
+        hash *= 1099511628211ull;
     }
-    std::vector<std::string> lines;
+    return hash == GENERAL_CONVERSATION ? 1 : hash;
+}
+
+// Pasa al log un archivo "usuario|mensaje" del formato anterior y lo renombra a .migrated
+static size_t importLegacyFile(const std::string &path, uint64_t conversation)
+{
+    std::ifstream fin(path);
+    if (!fin)
+        return 0;
+    size_t imported = 0;
     std::string line;
     while (std::getline(fin, line))
     {
-        if (!line.empty()) {
-            lines.push_back(line);
-        }
+        auto pos = line.find('|');
+        if (line.empty() || pos == std::string::npos)
+            continue;
+        if (historyLog.append(conversation, std::string_view(line).substr(0, pos), std::string_view(line).substr(pos + 1)))
+            ++imported;
     }
     fin.close();
-    std::cerr << "[DEBUG] appendToHistory: Leídas " << lines.size() << " líneas." << std::endl;
+    // Recién se renombra cuando todo quedó escrito en el log
+    historyLog.waitWritten();
+    if (std::rename(path.c_str(), (path + ".migrated").c_str()) != 0)
+        std::cerr << "[ERROR] importLegacyFile: No se pudo renombrar " << path << std::endl;
+    return imported;
+}
+
+// Tabla persistente par de nombres -> clave en el log. Cada par nuevo recibe una clave que
+// no usa ningún otro, así dos conversaciones nunca comparten registros. Es un archivo de solo
+// agregado junto a los segmentos: clave (8 bytes) y los dos nombres con 2 bytes de longitud.
+using NamePair = std::pair<std::string, std::string>;
+static std::map<NamePair, uint64_t> conversationTable;
+static std::unordered_set<uint64_t> conversationKeys;
+static uint64_t nextConversationKey = GENERAL_CONVERSATION + 1;
+static AppendFile conversationFile;
+
+static std::string conversationTablePath()
+{
+    return serverConfig.historyLogDir() + "/conversations";
+}
+
+template <typename T>
+static bool readRaw(std::istream &in, T &value)
+{
+    return static_cast<bool>(in.read(reinterpret_cast<char *>(&value), sizeof value));
+}
+
+static bool readSized(std::istream &in, std::string &s)
+{
+    uint16_t len;
+    if (!readRaw(in, len))
+        return false;
+    s.resize(len);
+    return len == 0 || static_cast<bool>(in.read(&s[0], len));
+}
+
+template <typename T>
+static void appendRaw(std::string &out, T value)
+{
+    out.append(reinterpret_cast<const char *>(&value), sizeof value);
+}
+
+static void appendSized(std::string &out, const std::string &s)
+{
+    appendRaw(out, static_cast<uint16_t>(s.size()));
+    out += s;
+}
 
-    // 2) Si ya hay 50, borrar la más antigua (posición 0)
-    if (lines.size() >= 50)
+// Carga la tabla y la deja abierta para agregar. Un registro cortado al final (apagado a
+// medias) se descarta: su conversación todavía no tenía mensajes en el log.
+static bool loadConversationTable()
+{
+    std::ifstream in(conversationTablePath(), std::ios::binary);
+    uint64_t valid = 0;
+    if (in)
     {
-        std::cerr << "[DEBUG] appendToHistory: Historial tiene " << lines.size() << " entradas, eliminando la más antigua." << std::endl;
-        lines.erase(lines.begin());
+        uint64_t key;
+        NamePair names;
+        while (readRaw(in, key) && readSized(in, names.first) && readSized(in, names.second))
+        {
+            conversationKeys.insert(key);
+            nextConversationKey = std::max(nextConversationKey, key + 1);
+            conversationTable[names] = key;
+            valid = static_cast<uint64_t>(in.tellg());
+        }
+        in.close();
+        std::error_code ec;
+        if (std::filesystem::file_size(conversationTablePath(), ec) != valid && !ec)
+        {
+            std::cerr << "[ERROR] loadConversationTable: Registro incompleto al final de " << conversationTablePath() << std::endl;
+            std::filesystem::resize_file(conversationTablePath(), valid, ec);
+        }
     }
+    if (!conversationFile.open(conversationTablePath(), false))
+    {
+        std::cerr << "[ERROR] loadConversationTable: No se pudo abrir " << conversationTablePath() << std::endl;
+        return false;
+    }
+    return true;
+}
 
-    // 3) Añadir la nueva línea al final
+// Clave en el log de la conversación entre dos nombres. Si es nueva la crea solo con @p create
+// (para agregarle mensajes); si no, devuelve GENERAL_CONVERSATION. Se busca por los nombres y
+// no por los IDs del directorio para que no dependa de que el registro se haya conservado.
+// Llamar con privateKeyMutex tomado.
+static uint64_t privateLogKeyLocked(const std::string &u1, const std::string &u2, bool create)
+{
+    NamePair names(std::min(u1, u2), std::max(u1, u2));
+    auto it = conversationTable.find(names);
+    if (it != conversationTable.end())
+        return it->second;
+
+    // Lo escrito por versiones anteriores sigue con la clave de entonces, si nadie la tomó
+    uint64_t key = legacyPrivateLogKey(u1, u2);
+    if (conversationKeys.count(key) || !historyLog.has(key))
     {
-        std::ostringstream oss;
-        oss << user << "|" << msg;
-        std::string newLine = oss.str();
-        lines.push_back(newLine);
-        std::cerr << "[DEBUG] appendToHistory: Añadida nueva línea: " << newLine << std::endl;
+        if (!create)
+            return GENERAL_CONVERSATION;
+        key = nextConversationKey++;
+        while (conversationKeys.count(key) || historyLog.has(key))
+            key = nextConversationKey++;
     }
 
-    // 4) Reescribir el archivo con el contenido actualizado
-    std::ofstream fout(HISTORY_FILE, std::ios::trunc);
-    if (!fout) {
-        std::cerr << "[ERROR] appendToHistory: No se pudo abrir " << HISTORY_FILE << " para escritura." << std::endl;
+    // El par queda en disco antes que su primer mensaje en el log
+    std::string record;
+    appendRaw(record, key);
+    appendSized(record, names.first);
+    appendSized(record, names.second);
+    if (!conversationFile.write(record) || !conversationFile.sync())
+        std::cerr << "[ERROR] privateLogKey: No se pudo guardar la conversación " << names.first
+                  << " - " << names.second << std::endl;
+    conversationKeys.insert(key);
+    conversationTable.emplace(std::move(names), key);
+    return key;
+}
+
+// Claves del log ya calculadas por clave de conversación. La primera vez que se ve una
+// conversación se migra su archivo privado del formato anterior, si existe.
+static std::unordered_map<uint64_t, uint64_t> privateKeyCache;
+// Nombres de los archivos privados del formato anterior que todavía no se migraron. Se listan
+// una vez al arrancar, así preguntar por una conversación sin historial no toca el disco.
+static std::unordered_set<std::string> legacyPrivateFiles;
+static std::mutex privateKeyMutex;
+// Conversaciones cuyo archivo anterior se está importando (sin privateKeyMutex tomado); quien
+// pide una de ellas espera en importDone a que termine
+static std::unordered_set<uint64_t> importingKeys;
+static std::condition_variable importDone;
+
+bool openHistory()
+{
+    if (!historyLog.open(serverConfig.historyLogDir()))
+    {
+        std::cerr << "[ERROR] openHistory: No se pudo abrir el log de historial en " << serverConfig.historyLogDir() << std::endl;
+        return false;
     }
-    for (auto &l : lines)
+    if (historyLog.empty())
     {
-        fout << l << "\n";
+        size_t imported = importLegacyFile(serverConfig.generalHistoryFile(), GENERAL_CONVERSATION);
+        if (imported > 0)
+            std::cout << "→ Historial general migrado al log (" << imported << " mensajes)" << std::endl;
     }
-    fout.close();
-    std::cerr << "[DEBUG] appendToHistory: Historial actualizado, ahora tiene " << lines.size() << " entradas." << std::endl;
+
+    RetentionPolicy general;
+    general.maxRecords = serverConfig.historyLimit;
+    general.maxAgeSeconds = serverConfig.historyGeneralMaxAgeSeconds;
+    general.maxBytes = serverConfig.historyGeneralMaxBytes;
+    historyLog.setRetention(GENERAL_CONVERSATION, general);
+    RetentionPolicy privates;
+    privates.maxRecords = serverConfig.historyPrivateLimit;
+    privates.maxAgeSeconds = serverConfig.historyPrivateMaxAgeSeconds;
+    privates.maxBytes = serverConfig.historyPrivateMaxBytes;
+    historyLog.setDefaultRetention(privates);
+    historyLog.expire();
+
+    {
+        std::lock_guard<std::mutex> lock(privateKeyMutex);
+        if (!loadConversationTable())
+            return false;
+        std::error_code ec;
+        for (const auto &entry : std::filesystem::directory_iterator(serverConfig.privateHistoryDir(), ec))
+            if (entry.path().extension() == ".txt")
+                legacyPrivateFiles.insert(entry.path().filename().string());
+        if (!legacyPrivateFiles.empty())
+            std::cout << "→ " << legacyPrivateFiles.size() << " historiales privados por migrar al log" << std::endl;
+    }
+    historyLog.startCompactor();
+    return true;
 }
 
-// Carga todo el historial del archivo (hasta 50 líneas).
-// Retorna un vector de pares <user, mensaje>.
-std::vector<std::pair<std::string, std::string>> loadHistory()
+// Clave en el log de una conversación privada; sin @p create, GENERAL_CONVERSATION si todavía
+// no tiene mensajes (leerla no la da de alta)
+static uint64_t privateLogKey(uint64_t conversation, const std::string &u1, const std::string &u2, bool create)
 {
-    std::cerr << "[DEBUG] loadHistory: Cargando historial desde " << HISTORY_FILE << std::endl;
-    std::vector<std::pair<std::string, std::string>> result;
-    std::ifstream fin(HISTORY_FILE);
-    if (!fin) {
-        std::cerr << "[ERROR] loadHistory: No se pudo abrir " << HISTORY_FILE << " para lectura." << std::endl;
+    std::unique_lock<std::mutex> lock(privateKeyMutex);
+    auto it = privateKeyCache.find(conversation);
+    if (it != privateKeyCache.end())
+        return it->second;
+
+    std::string legacyPath = privateHistoryPath(u1, u2);
+    auto legacy = legacyPrivateFiles.find(std::filesystem::path(legacyPath).filename().string());
+    bool importLegacy = legacy != legacyPrivateFiles.end();
+    uint64_t key = privateLogKeyLocked(u1, u2, create || importLegacy);
+    if (key == GENERAL_CONVERSATION)
+        return key;
+
+    // Otro hilo está importando esta conversación: se espera a que quede completa
+    if (importingKeys.count(key))
+    {
+        importDone.wait(lock, [key] { return !importingKeys.count(key); });
+        return key;
     }
-    std::string line;
-    while (std::getline(fin, line))
+
+    // La importación lee el archivo y espera al escritor del log: se hace sin el mutex, así
+    // las demás conversaciones no la esperan
+    if (importLegacy)
     {
-        if (!line.empty())
+        legacyPrivateFiles.erase(legacy);
+        importingKeys.insert(key);
+        lock.unlock();
+        if (!historyLog.has(key))
+            importLegacyFile(legacyPath, key);
+        lock.lock();
+        importingKeys.erase(key);
+        importDone.notify_all();
+    }
+    privateKeyCache.emplace(conversation, key);
+    return key;
+}
+
+void appendToHistory(const std::string &user, const std::string &msg)
+{
+    // Lo que excede la retención se descarta al leer o en la próxima compactación
+    if (!historyLog.append(GENERAL_CONVERSATION, user, msg))
+        std::cerr << "[ERROR] appendToHistory: No se pudo guardar el mensaje de " << user << std::endl;
+}
+
+bool HistoryCursor::openGeneral()
+{
+    // Un chat general sin mensajes es un historial vacío, no un error
+    historyLog.snapshot(GENERAL_CONVERSATION, snap);
+    return true;
+}
+
+bool HistoryCursor::openPrivate(uint64_t conversation, const std::string &u1, const std::string &u2)
+{
+    uint64_t key = privateLogKey(conversation, u1, u2, false);
+    return key != GENERAL_CONVERSATION && historyLog.snapshot(key, snap);
+}
+
+void HistoryCursor::searchGeneral(std::string_view query, size_t limit)
+{
+    historyLog.search(GENERAL_CONVERSATION, query, limit, snap);
+}
+
+void HistoryCursor::searchPrivate(uint64_t conversation, const std::string &u1, const std::string &u2,
+                                  std::string_view query, size_t limit)
+{
+    uint64_t key = privateLogKey(conversation, u1, u2, false);
+    if (key != GENERAL_CONVERSATION)
+        historyLog.search(key, query, limit, snap);
+}
+
+bool HistoryCursor::next(std::string_view &user, std::string_view &msg)
+{
+    while (pos < snap.refs.size())
+    {
+        const LogRef &ref = snap.refs[pos++];
+        if (ref.segment != readerSegment)
+        {
+            const auto &seg = snap.segments[ref.segment];
+            readerOpen = reader.open(seg.segment, seg.bytes);
+            readerSegment = ref.segment;
+        }
+        if (readerOpen && reader.read(ref.offset, user, msg))
         {
-            auto pos = line.find('|');
-            if (pos != std::string::npos)
-            {
-                std::string u = line.substr(0, pos);
-                std::string m = line.substr(pos + 1);
-                result.push_back({u, m});
-            }
+            ++records;
+            return true;
         }
+        std::cerr << "[ERROR] HistoryCursor: Registro ilegible en el segmento " << ref.segment
+                  << " (posición " << ref.offset << ")" << std::endl;
     }
-    fin.close();
-    std::cerr << "[DEBUG] loadHistory: Cargado historial con " << result.size() << " entradas." << std::endl;
-    return result;
+    return false;
+}
+
+void flushHistory()
+{
+    historyLog.close();
+    std::lock_guard<std::mutex> lock(privateKeyMutex);
+    conversationFile.close();
 }
 
 std::string privateHistoryPath(const std::string &u1, const std::string &u2) {
     auto a = std::min(u1, u2), b = std::max(u1, u2);
-    return "/home/ubuntu/YaPPuccino/Servidor/History/private/" + a + "_" + b + ".txt";
+    return serverConfig.privateHistoryDir() + "/" + a + "_" + b + ".txt";
 }
 
-void appendPrivateHistory(const std::string &from, const std::string &to, const std::string &msg) {
-    std::string path = privateHistoryPath(from, to);
-    std::ofstream fout(path, std::ios::app);
-    fout << from << "|" << msg << "\n";
+uint64_t privateConversationKey(uint32_t id1, uint32_t id2) {
+    uint32_t a = std::min(id1, id2), b = std::max(id1, id2);
+    return (static_cast<uint64_t>(a) << 32) | b;
 }
 
-std::vector<std::pair<std::string,std::string>> loadPrivateHistory(const std::string &u1, const std::string &u2) {
-    std::string path = privateHistoryPath(u1, u2);
-    std::ifstream fin(path);
-    std::vector<std::pair<std::string,std::string>> result;
-    std::string line;
-    while(std::getline(fin,line)) {
-        auto pos = line.find('|');
-        result.emplace_back(line.substr(0,pos), line.substr(pos+1));
-    }
-    return result;
-}
\ No newline at end of file
+void appendPrivateHistory(uint64_t conversation, const std::string &from, const std::string &to, const std::string &msg) {
+    if (!historyLog.append(privateLogKey(conversation, from, to, true), from, msg))
+        std::cerr << "[ERROR] appendPrivateHistory: No se pudo guardar el mensaje de " << from << std::endl;
+}
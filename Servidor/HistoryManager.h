@@ -1,12 +1,82 @@
 #pragma once
 
 #include <string>
-#include <vector>
-#include <utility>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include "HistoryLog.h"
 
+/**
+ * @brief Abre el log de historial y migra el general.txt anterior si el log está vacío.
+ *
+ * Se llama una vez al arrancar, antes de aceptar conexiones.
+ *
+ * @return bool false si no se pudo abrir el directorio del log.
+ */
+bool openHistory();
 
 /**
- * @brief Agrega un mensaje al historial, manteniendo solo los últimos 50.
+ * @brief Lector incremental del historial de una conversación.
+ *
+ * Toma una instantánea de las ubicaciones de sus registros y los lee de a uno directamente
+ * de los segmentos proyectados en memoria (o del bloque descomprimido), sin copiarlos, así una respuesta grande no
+ * necesita el historial completo en memoria. Solo ve lo que había al abrirlo; los segmentos
+ * que referencia no se borran mientras el cursor exista.
+ */
+class HistoryCursor
+{
+public:
+    // Abre el historial general
+    bool openGeneral();
+
+    // Abre el historial privado; false si la conversación todavía no tiene mensajes
+    bool openPrivate(uint64_t conversation, const std::string &u1, const std::string &u2);
+
+    /**
+     * @brief Abre solo los mensajes del chat general que contienen palabras de @p query.
+     *
+     * next() los devuelve del más relevante al menos; sin coincidencias queda vacío.
+     */
+    void searchGeneral(std::string_view query, size_t limit);
+
+    // Como searchGeneral() en el historial privado entre dos usuarios
+    void searchPrivate(uint64_t conversation, const std::string &u1, const std::string &u2,
+                       std::string_view query, size_t limit);
+
+    /**
+     * @brief Lee el siguiente registro.
+     *
+     * @p user y @p msg apuntan a la proyección del segmento y valen hasta la próxima llamada.
+     *
+     * @return bool false al llegar al final de lo que había al abrir el cursor.
+     */
+    bool next(std::string_view &user, std::string_view &msg);
+
+    // true si ya no quedan registros por leer
+    bool atEnd() const { return pos >= snap.refs.size(); }
+
+    size_t recordsRead() const { return records; }
+
+    // Salta los registros no leídos salvo los últimos @p count
+    void keepLast(size_t count)
+    {
+        if (snap.refs.size() - pos > count)
+            pos = snap.refs.size() - count;
+    }
+
+private:
+    HistoryLog::Snapshot snap;
+    SegmentReader reader;
+    uint32_t readerSegment = 0; // Segmento abierto en reader (0 = ninguno)
+    bool readerOpen = false;
+    size_t pos = 0;
+    size_t records = 0;
+};
+
+
+/**
+ * @brief Agrega un mensaje al historial general, que conserva lo que permita su retención
+ * (history_limit, history_general_max_age y history_general_max_bytes).
  * 
  * @param user Nombre del usuario que envía el mensaje
  * @param msg  Texto del mensaje
@@ -14,14 +84,15 @@
 void appendToHistory(const std::string &user, const std::string &msg);
 
 /**
- * @brief Carga los mensajes almacenados en el historial.
- * 
- * @return Vector de pares <username, mensaje>, en el orden en que se guardaron.
+ * @brief Detiene la compactación y baja a disco el segmento activo del log.
+ *
+ * Se llama durante el apagado, después de cerrar las sesiones y antes de salir.
  */
-std::vector<std::pair<std::string, std::string>> loadHistory();
+void flushHistory();
 
 /**
- * @brief Genera la ruta del historial privado entre dos usuarios.
+ * @brief Ruta del archivo de historial privado entre dos usuarios en el formato anterior al
+ * log; solo se usa para migrarlo.
  *
  * @param u1 Primer usuario.
  * @param u2 Segundo usuario.
@@ -30,19 +101,18 @@ std::vector<std::pair<std::string, std::string>> loadHistory();
 std::string privateHistoryPath(const std::string &u1, const std::string &u2);
 
 /**
- * @brief Añade un mensaje al historial privado entre dos usuarios.
+ * @brief Clave de la conversación privada entre dos usuarios a partir de sus IDs.
  *
- * @param from Usuario que envía el mensaje.
- * @param to Usuario que recibe el mensaje.
- * @param msg Texto del mensaje.
+ * El orden de los IDs no importa: (a, b) y (b, a) dan la misma clave.
  */
-void appendPrivateHistory(const std::string &from, const std::string &to, const std::string &msg);
+uint64_t privateConversationKey(uint32_t id1, uint32_t id2);
 
 /**
- * @brief Carga el historial privado de mensajes entre dos usuarios.
+ * @brief Añade un mensaje al historial privado entre dos usuarios.
  *
- * @param u1 Primer usuario.
- * @param u2 Segundo usuario.
- * @return std::vector<std::pair<std::string, std::string>> Vector de pares <usuario, mensaje>.
+ * @param conversation Clave de la conversación.
+ * @param from Usuario que envía el mensaje.
+ * @param to Usuario que recibe el mensaje.
+ * @param msg Texto del mensaje.
  */
-std::vector<std::pair<std::string, std::string>> loadPrivateHistory(const std::string &u1, const std::string &u2);
\ No newline at end of file
+void appendPrivateHistory(uint64_t conversation, const std::string &from, const std::string &to, const std::string &msg);
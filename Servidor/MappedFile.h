@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+/**
+ * @brief Un archivo completo proyectado en memoria, de solo lectura.
+ *
+ * Las lecturas se sirven desde el page cache sin copiar a buffers propios. El tamaño queda
+ * fijo al abrir: lo que se agregue después al archivo no se ve hasta abrirlo de nuevo.
+ */
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    /**
+     * @brief Proyecta @p path entero.
+     *
+     * @return bool false si no se pudo abrir o proyectar (un archivo vacío también es false).
+     */
+    bool open(const std::string &path);
+
+    const char *data() const { return base; }
+    size_t size() const { return length; }
+
+private:
+    void close();
+
+    const char *base = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void *mapping = nullptr; // HANDLE de CreateFileMapping
+#endif
+};
@@ -0,0 +1,360 @@
+#include "OutboundQueue.h"
+#include "ServerConfig.h"
+#include <iostream>
+#include <vector>
+
+#ifdef YAPP_HAS_COROUTINES
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#endif
+
+static std::atomic<uint64_t> framesWritten{0};
+static std::atomic<uint64_t> totalQueuedBytes{0};
+static std::atomic<uint64_t> readerPauses{0};
+static std::atomic<uint64_t> queueOverflows{0};
+
+OutboundStats outboundStats()
+{
+    return {framesWritten.load(std::memory_order_relaxed),
+            totalQueuedBytes.load(std::memory_order_relaxed),
+            readerPauses.load(std::memory_order_relaxed),
+            queueOverflows.load(std::memory_order_relaxed)};
+}
+
+OutboundQueue::OutboundQueue(const boost::asio::any_io_executor &executor)
+    : wakeup(executor), drained(executor)
+{
+}
+
+OutboundQueue::~OutboundQueue()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    dropFramesLocked();
+}
+
+void OutboundQueue::dropFramesLocked()
+{
+    totalQueuedBytes.fetch_sub(queuedBytes, std::memory_order_relaxed);
+    queuedBytes = 0;
+    for (auto &lane : lanes)
+    {
+        for (auto &frame : lane)
+            if (frame.sequenced)
+                sent.push_back(std::move(frame.data));
+        lane.clear();
+    }
+}
+
+bool OutboundQueue::emptyLocked() const
+{
+    for (const auto &lane : lanes)
+        if (!lane.empty())
+            return false;
+    return true;
+}
+
+bool OutboundQueue::push(PooledBytes frame, bool binary, OutboundLane lane, bool sequenced)
+{
+    bool mustWake = false;
+    bool overflow = false;
+    size_t pending = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (closed)
+            return false;
+
+        size_t size = frame.size();
+        lanes[static_cast<size_t>(lane)].push_back({std::move(frame), binary, sequenced});
+        queuedBytes += size;
+        totalQueuedBytes.fetch_add(size, std::memory_order_relaxed);
+
+        if (queuedBytes > serverConfig.sessionQueueMaxBytes)
+        {
+            pending = queuedBytes;
+            dropFramesLocked();
+            closed = overflow = true;
+        }
+        else
+        {
+            mustWake = writerIdle;
+            writerIdle = false;
+        }
+    }
+
+    if (overflow)
+    {
+        abortSlowClient(pending);
+        notifyRoomWaiters();
+    }
+    else if (mustWake)
+        wake();
+    return true;
+}
+
+std::vector<PooledBytes> OutboundQueue::takeSequenced()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<PooledBytes> out = std::move(sent);
+    sent.clear();
+    if (closed)
+    {
+        // El escritor todavía puede enviarlas, pero ya no se vuelven a entregar
+        for (auto &lane : lanes)
+            for (auto &frame : lane)
+                if (frame.sequenced)
+                {
+                    out.push_back(frame.data);
+                    frame.sequenced = false;
+                }
+    }
+    return out;
+}
+
+void OutboundQueue::abortSlowClient(size_t pending)
+{
+    queueOverflows.fetch_add(1, std::memory_order_relaxed);
+    std::cerr << "[ERROR] OutboundQueue: " << pending << " bytes sin enviar, se corta al cliente lento." << std::endl;
+    // El escritor puede estar trabado en una escritura que el cliente nunca lee: cortar el
+    // socket la hace fallar, y la lectura de la sesión termina con fin de stream
+    boost::asio::post(wakeup.get_executor(), [self = shared_from_this()] {
+        boost::system::error_code ec;
+        if (self->stream)
+            self->stream->next_layer().shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+        self->wakeup.cancel();
+        self->drained.cancel();
+    });
+}
+
+void OutboundQueue::close()
+{
+    bool mustWake = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        mustWake = writerIdle;
+        writerIdle = false;
+    }
+    if (mustWake)
+        wake();
+    notifyRoomWaiters();
+}
+
+bool OutboundQueue::hasRoom()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return !closed && queuedBytes <= serverConfig.sessionQueueBytes;
+}
+
+bool OutboundQueue::isClosed()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return closed;
+}
+
+void OutboundQueue::whenRoom(std::function<void()> callback)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!closed && queuedBytes > serverConfig.sessionQueueBytes)
+        {
+            roomWaiters.push_back(std::move(callback));
+            return;
+        }
+    }
+    callback();
+}
+
+void OutboundQueue::notifyRoomWaiters()
+{
+    std::vector<std::function<void()>> waiters;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (roomWaiters.empty() || (!closed && queuedBytes > serverConfig.sessionQueueBytes / 2))
+            return;
+        waiters.swap(roomWaiters);
+    }
+    for (auto &callback : waiters)
+        callback();
+}
+
+void OutboundQueue::wake()
+{
+    boost::asio::post(wakeup.get_executor(), [self = shared_from_this()] {
+        self->wakeup.cancel();
+    });
+}
+
+void OutboundQueue::takeFront(std::deque<Frame> &lane, std::vector<Frame> &batch)
+{
+    Frame &frame = lane.front();
+    if (frame.sequenced)
+        sent.push_back(frame.data);
+    queuedBytes -= frame.data.size();
+    totalQueuedBytes.fetch_sub(frame.data.size(), std::memory_order_relaxed);
+    batch.push_back(std::move(frame));
+    lane.pop_front();
+}
+
+bool OutboundQueue::takeBatch(std::vector<Frame> &batch)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &bulk = lanes[static_cast<size_t>(OutboundLane::Bulk)];
+    size_t bulkWaiting = bulk.size();
+    size_t bytes = 0;
+
+    // Si el chat no deja lugar a las respuestas grandes durante varios lotes, la siguiente
+    // Bulk sale primero para que no esperen indefinidamente
+    if (!bulk.empty() && bulkSkipped >= BULK_STARVATION_LIMIT)
+    {
+        bytes += bulk.front().data.size();
+        takeFront(bulk, batch);
+    }
+
+    for (auto &lane : lanes)
+    {
+        while (!lane.empty())
+        {
+            size_t size = lane.front().data.size();
+            if (!batch.empty() && bytes + size > serverConfig.writeBatchBytes)
+                break;
+            bytes += size;
+            takeFront(lane, batch);
+        }
+        // Lo que queda en este carril sale antes que los siguientes
+        if (!lane.empty())
+            break;
+    }
+
+    if (bulk.empty() || bulk.size() < bulkWaiting)
+        bulkSkipped = 0;
+    else
+        ++bulkSkipped;
+
+    // Se reanuda con la cola a la mitad del umbral, para no alternar pausa/lectura por trama
+    return readerWaiting && queuedBytes <= serverConfig.sessionQueueBytes / 2;
+}
+
+#ifdef YAPP_HAS_COROUTINES
+boost::asio::awaitable<void> OutboundQueue::run(std::shared_ptr<WebSocketStream> ws)
+{
+    // La sesión puede terminar mientras hay una escritura en curso; la cola vive hasta aquí
+    auto self = shared_from_this();
+    stream = ws;
+    std::vector<Frame> batch;
+
+    while (true)
+    {
+        bool idle = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (emptyLocked())
+            {
+                if (closed)
+                {
+                    stream.reset();
+                    co_return;
+                }
+                idle = writerIdle = true;
+            }
+        }
+
+        if (idle)
+        {
+            // Un push() desde otro hilo cancela la espera; el wake se procesa en este mismo
+            // strand, así que no puede llegar antes de que la espera quede registrada
+            boost::system::error_code ec;
+            wakeup.expires_at(boost::asio::steady_timer::time_point::max());
+            co_await wakeup.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+            continue;
+        }
+
+        boost::system::error_code ec;
+        batch.clear();
+        if (takeBatch(batch))
+            drained.cancel(); // mismo strand que la lectura pausada
+        notifyRoomWaiters();
+        if (batch.empty())
+            continue;
+        // Cada trama es una escritura de Beast: también escribe por su cuenta (pong, respuesta
+        // al close y el close del apagado) y solo así esas tramas nunca caen en medio de una
+        // de las nuestras. Por eso no se juntan varias tramas en una sola escritura al socket.
+        size_t written = 0;
+        for (auto &frame : batch)
+        {
+            ws->binary(frame.binary);
+            co_await ws->async_write(boost::asio::buffer(frame.data), boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+            if (ec)
+                break;
+            ++written;
+        }
+        framesWritten.fetch_add(written, std::memory_order_relaxed);
+
+        if (ec)
+        {
+            std::cerr << "[ERROR] OutboundQueue: " << ec.message() << std::endl;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                closed = true;
+                dropFramesLocked();
+            }
+            ws->next_layer().shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+            drained.cancel();
+            notifyRoomWaiters();
+            stream.reset();
+            co_return;
+        }
+    }
+}
+
+boost::asio::awaitable<bool> OutboundQueue::waitUntilWritable()
+{
+    auto self = shared_from_this();
+    bool paused = false;
+    auto pausedSince = std::chrono::steady_clock::now();
+    while (true)
+    {
+        size_t pending = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            bool ownLimit = queuedBytes > serverConfig.sessionQueueBytes;
+            bool overLimit = ownLimit
+                || totalQueuedBytes.load(std::memory_order_relaxed) > serverConfig.outboundBudgetBytes;
+            if (closed || !overLimit)
+            {
+                readerWaiting = false;
+                co_return !closed;
+            }
+            readerWaiting = true;
+
+            // Un cliente que escribe sin leer nunca vacía su cola; pasado el plazo se lo corta
+            // igual que al exceder session_queue_max_bytes
+            if (ownLimit && paused && std::chrono::steady_clock::now() - pausedSince
+                                          > std::chrono::seconds(serverConfig.slowClientTimeoutSeconds))
+            {
+                pending = queuedBytes;
+                dropFramesLocked();
+                closed = true;
+                readerWaiting = false;
+            }
+        }
+        if (pending > 0)
+        {
+            abortSlowClient(pending);
+            co_return false;
+        }
+
+        if (!paused)
+        {
+            paused = true;
+            pausedSince = std::chrono::steady_clock::now();
+            readerPauses.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // El escritor cancela la espera cuando esta cola se vacía; el tope de 10 ms sirve para
+        // volver a mirar el presupuesto global, que depende de las demás sesiones
+        boost::system::error_code ec;
+        drained.expires_after(std::chrono::milliseconds(10));
+        co_await drained.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+    }
+}
+#endif
@@ -0,0 +1,173 @@
+#pragma once
+
+// boost 1.74 usa std::exchange en awaitable.hpp sin incluir <utility>
+#include <utility>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/beast/websocket.hpp>
+#include "BufferPool.h"
+
+// Las sesiones con corrutinas solo existen si el compilador y boost soportan co_await (C++20)
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+#define YAPP_HAS_COROUTINES 1
+#include <boost/asio/awaitable.hpp>
+#endif
+
+using WebSocketStream = boost::beast::websocket::stream<boost::asio::ip::tcp::socket>;
+
+// Contadores globales del camino de salida
+struct OutboundStats
+{
+    uint64_t frames;       // Tramas WebSocket escritas
+    uint64_t queuedBytes;  // Bytes encolados en este momento, sumando todas las sesiones
+    uint64_t readerPauses; // Veces que se pausó la lectura de una sesión por su cola o el presupuesto
+    uint64_t overflows;    // Sesiones cortadas por exceder session_queue_max_bytes
+};
+
+OutboundStats outboundStats();
+
+// Carril de prioridad de una trama de salida. El escritor vacía los carriles en este orden,
+// así una respuesta grande ya encolada no retrasa la presencia ni el chat en vivo.
+enum class OutboundLane : uint8_t
+{
+    Control, // SESSION_INFO, cambios de estado, errores y tramas reenviadas al reanudar
+    Chat,    // Mensajes en vivo y respuestas cortas
+    Bulk     // Historiales y listas completas de usuarios
+};
+
+// Cola de salida de una sesión con corrutinas. Cualquier hilo encola tramas y una sola
+// corrutina, que corre en el strand del socket, las escribe por carril (en orden dentro de
+// cada uno). Así nunca hay dos escrituras simultáneas sobre el mismo stream.
+//
+// Como los carriles pueden adelantar tramas, las que llevan número de secuencia se numeran
+// en el orden en que sale cada una: la cola las junta y la sesión las pasa a su ventana de
+// repetición con takeSequenced().
+class OutboundQueue : public std::enable_shared_from_this<OutboundQueue>
+{
+public:
+    // executor: el strand del socket de la sesión
+    explicit OutboundQueue(const boost::asio::any_io_executor &executor);
+    ~OutboundQueue();
+
+    /**
+     * @brief Encola una trama y despierta al escritor si estaba esperando.
+     *
+     * Si la cola pasa de session_queue_max_bytes el cliente no está leyendo: se descarta la
+     * cola y se corta su socket en lugar de seguir acumulando memoria.
+     *
+     * @param frame Contenido de la trama.
+     * @param binary true para trama binaria, false para texto.
+     * @param lane Carril de prioridad.
+     * @param sequenced true si la trama cuenta para la reanudación (ver takeSequenced()).
+     * @return bool false si la cola ya estaba cerrada y la trama no se encoló.
+     */
+    bool push(PooledBytes frame, bool binary, OutboundLane lane, bool sequenced = false);
+
+    // El escritor termina después de vaciar la cola. Las tramas que lleguen luego se descartan.
+    void close();
+
+    // true si lo encolado no llega a session_queue_bytes (se puede seguir produciendo)
+    bool hasRoom();
+
+    // true después de close(), de un error de escritura o de cortar a un cliente lento
+    bool isClosed();
+
+    /**
+     * @brief Llama a @p callback una vez, cuando lo encolado baje a la mitad de
+     * session_queue_bytes o la cola se cierre.
+     *
+     * Si ya hay lugar (como en hasRoom()) o la cola está cerrada se llama enseguida desde el
+     * hilo que pregunta; si no, desde el escritor. Sirve a quien produce tramas fuera del
+     * strand (el pool de historial) para seguir sin tener que esperar bloqueado.
+     */
+    void whenRoom(std::function<void()> callback);
+
+    /**
+     * @brief Entrega, en el orden en que salieron, las tramas numeradas que el escritor ya
+     * tomó (o que se descartaron al cortar la sesión).
+     *
+     * Con la cola cerrada también entrega las que siguen encoladas, en el orden en que el
+     * escritor las tomará. Llamar con el mutex de la sesión tomado, el mismo que se usa al
+     * encolarlas, para que la numeración no se intercale.
+     */
+    std::vector<PooledBytes> takeSequenced();
+
+#ifdef YAPP_HAS_COROUTINES
+    /**
+     * @brief Corrutina escritora: envía las tramas encoladas hasta que se llame close().
+     *
+     * Toma de una vez las tramas pendientes (hasta write_batch_bytes, por carril) y las
+     * escribe una por una con el stream de Beast, cada una en su propia escritura. Si una escritura falla se descarta el resto
+     * y se corta el socket, lo que también termina la lectura de la sesión.
+     */
+    boost::asio::awaitable<void> run(std::shared_ptr<WebSocketStream> ws);
+
+    /**
+     * @brief Espera (sin bloquear el hilo) mientras esta cola pase de session_queue_bytes o
+     * el total encolado del servidor pase de outbound_budget_bytes.
+     *
+     * La sesión la llama antes de cada lectura, así un cliente que pide más de lo que
+     * consume deja de ser leído hasta que sus respuestas salgan. Si su propia cola sigue
+     * llena pasados slow_client_timeout segundos, se lo desconecta.
+     *
+     * @return bool false si la cola se cerró (ya no tiene sentido producir más tramas).
+     */
+    boost::asio::awaitable<bool> waitUntilWritable();
+#endif
+
+private:
+    struct Frame
+    {
+        PooledBytes data;
+        bool binary;
+        bool sequenced;
+    };
+
+    static constexpr size_t LANE_COUNT = 3;
+
+    // Lotes seguidos sin tramas Bulk antes de darle una aunque haya tramas más urgentes
+    static constexpr unsigned BULK_STARVATION_LIMIT = 4;
+
+    // Pide al escritor (en su strand) que revise la cola
+    void wake();
+
+    // Saca de la cola las tramas del próximo lote, por carril y hasta write_batch_bytes (al
+    // menos una si hay). Devuelve true si la lectura estaba pausada y la cola ya bajó lo
+    // suficiente para reanudarla.
+    bool takeBatch(std::vector<Frame> &batch);
+
+    // Pasa la primera trama del carril al lote; llamar con mutex tomado
+    void takeFront(std::deque<Frame> &lane, std::vector<Frame> &batch);
+
+    bool emptyLocked() const;
+
+    // Descarta lo encolado descontándolo del total global. Las tramas numeradas pasan a
+    // sent para que la sesión las conserve. Llamar con mutex tomado.
+    void dropFramesLocked();
+
+    // Registra el corte y cierra el socket desde el strand. La cola ya debe estar cerrada.
+    void abortSlowClient(size_t pending);
+
+    // Llama a los que esperan en whenRoom() si la cola bajó lo suficiente o se cerró
+    void notifyRoomWaiters();
+
+    std::mutex mutex;
+    std::array<std::deque<Frame>, LANE_COUNT> lanes;
+    std::vector<PooledBytes> sent;       // Tramas numeradas ya tomadas, pendientes de takeSequenced()
+    std::vector<std::function<void()>> roomWaiters; // Pendientes de whenRoom()
+    unsigned bulkSkipped = 0;            // Lotes seguidos que dejaron tramas Bulk esperando
+    size_t queuedBytes = 0;
+    bool closed = false;
+    bool writerIdle = false;             // El escritor está esperando en wakeup
+    bool readerWaiting = false;          // La lectura está pausada en drained
+    std::shared_ptr<WebSocketStream> stream; // Socket del escritor mientras corre (para cortarlo)
+    boost::asio::steady_timer wakeup;    // Solo se usa desde el strand
+    boost::asio::steady_timer drained;   // Solo se usa desde el strand
+};
@@ -0,0 +1,80 @@
+#include "PresenceIndex.h"
+#include "ServerConfig.h"
+#include <mutex>
+
+PooledVector<uint32_t> PresenceIndex::subscribe(uint32_t subscriber, const PooledVector<uint32_t> &targets)
+{
+    PooledVector<uint32_t> accepted;
+    accepted.reserve(targets.size());
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto &mine = watching[subscriber];
+    for (uint32_t target : targets)
+    {
+        if (target == subscriber)
+            continue; // Los cambios propios siempre le llegan
+        if (mine.count(target) == 0)
+        {
+            if (mine.size() >= serverConfig.presenceSubscriptionsMax)
+                continue;
+            mine.insert(target);
+            watchers[target].insert(subscriber);
+            ++total;
+        }
+        accepted.push_back(target);
+    }
+    if (mine.empty())
+        watching.erase(subscriber);
+    return accepted;
+}
+
+void PresenceIndex::removeLocked(uint32_t subscriber, uint32_t target)
+{
+    auto it = watchers.find(target);
+    if (it == watchers.end() || it->second.erase(subscriber) == 0)
+        return;
+    if (it->second.empty())
+        watchers.erase(it);
+    --total;
+}
+
+void PresenceIndex::unsubscribe(uint32_t subscriber, const PooledVector<uint32_t> &targets)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto mine = watching.find(subscriber);
+    if (mine == watching.end())
+        return;
+    for (uint32_t target : targets)
+    {
+        if (mine->second.erase(target) > 0)
+            removeLocked(subscriber, target);
+    }
+    if (mine->second.empty())
+        watching.erase(mine);
+}
+
+void PresenceIndex::clear(uint32_t subscriber)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto mine = watching.find(subscriber);
+    if (mine == watching.end())
+        return;
+    for (uint32_t target : mine->second)
+        removeLocked(subscriber, target);
+    watching.erase(mine);
+}
+
+PooledVector<uint32_t> PresenceIndex::subscribersOf(uint32_t target)
+{
+    PooledVector<uint32_t> ids;
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it = watchers.find(target);
+    if (it != watchers.end())
+        ids.assign(it->second.begin(), it->second.end());
+    return ids;
+}
+
+size_t PresenceIndex::size()
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return total;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <shared_mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include "BufferPool.h"
+
+/**
+ * @brief Suscripciones de presencia entre usuarios, indexadas en los dos sentidos.
+ *
+ * Cada cliente se suscribe a los usuarios que muestra; un cambio de estado se envía solo a
+ * los suscriptores del usuario que cambió (índice inverso), así el costo de la presencia
+ * depende del interés real y no del total de conectados. Los usuarios se identifican por
+ * su ID del directorio.
+ */
+class PresenceIndex
+{
+public:
+    /**
+     * @brief Suscribe a @p subscriber a los cambios de estado de cada usuario de @p targets.
+     *
+     * Las suscripciones repetidas no cuentan dos veces. Las que pasen del máximo por
+     * suscriptor (presence_subscriptions_max) se ignoran.
+     *
+     * @return PooledVector<uint32_t> Los IDs a los que quedó suscrito, en el orden pedido.
+     */
+    PooledVector<uint32_t> subscribe(uint32_t subscriber, const PooledVector<uint32_t> &targets);
+
+    // Quita las suscripciones de @p subscriber a los usuarios de @p targets
+    void unsubscribe(uint32_t subscriber, const PooledVector<uint32_t> &targets);
+
+    // Quita todas las suscripciones de @p subscriber (p. ej. al empezar una sesión nueva)
+    void clear(uint32_t subscriber);
+
+    // IDs de los usuarios suscritos a @p target
+    PooledVector<uint32_t> subscribersOf(uint32_t target);
+
+    // Total de suscripciones vigentes entre todos los usuarios
+    size_t size();
+
+private:
+    // Quita una suscripción de ambos índices; llamar con mutex tomado en exclusivo
+    void removeLocked(uint32_t subscriber, uint32_t target);
+
+    std::shared_mutex mutex;
+    std::unordered_map<uint32_t, std::unordered_set<uint32_t>> watchers; // usuario → quién lo sigue
+    std::unordered_map<uint32_t, std::unordered_set<uint32_t>> watching; // suscriptor → a quién sigue
+    size_t total = 0;
+};
@@ -0,0 +1,224 @@
+#include "SearchIndex.h"
+#include "AppendFile.h"
+#include "MappedFile.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+static const char MAGIC[8] = {'Y', 'A', 'P', 'P', 'I', 'D', 'X', '1'};
+static const size_t MAX_TERM_BYTES = 64; // Las palabras más largas se indexan (y se buscan) cortadas
+
+template <typename T>
+static void putRaw(std::string &out, T value)
+{
+    out.append(reinterpret_cast<const char *>(&value), sizeof value);
+}
+
+// Lee un entero en @p pos si entra en @p size
+template <typename T>
+static bool getRaw(const char *data, size_t size, size_t &pos, T &value)
+{
+    if (size - pos < sizeof value)
+        return false;
+    std::memcpy(&value, data + pos, sizeof value);
+    pos += sizeof value;
+    return true;
+}
+
+std::vector<std::string> SearchIndex::tokenize(std::string_view text)
+{
+    std::vector<std::string> terms;
+    std::string term;
+    auto flush = [&] {
+        if (!term.empty())
+            terms.push_back(term.substr(0, MAX_TERM_BYTES));
+        term.clear();
+    };
+    for (unsigned char c : text)
+    {
+        if (c >= 'A' && c <= 'Z')
+            term += static_cast<char>(c - 'A' + 'a');
+        else if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c >= 0x80)
+            term += static_cast<char>(c);
+        else
+            flush();
+    }
+    flush();
+    std::sort(terms.begin(), terms.end());
+    terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+    return terms;
+}
+
+void SearchIndex::addTo(Postings &postings, uint64_t conversation, uint64_t seq, std::string_view msg)
+{
+    auto &terms = postings[conversation];
+    for (auto &term : tokenize(msg))
+        terms[std::move(term)].push_back(seq);
+}
+
+void SearchIndex::add(uint64_t conversation, uint64_t seq, std::string_view msg)
+{
+    auto terms = tokenize(msg);
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &conv = postings[conversation];
+    for (auto &term : terms)
+    {
+        auto &list = conv[std::move(term)];
+        // Lo nuevo llega en orden; lo que no (mensajes movidos al arrancar) se ordena en finishLoading
+        list.push_back(seq);
+    }
+}
+
+bool SearchIndex::save(const Postings &postings, const std::string &path)
+{
+    std::string out(MAGIC, sizeof MAGIC);
+    putRaw(out, static_cast<uint32_t>(postings.size()));
+    for (const auto &[conversation, terms] : postings)
+    {
+        putRaw(out, conversation);
+        putRaw(out, static_cast<uint32_t>(terms.size()));
+        for (const auto &[term, seqs] : terms)
+        {
+            putRaw(out, static_cast<uint16_t>(term.size()));
+            out += term;
+            putRaw(out, static_cast<uint32_t>(seqs.size()));
+            out.append(reinterpret_cast<const char *>(seqs.data()), seqs.size() * sizeof(uint64_t));
+        }
+    }
+
+    std::string tmp = path + ".tmp";
+    AppendFile file;
+    bool ok = file.open(tmp, true) && file.write(out) && file.sync();
+    file.close();
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        std::cerr << "[ERROR] SearchIndex: No se pudo escribir " << path << std::endl;
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool SearchIndex::merge(const std::string &path)
+{
+    MappedFile file;
+    if (!file.open(path) || file.size() < sizeof MAGIC || std::memcmp(file.data(), MAGIC, sizeof MAGIC) != 0)
+        return false;
+
+    // Se lee entero antes de tocar el índice: un archivo cortado no agrega nada
+    Postings loaded;
+    const char *data = file.data();
+    size_t size = file.size(), pos = sizeof MAGIC;
+    uint32_t conversations;
+    if (!getRaw(data, size, pos, conversations))
+        return false;
+    for (uint32_t c = 0; c < conversations; ++c)
+    {
+        uint64_t conversation;
+        uint32_t termCount;
+        if (!getRaw(data, size, pos, conversation) || !getRaw(data, size, pos, termCount))
+            return false;
+        auto &terms = loaded[conversation];
+        for (uint32_t t = 0; t < termCount; ++t)
+        {
+            uint16_t termLen;
+            uint32_t count;
+            if (!getRaw(data, size, pos, termLen) || size - pos < termLen)
+                return false;
+            std::string term(data + pos, termLen);
+            pos += termLen;
+            if (!getRaw(data, size, pos, count) || (size - pos) / sizeof(uint64_t) < count)
+                return false;
+            auto &seqs = terms[std::move(term)];
+            seqs.resize(count);
+            std::memcpy(seqs.data(), data + pos, count * sizeof(uint64_t));
+            pos += count * sizeof(uint64_t);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &[conversation, terms] : loaded)
+    {
+        auto &conv = postings[conversation];
+        for (auto &[term, seqs] : terms)
+        {
+            auto &list = conv[term];
+            list.insert(list.end(), seqs.begin(), seqs.end());
+        }
+    }
+    return true;
+}
+
+void SearchIndex::finishLoading()
+{
+    // Una compactación deja mensajes viejos en segmentos nuevos, y uno cortada los deja en dos
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &[conversation, terms] : postings)
+        for (auto &[term, seqs] : terms)
+        {
+            std::sort(seqs.begin(), seqs.end());
+            seqs.erase(std::unique(seqs.begin(), seqs.end()), seqs.end());
+        }
+}
+
+void SearchIndex::erase(uint64_t conversation)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    postings.erase(conversation);
+}
+
+std::vector<uint64_t> SearchIndex::search(uint64_t conversation, std::string_view query, uint64_t firstLive, size_t limit)
+{
+    std::vector<uint64_t> result;
+    auto terms = tokenize(query);
+    if (terms.empty() || limit == 0)
+        return result;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto conv = postings.find(conversation);
+    if (conv == postings.end())
+        return result;
+
+    // Solo las listas de los términos buscados, sin los mensajes ya descartados
+    std::vector<const std::vector<uint64_t> *> lists;
+    for (const auto &term : terms)
+    {
+        auto it = conv->second.find(term);
+        if (it == conv->second.end())
+            continue;
+        auto &seqs = it->second;
+        seqs.erase(seqs.begin(), std::lower_bound(seqs.begin(), seqs.end(), firstLive));
+        if (seqs.empty())
+            conv->second.erase(it);
+        else
+            lists.push_back(&seqs);
+    }
+    if (lists.empty())
+        return result;
+
+    // Un solo término: los más nuevos son el final de la lista
+    if (lists.size() == 1)
+    {
+        const auto &seqs = *lists[0];
+        size_t n = std::min(limit, seqs.size());
+        result.assign(seqs.rbegin(), seqs.rbegin() + n);
+        return result;
+    }
+
+    std::unordered_map<uint64_t, unsigned> scores;
+    for (const auto *seqs : lists)
+        for (uint64_t seq : *seqs)
+            ++scores[seq];
+    std::vector<std::pair<unsigned, uint64_t>> ranked;
+    ranked.reserve(scores.size());
+    for (const auto &[seq, score] : scores)
+        ranked.emplace_back(score, seq);
+    size_t n = std::min(limit, ranked.size());
+    std::partial_sort(ranked.begin(), ranked.begin() + n, ranked.end(),
+                      [](const auto &a, const auto &b) { return a > b; });
+    result.reserve(n);
+    for (size_t i = 0; i < n; ++i)
+        result.push_back(ranked[i].second);
+    return result;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Índice invertido del historial para búsquedas por palabras.
+ *
+ * Por conversación, cada término apunta a la lista ordenada de secuencias (los IDs de
+ * mensaje del log) de los mensajes que lo contienen. Lo alimenta el hilo de escritura del
+ * log a medida que agrega mensajes; cada segmento sellado guarda además sus listas en un
+ * archivo propio (seg-N.idx) para no volver a separar sus mensajes al arrancar.
+ *
+ * Los términos son las palabras del mensaje en minúsculas: letras y dígitos ASCII, más los
+ * bytes no ASCII, así las palabras con acentos (UTF-8) quedan enteras.
+ */
+class SearchIndex
+{
+public:
+    // conversación → término → secuencias
+    using Postings = std::unordered_map<uint64_t, std::unordered_map<std::string, std::vector<uint64_t>>>;
+
+    // Separa @p text en términos distintos
+    static std::vector<std::string> tokenize(std::string_view text);
+
+    // Agrega un mensaje a @p postings (sin lock; sirve para armar el índice de un segmento)
+    static void addTo(Postings &postings, uint64_t conversation, uint64_t seq, std::string_view msg);
+
+    /**
+     * @brief Guarda @p postings en @p path (se escribe aparte y se renombra).
+     *
+     * Archivo: "YAPPIDX1", cantidad de conversaciones (u32) y por cada una su clave (u64),
+     * cantidad de términos (u32) y por término: largo (u16), término, cantidad (u32) y las
+     * secuencias (u64).
+     */
+    static bool save(const Postings &postings, const std::string &path);
+
+    // Agrega un mensaje recién escrito
+    void add(uint64_t conversation, uint64_t seq, std::string_view msg);
+
+    // Agrega las listas guardadas en @p path; false (sin cambios) si el archivo no es válido
+    bool merge(const std::string &path);
+
+    // Ordena y quita repetidos después de cargar con merge()/add() fuera de orden
+    void finishLoading();
+
+    // Olvida una conversación que ya no tiene historial
+    void erase(uint64_t conversation);
+
+    /**
+     * @brief Mensajes de la conversación que contienen alguno de los términos de @p query.
+     *
+     * Primero los que contienen más términos distintos de la búsqueda y, entre ellos, los
+     * más nuevos.
+     *
+     * @param firstLive Secuencia del mensaje más viejo que sigue en el historial: las
+     * anteriores ya se descartaron y se podan de las listas.
+     * @return std::vector<uint64_t> Hasta @p limit secuencias, de la más relevante a la menos.
+     */
+    std::vector<uint64_t> search(uint64_t conversation, std::string_view query, uint64_t firstLive, size_t limit);
+
+private:
+    std::mutex mutex;
+    Postings postings;
+};
@@ -0,0 +1,241 @@
+#include "ServerConfig.h"
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <vector>
+
+ServerConfig serverConfig;
+
+// Convierte un valor numérico y verifica que esté en [min, max]
+static bool parseNumber(const std::string &value, long long min, long long max, long long &out)
+{
+    try {
+        size_t used = 0;
+        out = std::stoll(value, &used);
+        return used == value.size() && out >= min && out <= max;
+    } catch (const std::exception &) {
+        return false;
+    }
+}
+
+static bool parseBool(const std::string &value, bool &out)
+{
+    if (value == "1" || value == "true" || value == "si" || value == "on") { out = true; return true; }
+    if (value == "0" || value == "false" || value == "no" || value == "off") { out = false; return true; }
+    return false;
+}
+
+// Una entrada por clave: cómo asignarla a la configuración
+using Setter = std::function<bool(ServerConfig &, const std::string &)>;
+
+template <typename T>
+static Setter numberSetter(T ServerConfig::*field, long long min, long long max)
+{
+    return [field, min, max](ServerConfig &config, const std::string &value) {
+        long long n;
+        if (!parseNumber(value, min, max, n))
+            return false;
+        config.*field = static_cast<T>(n);
+        return true;
+    };
+}
+
+static bool parseSessionMode(const std::string &value, SessionMode &out)
+{
+    if (value == "threads") { out = SessionMode::Threads; return true; }
+    if (value == "coroutines") { out = SessionMode::Coroutines; return true; }
+    return false;
+}
+
+// "id@host:puerto,id@host:puerto,..." (vacío: sin otros nodos)
+static bool parseClusterPeers(const std::string &value, std::vector<ClusterPeer> &out)
+{
+    out.clear();
+    size_t begin = 0;
+    while (begin < value.size())
+    {
+        size_t end = value.find(',', begin);
+        if (end == std::string::npos)
+            end = value.size();
+        std::string entry = value.substr(begin, end - begin);
+        begin = end + 1;
+
+        auto at = entry.find('@');
+        auto colon = entry.rfind(':');
+        long long id, port;
+        if (at == std::string::npos || colon == std::string::npos || colon < at + 2
+            || !parseNumber(entry.substr(0, at), 1, 65535, id)
+            || !parseNumber(entry.substr(colon + 1), 1, 65535, port))
+            return false;
+        out.push_back({static_cast<uint16_t>(id), entry.substr(at + 1, colon - at - 1), static_cast<uint16_t>(port)});
+    }
+    return true;
+}
+
+static const std::map<std::string, Setter> &configKeys()
+{
+    static const std::map<std::string, Setter> keys = {
+        {"port",                 numberSetter(&ServerConfig::port, 1, 65535)},
+        {"data_dir",             [](ServerConfig &c, const std::string &v) { c.dataDir = v; return !v.empty(); }},
+        {"inactivity_threshold", numberSetter(&ServerConfig::inactivityThresholdSeconds, 1, 86400)},
+        {"sweep_interval",       numberSetter(&ServerConfig::sweepIntervalSeconds, 1, 3600)},
+        {"history_limit",        numberSetter(&ServerConfig::historyLimit, 1, 1000000)},
+        {"history_general_max_age",   numberSetter(&ServerConfig::historyGeneralMaxAgeSeconds, 0, 100ll * 365 * 86400)},
+        {"history_general_max_bytes", numberSetter(&ServerConfig::historyGeneralMaxBytes, 0, 1ll << 40)},
+        {"history_private_limit",     numberSetter(&ServerConfig::historyPrivateLimit, 0, 1ll << 32)},
+        {"history_private_max_age",   numberSetter(&ServerConfig::historyPrivateMaxAgeSeconds, 0, 100ll * 365 * 86400)},
+        {"history_private_max_bytes", numberSetter(&ServerConfig::historyPrivateMaxBytes, 0, 1ll << 40)},
+        {"history_chunk_bytes",  numberSetter(&ServerConfig::historyChunkBytes, 512, 1 << 20)},
+        {"history_segment_bytes",    numberSetter(&ServerConfig::historySegmentBytes, 64 * 1024, 1 << 30)},
+        {"history_compact_interval", numberSetter(&ServerConfig::historyCompactIntervalSeconds, 1, 86400)},
+        {"history_compress",     [](ServerConfig &c, const std::string &v) { return parseBool(v, c.historyCompress); }},
+        {"history_block_bytes",  numberSetter(&ServerConfig::historyBlockBytes, 4096, 16 << 20)},
+        {"history_fsync",        [](ServerConfig &c, const std::string &v) { return parseBool(v, c.historyFsync); }},
+        {"history_io_threads",   numberSetter(&ServerConfig::historyIoThreads, 1, 64)},
+        {"user_search_limit",    numberSetter(&ServerConfig::userSearchLimit, 1, 255)},
+        {"history_search_limit", numberSetter(&ServerConfig::historySearchLimit, 1, 255)},
+        {"presence_subscriptions_max", numberSetter(&ServerConfig::presenceSubscriptionsMax, 1, 1 << 22)},
+        {"replay_window",        numberSetter(&ServerConfig::replayWindowSize, 0, 65536)},
+        {"resume_window",        numberSetter(&ServerConfig::resumeWindowSeconds, 0, 86400)},
+        {"registry_cold_after",  numberSetter(&ServerConfig::registryColdAfterSeconds, 1, 365 * 86400)},
+        {"registry_evict_interval", numberSetter(&ServerConfig::registryEvictIntervalSeconds, 1, 86400)},
+        {"drain_timeout",        numberSetter(&ServerConfig::drainTimeoutSeconds, 0, 600)},
+        {"session_mode",         [](ServerConfig &c, const std::string &v) { return parseSessionMode(v, c.sessionMode); }},
+        {"io_threads",           numberSetter(&ServerConfig::ioThreads, 1, 256)},
+        {"max_message_bytes",    numberSetter(&ServerConfig::maxMessageBytes, 1024, 1LL << 30)},
+        {"write_buffer_bytes",   numberSetter(&ServerConfig::writeBufferBytes, 8, 1 << 24)},
+        {"write_batch_bytes",    numberSetter(&ServerConfig::writeBatchBytes, 1024, 1 << 24)},
+        {"session_queue_bytes",     numberSetter(&ServerConfig::sessionQueueBytes, 1024, 1LL << 32)},
+        {"session_queue_max_bytes", numberSetter(&ServerConfig::sessionQueueMaxBytes, 1024, 1LL << 34)},
+        {"outbound_budget_bytes",   numberSetter(&ServerConfig::outboundBudgetBytes, 1024, 1LL << 40)},
+        {"slow_client_timeout",     numberSetter(&ServerConfig::slowClientTimeoutSeconds, 1, 3600)},
+        {"log_frames",           [](ServerConfig &c, const std::string &v) { return parseBool(v, c.logFrames); }},
+        {"text_scan_kernel",     [](ServerConfig &c, const std::string &v) {
+             c.textScanKernel = v;
+             return v == "auto" || v == "avx2" || v == "sse2" || v == "escalar";
+         }},
+        {"cluster_node_id",      numberSetter(&ServerConfig::clusterNodeId, 0, 65535)},
+        {"cluster_bind",         [](ServerConfig &c, const std::string &v) { c.clusterBind = v; return !v.empty(); }},
+        {"cluster_port",         numberSetter(&ServerConfig::clusterPort, 1, 65535)},
+        {"cluster_secret",       [](ServerConfig &c, const std::string &v) { c.clusterSecret = v; return v.size() <= 255; }},
+        {"cluster_peers",        [](ServerConfig &c, const std::string &v) { return parseClusterPeers(v, c.clusterPeers); }},
+    };
+    return keys;
+}
+
+static bool setConfigValue(ServerConfig &config, const std::string &key, const std::string &value, const std::string &origin)
+{
+    auto it = configKeys().find(key);
+    if (it == configKeys().end())
+    {
+        std::cerr << "[ERROR] " << origin << ": Clave de configuración desconocida: " << key << std::endl;
+        return false;
+    }
+    if (!it->second(config, value))
+    {
+        std::cerr << "[ERROR] " << origin << ": Valor inválido para " << key << ": " << value << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static std::string trim(const std::string &s)
+{
+    auto begin = s.find_first_not_of(" \t\r");
+    if (begin == std::string::npos)
+        return "";
+    auto end = s.find_last_not_of(" \t\r");
+    return s.substr(begin, end - begin + 1);
+}
+
+bool loadConfigFile(const std::string &path, ServerConfig &config)
+{
+    std::ifstream fin(path);
+    if (!fin)
+    {
+        std::cerr << "[ERROR] loadConfigFile: No se pudo abrir " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    bool ok = true;
+    while (std::getline(fin, line))
+    {
+        ++lineNumber;
+        line = trim(line);
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        auto pos = line.find('=');
+        std::string origin = path + ":" + std::to_string(lineNumber);
+        if (pos == std::string::npos)
+        {
+            std::cerr << "[ERROR] " << origin << ": Se esperaba \"clave = valor\"" << std::endl;
+            ok = false;
+            continue;
+        }
+        ok = setConfigValue(config, trim(line.substr(0, pos)), trim(line.substr(pos + 1)), origin) && ok;
+    }
+    return ok;
+}
+
+static void printUsage(const char *program)
+{
+    std::cout << "Uso: " << program << " [--config archivo] [--clave valor | --clave=valor]...\n"
+              << "Claves disponibles:\n";
+    for (const auto &entry : configKeys())
+        std::cout << "  --" << entry.first << "\n";
+}
+
+bool parseCommandLine(int argc, char **argv, ServerConfig &config)
+{
+    // Primero se separan los pares clave/valor para poder leer --config antes que el resto
+    std::vector<std::pair<std::string, std::string>> overrides;
+    std::string configPath;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h")
+        {
+            printUsage(argv[0]);
+            return false;
+        }
+        if (arg.rfind("--", 0) != 0)
+        {
+            std::cerr << "[ERROR] Argumento inesperado: " << arg << std::endl;
+            return false;
+        }
+
+        std::string key = arg.substr(2), value;
+        auto eq = key.find('=');
+        if (eq != std::string::npos)
+        {
+            value = key.substr(eq + 1);
+            key.resize(eq);
+        }
+        else if (i + 1 < argc)
+        {
+            value = argv[++i];
+        }
+        else
+        {
+            std::cerr << "[ERROR] Falta el valor de --" << key << std::endl;
+            return false;
+        }
+
+        if (key == "config")
+            configPath = value;
+        else
+            overrides.emplace_back(key, value);
+    }
+
+    if (!configPath.empty() && !loadConfigFile(configPath, config))
+        return false;
+
+    bool ok = true;
+    for (const auto &[key, value] : overrides)
+        ok = setConfigValue(config, key, value, "línea de comandos") && ok;
+    return ok;
+}
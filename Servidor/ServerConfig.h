@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Cómo se atiende cada conexión
+enum class SessionMode
+{
+    Threads,    // Un hilo bloqueante por conexión
+    Coroutines  // Corrutinas C++20 sobre el io_context compartido (io_threads hilos)
+};
+
+// Otro nodo del cluster (cluster_peers: "id@host:puerto", separados por comas)
+struct ClusterPeer
+{
+    uint16_t id;
+    std::string host;
+    uint16_t port;
+};
+
+// Parámetros de ejecución del servidor. Los valores por defecto son los que antes estaban
+// fijos en el código; se pueden cambiar con un archivo de configuración y/o la línea de
+// comandos sin recompilar.
+struct ServerConfig
+{
+    uint16_t port = 5000;                               // port
+    std::string dataDir = ".";                          // data_dir: History/, registry.chk y registry.cold
+
+    int inactivityThresholdSeconds = 25;                // inactivity_threshold
+    int sweepIntervalSeconds = 5;                       // sweep_interval
+    size_t historyLimit = 50;                           // history_limit: mensajes del chat general
+    int64_t historyGeneralMaxAgeSeconds = 0;            // history_general_max_age: 0 = sin límite
+    uint64_t historyGeneralMaxBytes = 0;                // history_general_max_bytes: 0 = sin límite
+    size_t historyPrivateLimit = 0;                     // history_private_limit: mensajes por conversación privada
+    int64_t historyPrivateMaxAgeSeconds = 0;            // history_private_max_age: 0 = sin límite
+    uint64_t historyPrivateMaxBytes = 0;                // history_private_max_bytes: 0 = sin límite
+    size_t historyChunkBytes = 16 * 1024;               // history_chunk_bytes: tamaño de cada parte de un historial
+    size_t historySegmentBytes = 8 * 1024 * 1024;       // history_segment_bytes: tamaño de un segmento del log
+    int historyCompactIntervalSeconds = 60;             // history_compact_interval
+    bool historyCompress = true;                        // history_compress: comprimir segmentos sellados
+    size_t historyBlockBytes = 64 * 1024;               // history_block_bytes: bloque de compresión
+    bool historyFsync = false;                          // history_fsync: fdatasync después de cada escritura
+    unsigned historyIoThreads = 2;                      // history_io_threads: lecturas de historial (modo corrutinas)
+    size_t userSearchLimit = 20;                        // user_search_limit: resultados máximos de SEARCH_USERS
+    size_t historySearchLimit = 20;                     // history_search_limit: resultados máximos de SEARCH_HISTORY
+    size_t presenceSubscriptionsMax = 4096;             // presence_subscriptions_max: usuarios seguidos por cliente
+
+    size_t replayWindowSize = 64;                       // replay_window: tramas guardadas por usuario
+    int resumeWindowSeconds = 30;                       // resume_window
+    int drainTimeoutSeconds = 5;                        // drain_timeout
+    int registryColdAfterSeconds = 86400;               // registry_cold_after: desconexión para pasar al disco
+    int registryEvictIntervalSeconds = 300;             // registry_evict_interval
+
+    SessionMode sessionMode = SessionMode::Threads;     // session_mode: threads | coroutines
+    unsigned ioThreads = 1;                             // io_threads: hilos que corren io_context
+    size_t maxMessageBytes = 16 * 1024 * 1024;          // max_message_bytes: límite de lectura WebSocket
+    size_t writeBufferBytes = 4096;                     // write_buffer_bytes: buffer de escritura WebSocket
+    size_t writeBatchBytes = 64 * 1024;                 // write_batch_bytes: bytes que el escritor toma de la cola por vez
+    size_t sessionQueueBytes = 256 * 1024;              // session_queue_bytes: pausa la lectura de la sesión
+    size_t sessionQueueMaxBytes = 8 * 1024 * 1024;      // session_queue_max_bytes: corta al cliente lento
+    size_t outboundBudgetBytes = 256 * 1024 * 1024;     // outbound_budget_bytes: total encolado del servidor
+    int slowClientTimeoutSeconds = 30;                  // slow_client_timeout: lectura pausada como máximo
+    bool logFrames = false;                             // log_frames: volcar cada trama en hexadecimal
+    std::string textScanKernel = "auto";                // text_scan_kernel: auto | avx2 | sse2 | escalar
+
+    uint16_t clusterNodeId = 0;                         // cluster_node_id: 0 = sin cluster
+    std::string clusterBind = "127.0.0.1";              // cluster_bind: dirección de los enlaces entre nodos
+    uint16_t clusterPort = 5100;                        // cluster_port: enlaces con los otros nodos
+    std::string clusterSecret;                          // cluster_secret: clave compartida del HELLO
+    std::vector<ClusterPeer> clusterPeers;              // cluster_peers
+
+    std::string historyDir() const { return dataDir + "/History"; }
+    std::string generalHistoryFile() const { return historyDir() + "/general.txt"; }
+    std::string privateHistoryDir() const { return historyDir() + "/private"; }
+    std::string historyLogDir() const { return historyDir() + "/log"; }
+    std::string checkpointFile() const { return dataDir + "/registry.chk"; }
+    std::string coldRegistryFile() const { return dataDir + "/registry.cold"; }
+};
+
+// Configuración vigente. Se llena una sola vez al arrancar y después solo se lee.
+extern ServerConfig serverConfig;
+
+/**
+ * @brief Carga la configuración desde un archivo "clave = valor".
+ *
+ * Las líneas vacías y las que empiezan con '#' se ignoran.
+ *
+ * @return bool false si el archivo no se pudo abrir o tiene claves/valores inválidos.
+ */
+bool loadConfigFile(const std::string &path, ServerConfig &config);
+
+/**
+ * @brief Aplica los argumentos de la línea de comandos sobre la configuración.
+ *
+ * Acepta "--config <archivo>" (se lee primero) y "--clave valor" o "--clave=valor" con las
+ * mismas claves del archivo; la línea de comandos tiene prioridad sobre el archivo.
+ *
+ * @return bool false si hay un error (ya reportado por std::cerr) o se pidió --help.
+ */
+bool parseCommandLine(int argc, char **argv, ServerConfig &config);
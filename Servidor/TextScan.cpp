@@ -0,0 +1,331 @@
+#include "TextScan.h"
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define YAPP_TEXTSCAN_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define YAPP_TARGET_AVX2
+#else
+#define YAPP_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+static bool isAsciiSpace(unsigned char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/**
+ * @brief Valida el carácter que empieza en @p i y deja en @p i el siguiente.
+ *
+ * Sigue el RFC 3629: rechaza las formas largas de más, los sustitutos (U+D800–U+DFFF) y lo
+ * que pasa de U+10FFFF.
+ */
+static bool stepUtf8(const unsigned char *data, size_t size, size_t &i)
+{
+    unsigned char c = data[i];
+    if (c < 0x80)
+    {
+        ++i;
+        return true;
+    }
+    size_t len;
+    unsigned char lo = 0x80, hi = 0xBF; // Rango válido del segundo byte
+    if (c >= 0xC2 && c <= 0xDF)
+        len = 2;
+    else if (c >= 0xE0 && c <= 0xEF)
+    {
+        len = 3;
+        if (c == 0xE0)
+            lo = 0xA0;
+        else if (c == 0xED)
+            hi = 0x9F;
+    }
+    else if (c >= 0xF0 && c <= 0xF4)
+    {
+        len = 4;
+        if (c == 0xF0)
+            lo = 0x90;
+        else if (c == 0xF4)
+            hi = 0x8F;
+    }
+    else
+        return false;
+
+    if (size - i < len || data[i + 1] < lo || data[i + 1] > hi)
+        return false;
+    for (size_t k = 2; k < len; ++k)
+        if ((data[i + k] & 0xC0) != 0x80)
+            return false;
+    i += len;
+    return true;
+}
+
+// Valida desde @p i hasta pasar @p end (el último carácter puede terminar después)
+static bool validateUntil(const unsigned char *data, size_t size, size_t &i, size_t end)
+{
+    while (i < end)
+        if (!stepUtf8(data, size, i))
+            return false;
+    return true;
+}
+
+// Revisa byte a byte desde @p i (lo que quedó después de los bloques, o todo)
+static TextScanResult finishScalar(const unsigned char *data, size_t size, size_t i, bool allWhitespace)
+{
+    while (i < size)
+    {
+        if (allWhitespace && !isAsciiSpace(data[i]))
+            allWhitespace = false;
+        if (!stepUtf8(data, size, i))
+            return {false, false};
+    }
+    return {true, allWhitespace};
+}
+
+static TextScanResult scanScalar(const unsigned char *data, size_t size)
+{
+    return finishScalar(data, size, 0, true);
+}
+
+#ifdef YAPP_TEXTSCAN_X86
+
+static TextScanResult scanSse2(const unsigned char *data, size_t size)
+{
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i controlSpan = _mm_set1_epi8('\r' - '\t');
+    bool allWhitespace = true;
+    size_t i = 0;
+    while (size - i >= 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        if (allWhitespace)
+        {
+            // c - '\t' <= 4 sin signo: el mínimo contra 4 no lo cambia
+            __m128i shifted = _mm_sub_epi8(v, tab);
+            __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(shifted, controlSpan), shifted);
+            __m128i ws = _mm_or_si128(control, _mm_cmpeq_epi8(v, space));
+            allWhitespace = _mm_movemask_epi8(ws) == 0xFFFF;
+        }
+        if (_mm_movemask_epi8(v) == 0)
+        {
+            i += 16;
+            continue;
+        }
+        // Hay bytes no ASCII: se decodifica el bloque y se sigue desde donde termina su último carácter
+        if (!validateUntil(data, size, i, i + 16))
+            return {false, false};
+    }
+    return finishScalar(data, size, i, allWhitespace);
+}
+
+// Validación por tablas de Keiser y Lemire ("Validating UTF-8 in less than one instruction
+// per byte"): cada par de bytes consecutivos se clasifica con tres búsquedas de 16 entradas
+// (nibble alto del primero, nibble bajo del primero, nibble alto del segundo) y el AND de
+// las tres marca los errores de ese par. Las secuencias de 3 y 4 bytes se completan mirando
+// dos y tres bytes atrás.
+static const uint8_t TOO_SHORT = 1 << 0;      // 11______ 0_______ / 11______ 11______
+static const uint8_t TOO_LONG = 1 << 1;       // 0_______ 10______
+static const uint8_t OVERLONG_3 = 1 << 2;     // 11100000 100_____
+static const uint8_t TOO_LARGE = 1 << 3;      // 11110100 1001____ / 11110100 101_____
+static const uint8_t SURROGATE = 1 << 4;      // 11101101 101_____
+static const uint8_t OVERLONG_2 = 1 << 5;     // 1100000_ 10______
+static const uint8_t TOO_LARGE_1000 = 1 << 6; // 11110101 1000____ y mayores
+static const uint8_t OVERLONG_4 = 1 << 6;     // 11110000 1000____
+static const uint8_t TWO_CONTS = 1 << 7;      // 10______ 10______
+static const uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+YAPP_TARGET_AVX2 static __m256i table16(uint8_t t0, uint8_t t1, uint8_t t2, uint8_t t3, uint8_t t4, uint8_t t5,
+                                        uint8_t t6, uint8_t t7, uint8_t t8, uint8_t t9, uint8_t t10, uint8_t t11,
+                                        uint8_t t12, uint8_t t13, uint8_t t14, uint8_t t15)
+{
+    // La búsqueda de AVX2 es por mitades de 128 bits: la tabla va repetida
+    return _mm256_setr_epi8(t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12, t13, t14, t15,
+                            t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12, t13, t14, t15);
+}
+
+// Los 32 bytes de @p input corridos @p N posiciones, completando con el final de @p prev
+#define YAPP_PREV(input, prev, N) \
+    _mm256_alignr_epi8((input), _mm256_permute2x128_si256((prev), (input), 0x21), 16 - (N))
+
+// Estado entre bloques (se inicializa en scanAvx2: fuera de las funciones AVX2 no hay registros YMM)
+struct Avx2State
+{
+    __m256i error;
+    __m256i prevInput;
+    __m256i prevIncomplete;
+    bool allWhitespace;
+};
+
+YAPP_TARGET_AVX2 static void scanBlockAvx2(Avx2State &c, __m256i input)
+{
+    if (c.allWhitespace)
+    {
+        // c - '\t' <= 4 sin signo: el mínimo contra 4 no lo cambia
+        __m256i shifted = _mm256_sub_epi8(input, _mm256_set1_epi8('\t'));
+        __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8('\r' - '\t')), shifted);
+        __m256i ws = _mm256_or_si256(control, _mm256_cmpeq_epi8(input, _mm256_set1_epi8(' ')));
+        c.allWhitespace = static_cast<unsigned>(_mm256_movemask_epi8(ws)) == 0xFFFFFFFFu;
+    }
+
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    if (_mm256_movemask_epi8(input) == 0)
+    {
+        // Solo ASCII: alcanza con que el bloque anterior no haya quedado a mitad de carácter
+        c.error = _mm256_or_si256(c.error, c.prevIncomplete);
+        c.prevInput = input;
+        c.prevIncomplete = _mm256_setzero_si256();
+        return;
+    }
+
+    const __m256i byte1HighTable = table16(
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+        TOO_SHORT | OVERLONG_2,
+        TOO_SHORT,
+        TOO_SHORT | OVERLONG_3 | SURROGATE,
+        TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+    const __m256i byte1LowTable = table16(
+        CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+        CARRY | OVERLONG_2,
+        CARRY,
+        CARRY,
+        CARRY | TOO_LARGE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000);
+    const __m256i byte2HighTable = table16(
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+
+    __m256i prev1 = YAPP_PREV(input, c.prevInput, 1);
+    __m256i byte1High = _mm256_shuffle_epi8(byte1HighTable, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+    __m256i byte1Low = _mm256_shuffle_epi8(byte1LowTable, _mm256_and_si256(prev1, nibble));
+    __m256i byte2High = _mm256_shuffle_epi8(byte2HighTable, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+    __m256i special = _mm256_and_si256(_mm256_and_si256(byte1High, byte1Low), byte2High);
+
+    // Dos o tres bytes atrás empieza una secuencia de 3 o 4: este byte tiene que ser continuación
+    __m256i prev2 = YAPP_PREV(input, c.prevInput, 2);
+    __m256i prev3 = YAPP_PREV(input, c.prevInput, 3);
+    __m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8(static_cast<char>(0xE0 - 0x80)));
+    __m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8(static_cast<char>(0xF0 - 0x80)));
+    __m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8(static_cast<char>(0x80)));
+    c.error = _mm256_or_si256(c.error, _mm256_xor_si256(must23, special));
+
+    // Un carácter que empieza en los últimos 3 bytes sigue en el bloque siguiente
+    const __m256i maxValue = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        static_cast<char>(0xF0 - 1), static_cast<char>(0xE0 - 1), static_cast<char>(0xC0 - 1));
+    c.prevIncomplete = _mm256_subs_epu8(input, maxValue);
+    c.prevInput = input;
+}
+
+YAPP_TARGET_AVX2 static TextScanResult scanAvx2(const unsigned char *data, size_t size)
+{
+    Avx2State state;
+    state.error = state.prevInput = state.prevIncomplete = _mm256_setzero_si256();
+    state.allWhitespace = true;
+    size_t i = 0;
+    for (; size - i >= 32; i += 32)
+        scanBlockAvx2(state, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i)));
+    if (i < size)
+    {
+        // El resto va completado con espacios: no cambian ninguno de los dos resultados
+        alignas(32) unsigned char tail[32];
+        std::memset(tail, ' ', sizeof tail);
+        std::memcpy(tail, data + i, size - i);
+        scanBlockAvx2(state, _mm256_load_si256(reinterpret_cast<const __m256i *>(tail)));
+    }
+    __m256i error = _mm256_or_si256(state.error, state.prevIncomplete);
+    if (!_mm256_testz_si256(error, error))
+        return {false, false};
+    return {true, state.allWhitespace};
+}
+
+#undef YAPP_PREV
+
+static bool cpuHasAvx2()
+{
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuid(regs, 0);
+    if (regs[0] < 7)
+        return false;
+    __cpuid(regs, 1);
+    bool osxsave = (regs[2] & (1 << 27)) != 0, avx = (regs[2] & (1 << 28)) != 0;
+    // El sistema tiene que guardar los registros YMM al cambiar de hilo
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(regs, 7, 0);
+    return (regs[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // YAPP_TEXTSCAN_X86
+
+struct TextScanKernel
+{
+    TextScanResult (*scan)(const unsigned char *, size_t);
+    const char *name;
+};
+
+// En x86-64 SSE2 siempre está; AVX2 depende del procesador
+static TextScanKernel pickKernel()
+{
+#ifdef YAPP_TEXTSCAN_X86
+    if (cpuHasAvx2())
+        return {scanAvx2, "avx2"};
+    return {scanSse2, "sse2"};
+#else
+    return {scanScalar, "escalar"};
+#endif
+}
+
+static TextScanKernel kernel = pickKernel();
+
+bool selectTextScanKernel(const std::string &name)
+{
+    if (name == "auto")
+        kernel = pickKernel();
+    else if (name == "escalar" || name == "scalar")
+        kernel = {scanScalar, "escalar"};
+#ifdef YAPP_TEXTSCAN_X86
+    else if (name == "sse2")
+        kernel = {scanSse2, "sse2"};
+    else if (name == "avx2" && cpuHasAvx2())
+        kernel = {scanAvx2, "avx2"};
+#endif
+    else
+        return false;
+    return true;
+}
+
+TextScanResult scanText(const unsigned char *data, size_t size)
+{
+    return kernel.scan(data, size);
+}
+
+const char *textScanKernel()
+{
+    return kernel.name;
+}
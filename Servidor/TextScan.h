@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Resultado de revisar el texto de un mensaje
+struct TextScanResult
+{
+    bool validUtf8;     // UTF-8 bien formado (sin secuencias largas de más ni sustitutos)
+    bool allWhitespace; // Vacío o solo espacios ASCII (' ', \t, \n, \v, \f, \r)
+};
+
+/**
+ * @brief Valida UTF-8 y detecta si el texto es solo espacios, en una sola pasada.
+ *
+ * Con AVX2 valida de a 32 bytes también el texto no ASCII (por tablas, sin decodificar);
+ * con SSE2 recorre de a 16 bytes y decodifica byte a byte solo los bloques que no son
+ * ASCII. En otros procesadores usa la versión escalar. La versión se elige una vez según
+ * lo que soporte el procesador.
+ */
+TextScanResult scanText(const unsigned char *data, size_t size);
+
+// Versión en uso: "avx2", "sse2" o "escalar"
+const char *textScanKernel();
+
+/**
+ * @brief Fija la versión a usar (text_scan_kernel). Llamar al arrancar, antes de aceptar conexiones.
+ *
+ * @param name "auto" (la mejor que soporte el procesador), "avx2", "sse2" o "escalar".
+ * @return bool false si no existe o el procesador no la soporta; se mantiene la anterior.
+ */
+bool selectTextScanKernel(const std::string &name);
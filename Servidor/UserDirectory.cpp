@@ -0,0 +1,460 @@
+#include "UserDirectory.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_set>
+
+// Encabezado del formato de checkpoint; cambiarlo si cambian los campos. La versión 1 no
+// tenía la columna del nivel frío y se sigue pudiendo leer.
+static const char *CHECKPOINT_MAGIC = "YAPP-REGISTRY 2";
+static const char *CHECKPOINT_MAGIC_V1 = "YAPP-REGISTRY 1";
+
+// Directorio del nivel frío: "YAPPCOLD", versión (u32) y cantidad (u32); una tabla de
+// offsets (u64) ordenada por nombre y después los registros: ID (u32), estado anterior (u8),
+// última secuencia (u64), IP y nombre (u16 de longitud + bytes). Los enteros van en el
+// orden de bytes del equipo: el archivo no se lleva a otra máquina.
+static const char COLD_MAGIC[8] = {'Y', 'A', 'P', 'P', 'C', 'O', 'L', 'D'};
+static const uint32_t COLD_VERSION = 1;
+static const size_t COLD_HEADER_SIZE = sizeof(COLD_MAGIC) + 2 * sizeof(uint32_t);
+
+struct ColdRecord
+{
+    uint32_t id;
+    uint8_t previous;
+    uint64_t lastSeq;
+    std::string ip;
+    std::string name;
+};
+
+template <typename T>
+static void writeRaw(std::ostream &out, T value)
+{
+    out.write(reinterpret_cast<const char *>(&value), sizeof value);
+}
+
+template <typename T>
+static bool readRaw(std::istream &in, T &value)
+{
+    return static_cast<bool>(in.read(reinterpret_cast<char *>(&value), sizeof value));
+}
+
+static void writeSized(std::ostream &out, const std::string &s)
+{
+    writeRaw(out, static_cast<uint16_t>(s.size()));
+    out.write(s.data(), s.size());
+}
+
+static bool readSized(std::istream &in, std::string &s)
+{
+    uint16_t len;
+    if (!readRaw(in, len))
+        return false;
+    s.resize(len);
+    return len == 0 || static_cast<bool>(in.read(&s[0], len));
+}
+
+// Lee el encabezado; false si el archivo no existe o no es un directorio frío
+static bool readColdHeader(std::istream &in, uint32_t &count)
+{
+    char magic[sizeof(COLD_MAGIC)];
+    uint32_t version;
+    return in.read(magic, sizeof magic) && std::equal(magic, magic + sizeof magic, COLD_MAGIC)
+        && readRaw(in, version) && version == COLD_VERSION && readRaw(in, count);
+}
+
+static bool readColdRecord(std::istream &in, uint64_t offset, ColdRecord &rec)
+{
+    in.seekg(static_cast<std::streamoff>(offset));
+    return readRaw(in, rec.id) && readRaw(in, rec.previous) && readRaw(in, rec.lastSeq)
+        && readSized(in, rec.ip) && readSized(in, rec.name);
+}
+
+static std::vector<ColdRecord> readColdRecords(const std::string &path)
+{
+    std::vector<ColdRecord> records;
+    std::ifstream in(path, std::ios::binary);
+    uint32_t count;
+    if (!in || !readColdHeader(in, count))
+        return records;
+
+    // Los registros están seguidos después de la tabla: se leen en orden, sin saltos
+    records.resize(count);
+    in.seekg(static_cast<std::streamoff>(COLD_HEADER_SIZE + count * sizeof(uint64_t)));
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        ColdRecord &rec = records[i];
+        if (!readRaw(in, rec.id) || !readRaw(in, rec.previous) || !readRaw(in, rec.lastSeq)
+            || !readSized(in, rec.ip) || !readSized(in, rec.name))
+        {
+            std::cerr << "[ERROR] readColdRecords: Registro incompleto en " << path << std::endl;
+            records.resize(i);
+            break;
+        }
+    }
+    return records;
+}
+
+// Escribe el directorio completo ordenado por nombre (a un temporal y luego rename)
+static bool writeColdRecords(const std::string &path, std::vector<ColdRecord> &records)
+{
+    std::sort(records.begin(), records.end(),
+              [](const ColdRecord &a, const ColdRecord &b) { return a.name < b.name; });
+
+    std::string tmpPath = path + ".tmp";
+    std::ofstream out(tmpPath, std::ios::trunc | std::ios::binary);
+    if (!out)
+    {
+        std::cerr << "[ERROR] writeColdRecords: No se pudo abrir " << tmpPath << " para escritura." << std::endl;
+        return false;
+    }
+
+    out.write(COLD_MAGIC, sizeof COLD_MAGIC);
+    writeRaw(out, COLD_VERSION);
+    writeRaw(out, static_cast<uint32_t>(records.size()));
+    uint64_t offset = COLD_HEADER_SIZE + records.size() * sizeof(uint64_t);
+    for (const auto &rec : records)
+    {
+        writeRaw(out, offset);
+        offset += sizeof rec.id + sizeof rec.previous + sizeof rec.lastSeq
+                + 2 * sizeof(uint16_t) + rec.ip.size() + rec.name.size();
+    }
+    for (const auto &rec : records)
+    {
+        writeRaw(out, rec.id);
+        writeRaw(out, rec.previous);
+        writeRaw(out, rec.lastSeq);
+        writeSized(out, rec.ip);
+        writeSized(out, rec.name);
+    }
+    out.close();
+    if (!out || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        std::cerr << "[ERROR] writeColdRecords: No se pudo escribir " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Búsqueda binaria por nombre sobre la tabla de offsets: unas log2(N) lecturas del archivo
+static bool findColdRecord(const std::string &path, std::string_view name, ColdRecord &rec)
+{
+    std::ifstream in(path, std::ios::binary);
+    uint32_t count;
+    if (!in || !readColdHeader(in, count))
+        return false;
+
+    uint32_t low = 0, high = count;
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        uint64_t offset;
+        in.seekg(static_cast<std::streamoff>(COLD_HEADER_SIZE + mid * sizeof(uint64_t)));
+        if (!readRaw(in, offset) || !readColdRecord(in, offset, rec))
+            return false;
+        int cmp = std::string_view(rec.name).compare(name);
+        if (cmp == 0)
+            return true;
+        if (cmp < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return false;
+}
+
+UserInfo *UserDirectory::find(std::string_view username)
+{
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        auto it = idsByName.find(username);
+        if (it != idsByName.end())
+            return &(*this)[it->second];
+        if (coldPath.empty())
+            return nullptr;
+    }
+
+    // No está en memoria: puede estar en el nivel frío
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto it = idsByName.find(username);
+    if (it != idsByName.end())
+        return &(*this)[it->second];
+    return reloadLocked(username);
+}
+
+UserInfo &UserDirectory::intern(const std::string &username, bool *created)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return internLocked(username, created);
+}
+
+UserInfo *UserDirectory::claim(const std::string &username, bool *created)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    UserInfo &info = internLocked(username, created);
+    if (info.node != 0 && info.status != UserStatus::DISCONNECTED)
+        return nullptr;
+    bool expected = false;
+    if (!info.inSession.compare_exchange_strong(expected, true))
+        return nullptr;
+    return &info;
+}
+
+UserInfo &UserDirectory::internLocked(const std::string &username, bool *created)
+{
+    auto it = idsByName.find(username);
+    if (it != idsByName.end())
+    {
+        if (created) *created = false;
+        return (*this)[it->second];
+    }
+    if (UserInfo *info = reloadLocked(username))
+    {
+        if (created) *created = false;
+        return *info;
+    }
+    if (created) *created = true;
+    return createLocked(username);
+}
+
+UserInfo &UserDirectory::createLocked(const std::string &username)
+{
+    uint32_t id = count.load(std::memory_order_relaxed);
+    if ((id >> CHUNK_BITS) >= MAX_CHUNKS)
+        throw std::runtime_error("Directorio de usuarios lleno.");
+    if (!chunks[id >> CHUNK_BITS])
+        chunks[id >> CHUNK_BITS].reset(new UserInfo[CHUNK_SIZE]);
+
+    UserInfo &info = (*this)[id];
+    info.id = id;
+    info.username = username;
+    info.session = std::make_shared<SessionState>();
+    idsByName.emplace(info.username, id);
+    namesInOrder.emplace(info.username, id);
+
+    // Se publica el nuevo tamaño al final para que forEach nunca vea un registro a medias
+    count.store(id + 1, std::memory_order_release);
+    return info;
+}
+
+void UserDirectory::openColdTier(const std::string &path)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    coldPath = path;
+}
+
+UserInfo *UserDirectory::reloadLocked(std::string_view username)
+{
+    if (coldPath.empty())
+        return nullptr;
+
+    ColdRecord rec;
+    {
+        std::lock_guard<std::mutex> lock(coldMutex);
+        if (!findColdRecord(coldPath, username, rec))
+            return nullptr;
+    }
+    // El registro puede haber quedado de una carga anterior; vale solo si el ID sigue frío
+    if (rec.id >= size())
+        return nullptr;
+    UserInfo &info = (*this)[rec.id];
+    if (!info.cold.load(std::memory_order_relaxed) || info.username != rec.name)
+        return nullptr;
+
+    info.previousState = static_cast<UserStatus>(rec.previous);
+    info.ipAddress = rec.ip;
+    {
+        std::lock_guard<std::mutex> lock(info.session->mutex);
+        info.session->lastSeq = rec.lastSeq;
+    }
+    idsByName.emplace(info.username, info.id);
+    namesInOrder.emplace(info.username, info.id);
+    info.cold.store(false, std::memory_order_release);
+    return &info;
+}
+
+void UserDirectory::makeColdLocked(UserInfo &info)
+{
+    idsByName.erase(info.username);
+    namesInOrder.erase(info.username);
+    info.ipAddress.clear();
+    info.ipAddress.shrink_to_fit();
+    info.cold.store(true, std::memory_order_release);
+}
+
+std::vector<uint32_t> UserDirectory::evictIdle(std::chrono::seconds idleFor)
+{
+    std::vector<uint32_t> evicted;
+    if (coldPath.empty())
+        return evicted;
+
+    // 1) Candidatos: desconectados, sin socket y sin actividad desde hace idleFor
+    struct Candidate
+    {
+        uint32_t id;
+        std::chrono::steady_clock::time_point detachedAt;
+    };
+    std::vector<Candidate> candidates;
+    std::vector<ColdRecord> fresh;
+    auto now = std::chrono::steady_clock::now();
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        forEach([&](UserInfo &info) {
+            if (info.status != UserStatus::DISCONNECTED || info.inSession.load())
+                return;
+            std::lock_guard<std::mutex> sessionLock(info.session->mutex);
+            if (info.ws || now - info.session->detachedAt < idleFor)
+                return;
+            candidates.push_back({info.id, info.session->detachedAt});
+            fresh.push_back({info.id, static_cast<uint8_t>(info.previousState), info.session->lastSeq,
+                             info.ipAddress, info.username});
+        });
+    }
+    if (fresh.empty())
+        return evicted;
+
+    // 2) Se escribe el directorio antes de sacarlos de memoria. Los registros de usuarios
+    //    que ya se volvieron a cargar se descartan.
+    {
+        std::lock_guard<std::mutex> lock(coldMutex);
+        std::vector<ColdRecord> records = readColdRecords(coldPath);
+        uint32_t n = size();
+        records.erase(std::remove_if(records.begin(), records.end(), [&](const ColdRecord &rec) {
+                          return rec.id >= n || !(*this)[rec.id].cold.load(std::memory_order_relaxed);
+                      }),
+                      records.end());
+        for (auto &rec : fresh)
+            records.push_back(std::move(rec));
+        if (!writeColdRecords(coldPath, records))
+            return evicted;
+    }
+
+    // 3) Los que se reconectaron mientras tanto siguen en memoria; su registro en disco se
+    //    descarta en la próxima reescritura
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    for (const auto &candidate : candidates)
+    {
+        UserInfo &info = (*this)[candidate.id];
+        std::lock_guard<std::mutex> sessionLock(info.session->mutex);
+        if (info.status != UserStatus::DISCONNECTED || info.inSession.load() || info.ws
+            || info.session->detachedAt != candidate.detachedAt)
+            continue;
+        makeColdLocked(info);
+        // El SessionState se conserva: quien recorre los usuarios puede estar leyéndolo sin
+        // más lock que el suyo. Solo se vacía su ventana de repetición, que es lo que ocupa.
+        info.session->replay.clear();
+        info.session->replay.shrink_to_fit();
+        evicted.push_back(info.id);
+    }
+    return evicted;
+}
+
+PooledVector<uint32_t> UserDirectory::findByPrefix(std::string_view prefix, size_t limit)
+{
+    PooledVector<uint32_t> ids;
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    // Los nombres con el prefijo forman un tramo contiguo que empieza en lower_bound
+    for (auto it = namesInOrder.lower_bound(prefix);
+         it != namesInOrder.end() && ids.size() < limit && it->first.substr(0, prefix.size()) == prefix; ++it)
+        ids.push_back(it->second);
+    return ids;
+}
+
+// Una línea por usuario en orden de ID:
+// "<frío> <estado> <estadoAnterior> <ultimaSeq> <lenIp> <ip> <lenNombre> <nombre>"
+// Las longitudes permiten nombres con espacios u otros caracteres raros.
+size_t UserDirectory::saveCheckpoint(const std::string &path)
+{
+    std::string tmpPath = path + ".tmp";
+    std::ofstream out(tmpPath, std::ios::trunc | std::ios::binary);
+    if (!out)
+    {
+        std::cerr << "[ERROR] saveCheckpoint: No se pudo abrir " << tmpPath << " para escritura." << std::endl;
+        return 0;
+    }
+
+    out << CHECKPOINT_MAGIC << "\n";
+    uint32_t n = size();
+    for (uint32_t id = 0; id < n; ++id)
+    {
+        UserInfo &info = (*this)[id];
+        uint64_t lastSeq;
+        {
+            std::lock_guard<std::mutex> lock(info.session->mutex);
+            lastSeq = info.session->lastSeq;
+        }
+        out << (info.cold.load(std::memory_order_acquire) ? 1 : 0) << ' '
+            << static_cast<int>(info.status) << ' '
+            << static_cast<int>(info.previousState) << ' '
+            << lastSeq << ' '
+            << info.ipAddress.size() << ' ' << info.ipAddress << ' '
+            << info.username.size() << ' ' << info.username << "\n";
+    }
+    out.close();
+    if (!out || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        std::cerr << "[ERROR] saveCheckpoint: No se pudo escribir " << path << std::endl;
+        return 0;
+    }
+    return n;
+}
+
+// Lee un campo "<len> <bytes>" del checkpoint
+static bool readSizedField(std::istream &in, std::string &out)
+{
+    size_t len;
+    if (!(in >> len) || in.get() != ' ')
+        return false;
+    out.resize(len);
+    return static_cast<bool>(in.read(&out[0], len));
+}
+
+size_t UserDirectory::loadCheckpoint(const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return 0;
+
+    std::string magic;
+    std::getline(in, magic);
+    bool hasColdColumn = magic == CHECKPOINT_MAGIC;
+    if (!hasColdColumn && magic != CHECKPOINT_MAGIC_V1)
+    {
+        std::cerr << "[ERROR] loadCheckpoint: Formato desconocido en " << path << std::endl;
+        return 0;
+    }
+
+    // Un usuario vuelve al nivel frío solo si el directorio en disco todavía lo tiene; si
+    // no, se queda en memoria con lo que dice el checkpoint
+    std::unordered_set<uint32_t> coldIds;
+    if (hasColdColumn && !coldPath.empty())
+        for (const auto &rec : readColdRecords(coldPath))
+            coldIds.insert(rec.id);
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    size_t restored = 0;
+    auto now = std::chrono::steady_clock::now();
+    int cold = 0, status, previous;
+    uint64_t lastSeq;
+    while ((!hasColdColumn || in >> cold) && in >> status >> previous >> lastSeq)
+    {
+        std::string ip, name;
+        if (!readSizedField(in >> std::ws, ip) || !readSizedField(in >> std::ws, name))
+        {
+            std::cerr << "[ERROR] loadCheckpoint: Registro incompleto después de " << restored << " usuarios." << std::endl;
+            break;
+        }
+
+        UserInfo &info = createLocked(name);
+        info.status = UserStatus::DISCONNECTED;
+        info.previousState = static_cast<UserStatus>(previous);
+        info.ipAddress = ip;
+        info.session->lastSeq = lastSeq;
+        info.session->detachedAt = now;
+        if (cold && coldIds.count(info.id))
+            makeColdLocked(info);
+        ++restored;
+    }
+    return restored;
+}
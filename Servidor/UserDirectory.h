@@ -0,0 +1,215 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "BufferPool.h"
+#include "OutboundQueue.h"
+
+// Estructura para mapear un estado a su valor numerico
+enum class UserStatus : uint8_t
+{
+    DISCONNECTED = 0,
+    ACTIVE = 1,
+    BUSY = 2,
+    INACTIVE = 3
+};
+
+// Un paso de una lectura de historial en el pool. Devuelve la cola de salida en la que espera
+// lugar para seguir (se lo vuelve a llamar cuando lo haya) o nullptr si terminó.
+using HistoryRead = std::function<std::shared_ptr<OutboundQueue>()>;
+
+// Estado de salida de la sesión de un usuario. Sobrevive a las desconexiones para
+// que un cliente que se reconecta pueda pedir solo las tramas que se perdió.
+struct SessionState
+{
+    std::mutex mutex;      // Serializa la asignación de secuencia y la escritura al socket
+    uint64_t lastSeq = 0;  // Último número de secuencia asignado a una trama binaria
+    std::deque<std::pair<uint64_t, PooledBytes>> replay; // Últimas tramas enviadas
+    std::chrono::steady_clock::time_point detachedAt; // Momento en que se cerró el último socket
+    std::shared_ptr<OutboundQueue> outbound; // Solo en modo corrutinas: las escrituras se encolan aquí
+    std::deque<HistoryRead> historyReads; // Lecturas de historial en espera del pool, en orden
+    bool historyReadRunning = false;      // Alguna lectura de la sesión está en el pool o esperando lugar
+};
+
+// Estructura para almacenar la información de cada usuario
+struct UserInfo
+{
+    uint32_t id = 0; // Índice denso asignado por el directorio al registrarse
+    std::string username;
+    std::shared_ptr<WebSocketStream> ws;
+    UserStatus status = UserStatus::DISCONNECTED;
+    std::string ipAddress;
+
+    std::chrono::steady_clock::time_point lastActivityTime; // Última vez en que un usuario mandó un mensaje 
+
+    UserStatus previousState = UserStatus::ACTIVE; // Estado anterior del usuario
+
+    std::shared_ptr<SessionState> session;
+
+    // Nodo del cluster donde está (o estuvo) conectado; 0 es este nodo. Los de otro nodo no
+    // tienen socket ni sesión que atender aquí: sus mensajes se reenvían por el enlace.
+    uint16_t node = 0;
+
+    // En el nivel frío: desconectado hace mucho, fuera de los índices por nombre y con sus
+    // datos en el directorio en disco. El ID y el nombre se conservan para volver a cargarlo.
+    std::atomic<bool> cold{false};
+
+    // Una conexión ganó el nombre (ver UserDirectory::claim) y todavía no terminó su sesión
+    std::atomic<bool> inSession{false};
+};
+
+/**
+ * @brief Directorio de usuarios con IDs densos de 32 bits.
+ *
+ * Cada nombre se interna una sola vez al registrarse y recibe el siguiente ID libre. Los
+ * UserInfo viven en bloques contiguos indexados por ID que nunca se mueven, así que una
+ * referencia obtenida del directorio sigue siendo válida mientras corre el servidor y
+ * el acceso por ID es indexar un arreglo, sin tomar ningún lock.
+ *
+ * Los usuarios desconectados hace mucho pasan a un nivel frío (ver evictIdle): salen de los
+ * índices por nombre y sus datos quedan en un directorio compacto en disco, ordenado por
+ * nombre. find() e intern() los vuelven a cargar en su mismo ID cuando se los busca.
+ */
+class UserDirectory
+{
+public:
+    /**
+     * @brief Busca un usuario por nombre; si está en el nivel frío lo vuelve a cargar.
+     *
+     * @return UserInfo* El registro del usuario o nullptr si nunca se registró.
+     */
+    UserInfo *find(std::string_view username);
+
+    /**
+     * @brief Devuelve el registro del usuario, creándolo si es la primera vez que se ve.
+     *
+     * @param username Nombre del usuario.
+     * @param created  Si no es nulo, se indica si el registro se acaba de crear.
+     */
+    UserInfo &intern(const std::string &username, bool *created = nullptr);
+
+    /**
+     * @brief Reserva el nombre para una conexión nueva, de forma atómica con intern().
+     *
+     * Falla si otra conexión ya lo tiene (inSession) o si el usuario está conectado en otro
+     * nodo del cluster. Quien lo obtiene lo suelta poniendo inSession en false al terminar
+     * la sesión; mientras tanto evictIdle no lo pasa al nivel frío.
+     *
+     * @param created Si no es nulo, se indica si el registro se acaba de crear.
+     * @return UserInfo* El registro reservado o nullptr si el nombre está en uso.
+     */
+    UserInfo *claim(const std::string &username, bool *created = nullptr);
+
+    /**
+     * @brief Activa el nivel frío con el directorio en disco indicado.
+     *
+     * Llamar al arrancar, antes de loadCheckpoint. Sin llamarla nunca se desaloja a nadie.
+     */
+    void openColdTier(const std::string &path);
+
+    /**
+     * @brief Pasa al nivel frío a los usuarios desconectados hace más de @p idleFor.
+     *
+     * Reescribe el directorio en disco con los nuevos (y sin los que ya se volvieron a cargar)
+     * y recién entonces los quita de los índices, así una búsqueda siempre los encuentra en
+     * uno de los dos niveles. Libera su ventana de repetición (bajo el mutex de la sesión) y su
+     * IP; el SessionState en sí se conserva porque otros hilos lo leen sin lock del directorio.
+     *
+     * @return std::vector<uint32_t> IDs de los usuarios desalojados.
+     */
+    std::vector<uint32_t> evictIdle(std::chrono::seconds idleFor);
+
+    // Acceso directo por ID (el ID debe ser menor que size())
+    UserInfo &operator[](uint32_t id)
+    {
+        return chunks[id >> CHUNK_BITS][id & (CHUNK_SIZE - 1)];
+    }
+
+    /**
+     * @brief Busca los usuarios cuyo nombre empieza con un prefijo.
+     *
+     * Usa el índice ordenado por nombre: cuesta O(log N + limit) sin importar cuántos
+     * usuarios haya registrados. El prefijo vacío devuelve los primeros nombres.
+     *
+     * @param prefix Prefijo a buscar (se compara byte a byte, distingue mayúsculas).
+     * @param limit  Cantidad máxima de resultados.
+     * @return PooledVector<uint32_t> IDs de los usuarios encontrados, en orden alfabético.
+     */
+    PooledVector<uint32_t> findByPrefix(std::string_view prefix, size_t limit);
+
+    // Cantidad de usuarios registrados
+    uint32_t size() const { return count.load(std::memory_order_acquire); }
+
+    /**
+     * @brief Guarda el registro de usuarios (IDs, estados, IP y secuencia de sesión) en disco.
+     *
+     * Se escribe a un archivo temporal y luego se renombra, así un apagado a medias
+     * nunca deja un checkpoint corrupto.
+     *
+     * @return size_t Cantidad de usuarios guardados.
+     */
+    size_t saveCheckpoint(const std::string &path);
+
+    /**
+     * @brief Carga un checkpoint escrito por saveCheckpoint en un directorio vacío.
+     *
+     * Los usuarios se internan en el mismo orden, así conservan sus IDs. Todos quedan
+     * DISCONNECTED con su estado anterior y con la ventana de reanudación abierta; los que
+     * estaban en el nivel frío vuelven a él.
+     *
+     * @return size_t Cantidad de usuarios restaurados (0 si no hay checkpoint).
+     */
+    size_t loadCheckpoint(const std::string &path);
+
+    // Recorre los usuarios del nivel caliente en orden de ID
+    template <typename Fn>
+    void forEach(Fn &&fn)
+    {
+        uint32_t n = size();
+        for (uint32_t id = 0; id < n; ++id)
+        {
+            UserInfo &info = (*this)[id];
+            if (!info.cold.load(std::memory_order_acquire))
+                fn(info);
+        }
+    }
+
+private:
+    static const uint32_t CHUNK_BITS = 10;
+    static const uint32_t CHUNK_SIZE = 1u << CHUNK_BITS;
+    static const uint32_t MAX_CHUNKS = 4096; // ~4 millones de usuarios
+
+    mutable std::shared_mutex mutex; // Protege idsByName, namesInOrder y la creación de bloques
+    std::unordered_map<std::string_view, uint32_t> idsByName; // Las claves apuntan a UserInfo::username
+    std::map<std::string_view, uint32_t> namesInOrder;        // Mismas claves, ordenadas para buscar por prefijo
+    // Crea el registro de un nombre nuevo con el siguiente ID; llamar con mutex tomado en exclusivo
+    UserInfo &createLocked(const std::string &username);
+
+    // intern() con mutex tomado en exclusivo
+    UserInfo &internLocked(const std::string &username, bool *created);
+
+    // Vuelve a cargar un usuario del nivel frío; llamar con mutex tomado en exclusivo
+    UserInfo *reloadLocked(std::string_view username);
+
+    // Saca a un usuario de los índices por nombre; llamar con mutex tomado en exclusivo
+    void makeColdLocked(UserInfo &info);
+
+    std::unique_ptr<UserInfo[]> chunks[MAX_CHUNKS];
+    std::atomic<uint32_t> count{0};
+
+    std::string coldPath;  // Directorio del nivel frío en disco (vacío: desactivado)
+    std::mutex coldMutex;  // Serializa la lectura y reescritura del archivo; se toma después de mutex
+
+};
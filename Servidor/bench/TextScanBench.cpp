@@ -0,0 +1,85 @@
+// Microbenchmark de scanText() contra la revisión anterior de los mensajes de texto (dos
+// copias a std::string y dos std::all_of con ::isspace, sin validar UTF-8).
+//
+// Compilar desde Servidor/:
+//   g++ -std=c++17 -O2 bench/TextScanBench.cpp TextScan.cpp -o textscan-bench
+//
+// Imprime, por tipo de mensaje y por versión, los nanosegundos por mensaje y los GB/s.
+
+#include "../TextScan.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+struct Corpus
+{
+    const char *name;
+    std::vector<std::string> messages;
+};
+
+// Lo que hacía handleIncomingMessage con un mensaje de texto de un usuario inactivo
+static bool legacyCheck(const unsigned char *data, size_t size)
+{
+    std::string first(reinterpret_cast<const char *>(data), size);
+    bool reactivate = !first.empty() && !std::all_of(first.begin(), first.end(), ::isspace);
+    std::string msg(reinterpret_cast<const char *>(data), size);
+    bool blank = msg.empty() || std::all_of(msg.begin(), msg.end(), ::isspace);
+    return reactivate != blank;
+}
+
+static std::vector<std::string> repeat(const std::string &unit, size_t bytes, size_t count)
+{
+    std::string text;
+    while (text.size() < bytes)
+        text += unit;
+    return std::vector<std::string>(count, text);
+}
+
+template <typename F>
+static void run(const char *label, const Corpus &corpus, F check)
+{
+    size_t bytes = 0;
+    for (const auto &m : corpus.messages)
+        bytes += m.size();
+    const int rounds = 200;
+    volatile unsigned sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; ++r)
+        for (const auto &m : corpus.messages)
+            sink = sink + check(reinterpret_cast<const unsigned char *>(m.data()), m.size());
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    double perMessage = ns / (rounds * corpus.messages.size());
+    std::printf("  %-10s %10.1f ns/mensaje %8.2f GB/s\n", label, perMessage, bytes * double(rounds) / ns);
+}
+
+int main()
+{
+    std::vector<Corpus> corpora = {
+        {"ascii 41 B", std::vector<std::string>(100000, "Hola a todos, ya llegue al servidor nuevo")},
+        {"ascii 4 KiB", repeat("the quick brown fox jumps over the lazy dog ", 4096, 2000)},
+        {"español 4 KiB", repeat("mañana reunión en el café, ¿venís? ", 4096, 2000)},
+        {"emoji 4 KiB", repeat("listo 👍 nos vemos 🎉 ", 4096, 2000)},
+        {"espacios 4 KiB", repeat(" \t\n", 4096, 2000)},
+    };
+
+    const char *kernels[] = {"escalar", "sse2", "avx2"};
+    for (const auto &corpus : corpora)
+    {
+        std::printf("%s\n", corpus.name);
+        run("anterior", corpus, legacyCheck);
+        for (const char *name : kernels)
+        {
+            if (!selectTextScanKernel(name))
+                continue;
+            run(name, corpus, [](const unsigned char *data, size_t size) {
+                TextScanResult r = scanText(data, size);
+                return r.validUtf8 + r.allWhitespace;
+            });
+        }
+        selectTextScanKernel("auto");
+    }
+    return 0;
+}
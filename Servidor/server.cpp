@@ -1,3 +1,4 @@
+#include <utility>
 #include <iostream>
 #include <vector>
 #include <thread>
@@ -14,8 +15,21 @@
 #include <boost/beast/websocket.hpp>
 #include <boost/beast/http.hpp>
 #include <chrono> 
+#include <atomic>
+#include <condition_variable>
+#include <csignal>
+#include <deque>
+#include <functional>
+#include <optional>
 #include "BinaryMessageHandler.h"
+#include "BufferPool.h"
+#include "ClusterLink.h"
 #include "HistoryManager.h"
+#include "OutboundQueue.h"
+#include "PresenceIndex.h"
+#include "ServerConfig.h"
+#include "TextScan.h"
+#include "UserDirectory.h"
 
 namespace asio = boost::asio;
 namespace beast = boost::beast;
@@ -23,15 +37,6 @@ namespace websocket = beast::websocket;
 namespace http = beast::http;
 using tcp = asio::ip::tcp;
 
-// Estructura para mapear un estado a su valor numerico
-enum class UserStatus : uint8_t
-{
-    DISCONNECTED = 0,
-    ACTIVE = 1,
-    BUSY = 2,
-    INACTIVE = 3
-};
-
 static std::string userStatusToString(UserStatus s)
 {
     switch(s)
@@ -44,22 +49,7 @@ static std::string userStatusToString(UserStatus s)
     return "DESCONOCIDO";
 }
 
-// Estructura para almacenar la información de cada usuario
-struct UserInfo
-{
-    std::string username;
-    std::shared_ptr<websocket::stream<tcp::socket>> ws;
-    UserStatus status;
-    std::string ipAddress;
-
-    std::chrono::steady_clock::time_point lastActivityTime; // Última vez en que un usuario mandó un mensaje 
-
-    UserStatus previousState; // Estado anterior del usuario
-};
-
-std::vector<UserInfo> snapshot;
-
-std::string bytesToHexString(const std::vector<unsigned char> &data)
+std::string bytesToHexString(const PooledBytes &data)
 {
     std::ostringstream oss;
     for (const auto &byte : data)
@@ -69,26 +59,597 @@ std::string bytesToHexString(const std::vector<unsigned char> &data)
     return oss.str();
 }
 
-std::unordered_map<std::string, UserInfo> connectedUsers;
+// Todos los usuarios vistos desde que arrancó el servidor, indexados por ID
+UserDirectory userDirectory;
+// Quién sigue el estado de quién; los cambios de estado solo van a los suscriptores
+PresenceIndex presenceIndex;
+// Enlaces con los otros nodos (solo si cluster_node_id no es 0)
+ClusterLink clusterLink;
 std::mutex clients_mutex;
 
+// Se activa al recibir SIGINT/SIGTERM; desde ahí no se aceptan conexiones nuevas
+std::atomic<bool> shuttingDown{false};
+
+// Conexiones con hilo propio que siguen vivas. El apagado espera a que lleguen a cero.
+std::mutex sessionsMutex;
+std::condition_variable sessionsChanged;
+int activeSessions = 0;
+
+// Descuenta la conexión al terminar su hilo, salga como salga
+struct SessionCounter
+{
+    ~SessionCounter()
+    {
+        std::lock_guard<std::mutex> lock(sessionsMutex);
+        --activeSessions;
+        sessionsChanged.notify_all();
+    }
+};
+
 // Función para validar el nombre de usuario (no puede estar vacío ni ser "~")
 bool isValidUsername(const std::string &username)
 {
     return !username.empty() && username != "~";
 }
 
-// Envía un mensaje binario a un cliente específico
-void sendBinaryMessage(std::shared_ptr<websocket::stream<tcp::socket>> ws, const std::vector<unsigned char> &message)
+// Envía un mensaje binario a un cliente específico (modo hilos: escritura bloqueante)
+void sendBinaryMessage(std::shared_ptr<websocket::stream<tcp::socket>> ws, const PooledBytes &message)
 {
     ws->binary(true);
     try {
         ws->write(asio::buffer(message));
-        std::cerr << "[DEBUG] Texto sendBinaryMessage " << bytesToHexString(message) << std::endl;
+        if (serverConfig.logFrames)
+            std::cerr << "[DEBUG] Texto sendBinaryMessage " << bytesToHexString(message) << std::endl;
     } catch (const std::exception &e) {
-        std::cerr << "[ERROR] Texto sendBinaryMessage " <<  bytesToHexString(message) << ": " << e.what() << std::endl;
+        std::cerr << "[ERROR] Texto sendBinaryMessage " << (int)message[0] << ": " << e.what() << std::endl;
     }}
 
+// Carril de salida de una trama binaria según su código (solo aplica en modo corrutinas)
+OutboundLane laneFor(const PooledBytes &frame)
+{
+    switch (frame.empty() ? 0 : frame[0])
+    {
+        case MessageCode::MESSAGE_RECEIVED:
+        case MessageCode::RESPONSE_GET_USER:
+        case MessageCode::RESPONSE_SEARCH_USERS:
+            return OutboundLane::Chat;
+        case MessageCode::RESPONSE_HISTORY:
+        case MessageCode::RESPONSE_HISTORY_CHUNK:
+        case MessageCode::RESPONSE_SEARCH_HISTORY:
+        case MessageCode::RESPONSE_LIST_USERS:
+        case MessageCode::RESPONSE_ALL_USERS:
+        case MessageCode::RESPONSE_BATCH:
+        case MessageCode::RESPONSE_PRESENCE:
+            return OutboundLane::Bulk;
+        default:
+            return OutboundLane::Control;
+    }
+}
+
+// Escribe una trama binaria al socket del usuario; llamar con info.session->mutex tomado.
+// En modo corrutinas la trama se encola en el carril de control y la escribe la corrutina
+// de la sesión.
+void writeFrame(UserInfo &info, const PooledBytes &frame)
+{
+    if (info.session->outbound)
+        info.session->outbound->push(frame, true, OutboundLane::Control);
+    else
+        sendBinaryMessage(info.ws, frame);
+}
+
+// Igual que writeFrame pero como trama de texto. En modo hilos puede lanzar excepción.
+void writeText(UserInfo &info, const std::string &text)
+{
+    if (info.session->outbound)
+    {
+        info.session->outbound->push(PooledBytes(text.begin(), text.end()), false, OutboundLane::Chat);
+        return;
+    }
+    info.ws->binary(false);
+    info.ws->write(asio::buffer(text));
+}
+
+// Guarda una trama en la ventana de repetición con el siguiente número de secuencia
+void recordFrame(SessionState &session, PooledBytes frame)
+{
+    session.replay.emplace_back(++session.lastSeq, std::move(frame));
+    if (session.replay.size() > serverConfig.replayWindowSize)
+        session.replay.pop_front();
+}
+
+// Numera las tramas que la cola de salida ya envió, en el orden en que salieron
+void recordSent(SessionState &session)
+{
+    for (auto &frame : session.outbound->takeSequenced())
+        recordFrame(session, std::move(frame));
+}
+
+// Envía una trama binaria a un usuario asignándole el siguiente número de secuencia.
+// La trama se guarda en la ventana de repetición aunque el usuario no tenga socket abierto.
+void deliverToUser(UserInfo &info, const PooledBytes &message)
+{
+    // Un usuario de otro nodo recibe lo suyo allá; lo que le toca se reenvía por el cluster
+    if (info.node != 0)
+        return;
+
+    auto &session = *info.session;
+    std::lock_guard<std::mutex> lock(session.mutex);
+
+    if (session.outbound)
+    {
+        // Modo corrutinas: los carriles pueden adelantar tramas, así que el número se asigna
+        // cuando la trama sale y no al encolarla
+        recordSent(session);
+        if (session.outbound->push(message, true, laneFor(message), true))
+            return;
+    }
+
+    recordFrame(session, message);
+    if (!session.outbound && info.ws && info.ws->next_layer().is_open())
+        writeFrame(info, message);
+}
+
+// Lecturas de historial fuera de los hilos de red (solo en modo corrutinas)
+std::unique_ptr<asio::thread_pool> historyPool;
+
+// Corre en el pool las lecturas en espera de la sesión, de a una. Si una queda esperando
+// lugar en una cola de salida, la sesión no sigue con las demás hasta que esa termine.
+void runHistoryReads(const std::shared_ptr<SessionState> &session)
+{
+    asio::post(*historyPool, [session] {
+        while (true)
+        {
+            HistoryRead next;
+            {
+                std::lock_guard<std::mutex> lock(session->mutex);
+                if (session->historyReads.empty())
+                {
+                    session->historyReadRunning = false;
+                    return;
+                }
+                next = std::move(session->historyReads.front());
+                session->historyReads.pop_front();
+            }
+            if (auto waitOn = next())
+            {
+                // Vuelve al frente y se retoma desde el escritor de esa cola
+                {
+                    std::lock_guard<std::mutex> lock(session->mutex);
+                    session->historyReads.push_front(std::move(next));
+                }
+                waitOn->whenRoom([session] { runHistoryReads(session); });
+                return;
+            }
+        }
+    });
+}
+
+// Encola @p read en el pool de historial. Las lecturas de una misma sesión se hacen de a
+// una y en orden, así las respuestas llegan en el orden en que se pidieron.
+void postHistoryRead(const std::shared_ptr<SessionState> &session, HistoryRead read)
+{
+    {
+        std::lock_guard<std::mutex> lock(session->mutex);
+        session->historyReads.push_back(std::move(read));
+        if (session->historyReadRunning)
+            return;
+        session->historyReadRunning = true;
+    }
+    runHistoryReads(session);
+}
+
+// Como la anterior para una lectura que termina en un solo paso
+void postHistoryRead(const std::shared_ptr<SessionState> &session, std::function<void()> job)
+{
+    postHistoryRead(session, HistoryRead([job = std::move(job)]() -> std::shared_ptr<OutboundQueue> {
+        job();
+        return nullptr;
+    }));
+}
+
+// Abre el historial general (sin @p conversation) o el privado entre @p username y @p target
+bool openHistoryCursor(HistoryCursor &cursor, std::optional<uint64_t> conversation,
+                       const std::string &username, const std::string &target)
+{
+    return conversation ? cursor.openPrivate(*conversation, username, target) : cursor.openGeneral();
+}
+
+// Arma RESPONSE_HISTORY con los últimos mensajes del historial (hasta 255, lo que entra en
+// su byte de cantidad), o USER_NOT_FOUND si no hay historial
+PooledBytes buildHistoryResponse(std::optional<uint64_t> conversation, const std::string &username,
+                                 const std::string &target)
+{
+    HistoryCursor cursor;
+    if (!openHistoryCursor(cursor, conversation, username, target))
+        return { MessageCode::ERROR_RESPONSE, ErrorCode::USER_NOT_FOUND };
+    // El historial completo se pide con GET_HISTORY_STREAM
+    cursor.keepLast(255);
+
+    // Los registros se copian directo de los segmentos proyectados a la trama, sin copias
+    // intermedias. La cantidad se completa al final.
+    PooledBytes responseMsg;
+    responseMsg.push_back(MessageCode::RESPONSE_HISTORY);
+    responseMsg.push_back(0);
+
+    std::string_view user, msg;
+    while (cursor.next(user, msg))
+    {
+        appendField(responseMsg, user);
+        appendField(responseMsg, msg);
+    }
+    responseMsg[1] = static_cast<unsigned char>(cursor.recordsRead());
+
+    std::cout << "→ Historial de " << cursor.recordsRead()
+            << " mensajes enviado a " << username
+            << " target=" << target << ")" << std::endl;
+    return responseMsg;
+}
+
+// Arma RESPONSE_SEARCH_HISTORY con los mensajes de la conversación que contienen palabras
+// de @p query, hasta @p limit y del más relevante al menos
+PooledBytes buildHistorySearchResponse(std::optional<uint64_t> conversation, const std::string &username,
+                                       const std::string &target, const std::string &query, size_t limit)
+{
+    HistoryCursor cursor;
+    if (conversation)
+        cursor.searchPrivate(*conversation, username, target, query, limit);
+    else
+        cursor.searchGeneral(query, limit);
+
+    PooledBytes responseMsg;
+    responseMsg.push_back(MessageCode::RESPONSE_SEARCH_HISTORY);
+    responseMsg.push_back(0);
+    std::string_view user, msg;
+    while (cursor.next(user, msg))
+    {
+        appendField(responseMsg, user);
+        appendField(responseMsg, msg);
+    }
+    responseMsg[1] = static_cast<unsigned char>(cursor.recordsRead());
+
+    std::cout << "→ SEARCH_HISTORY: " << cursor.recordsRead() << " coincidencias para " << username
+            << " target=" << target << ")" << std::endl;
+    return responseMsg;
+}
+
+// Arma la siguiente parte de un historial (RESPONSE_HISTORY_CHUNK), con hasta
+// history_chunk_bytes o 255 registros
+PooledBytes buildHistoryChunk(HistoryCursor &cursor)
+{
+    PooledBytes chunk;
+    chunk.reserve(serverConfig.historyChunkBytes + 2 * 256);
+    chunk.push_back(MessageCode::RESPONSE_HISTORY_CHUNK);
+    chunk.push_back(cursor.recordsRead() == 0 ? HistoryChunkFlag::FIRST : 0);
+    chunk.push_back(0);
+
+    size_t first = cursor.recordsRead();
+    std::string_view user, msg;
+    while (cursor.recordsRead() - first < 255 && chunk.size() < serverConfig.historyChunkBytes
+           && cursor.next(user, msg))
+    {
+        appendField(chunk, user);
+        appendField(chunk, msg);
+    }
+    chunk[2] = static_cast<unsigned char>(cursor.recordsRead() - first);
+
+    if (cursor.atEnd())
+        chunk[1] |= HistoryChunkFlag::LAST;
+    return chunk;
+}
+
+// Un GET_HISTORY_STREAM en modo corrutinas. Cada paso corre en el pool de historial: abre
+// el cursor la primera vez y envía partes mientras la cola de salida tenga lugar; cuando se
+// llena, espera en ella (ver runHistoryReads) y el siguiente paso sigue donde quedó.
+struct HistoryStream
+{
+    UserInfo &self;
+    std::shared_ptr<SessionState> session;
+    std::shared_ptr<OutboundQueue> outbound;
+    std::optional<uint64_t> conversation;
+    std::string target;
+    std::shared_ptr<HistoryCursor> cursor;
+
+    std::shared_ptr<OutboundQueue> operator()()
+    {
+        if (!cursor)
+        {
+            auto opened = std::make_shared<HistoryCursor>();
+            if (!openHistoryCursor(*opened, conversation, self.username, target))
+            {
+                PooledBytes err = { MessageCode::ERROR_RESPONSE, ErrorCode::USER_NOT_FOUND };
+                deliver(err);
+                return nullptr;
+            }
+            std::cout << "→ Historial por partes para " << self.username
+                    << " target=" << target << ")" << std::endl;
+            cursor = std::move(opened);
+        }
+
+        while (true)
+        {
+            // Sin lugar se espera a que la cola baje; si se cerró, la sesión terminó y lo que
+            // falta ya no tiene a quién llegar
+            if (!outbound->hasRoom())
+                return outbound->isClosed() ? nullptr : outbound;
+            PooledBytes chunk = buildHistoryChunk(*cursor);
+            if (!deliver(chunk))
+                return nullptr;
+            if (cursor->atEnd())
+            {
+                std::cout << "→ Historial de " << cursor->recordsRead() << " mensajes enviado a "
+                          << self.username << " por partes" << std::endl;
+                return nullptr;
+            }
+        }
+    }
+
+    // Como en GET_HISTORY: solo si la sesión sigue siendo la misma
+    bool deliver(const PooledBytes &frame)
+    {
+        std::lock_guard<std::mutex> lock(clients_mutex);
+        if (self.session != session)
+            return false;
+        deliverToUser(self, frame);
+        return true;
+    }
+};
+
+// Arma RESPONSE_LIST_USERS (conectados) y/o RESPONSE_ALL_USERS (todos) recorriendo el
+// directorio una sola vez; el que no se necesite va en nullptr. Llamar con clients_mutex
+// tomado. Devuelve la cantidad de usuarios de la última lista armada.
+size_t buildUserLists(PooledBytes *connected, PooledBytes *all)
+{
+    if (connected)
+        connected->insert(connected->end(), {MessageCode::RESPONSE_LIST_USERS, 0});
+    if (all)
+        all->insert(all->end(), {MessageCode::RESPONSE_ALL_USERS, 0});
+
+    auto appendUser = [](PooledBytes &resp, const UserInfo &info) {
+        resp.push_back(static_cast<unsigned char>(info.username.size()));
+        resp.insert(resp.end(), info.username.begin(), info.username.end());
+        resp.push_back(static_cast<unsigned char>(info.status)); // casteo a byte
+    };
+
+    size_t connectedCount = 0, allCount = 0;
+    userDirectory.forEach([&](const UserInfo &info) {
+        if (all)
+        {
+            appendUser(*all, info);
+            ++allCount;
+        }
+        if (connected && info.status != UserStatus::DISCONNECTED)
+        {
+            appendUser(*connected, info);
+            ++connectedCount;
+        }
+    });
+
+    // La cantidad va antes de los usuarios; se completa al terminar
+    if (connected)
+        (*connected)[1] = static_cast<unsigned char>(connectedCount);
+    if (all)
+        (*all)[1] = static_cast<unsigned char>(allCount);
+    return all ? allCount : connectedCount;
+}
+
+// Respuesta a GET_USER: RESPONSE_GET_USER con el estado, o USER_NOT_FOUND si no está
+// conectado. Con varios nombres la respuesta trae uno por cada uno, en el mismo orden, y
+// los que no existen o están desconectados van con estado 0. @p found es lo que devolvió
+// resolveUsers() para los mismos nombres. Llamar con clients_mutex tomado.
+PooledBytes buildUserInfoResponse(const PooledVector<PooledBytes> &names, const PooledVector<const UserInfo *> &found)
+{
+    auto nameAt = [&](size_t i) {
+        return std::string_view(reinterpret_cast<const char *>(names[i].data()), names[i].size());
+    };
+
+    if (names.size() <= 1)
+    {
+        std::string_view target = names.empty() ? std::string_view() : nameAt(0);
+        const UserInfo *user = found.empty() ? nullptr : found[0];
+        if (!user || user->status == UserStatus::DISCONNECTED)
+            return { MessageCode::ERROR_RESPONSE, ErrorCode::USER_NOT_FOUND };
+
+        PooledBytes resp;
+        resp.push_back(MessageCode::RESPONSE_GET_USER);           // TIPO
+        appendField(resp, target);                                // LEN_USER + USERNAME
+        resp.push_back(static_cast<unsigned char>(user->status)); // STATUS
+        return resp;
+    }
+
+    PooledBytes resp;
+    resp.push_back(MessageCode::RESPONSE_GET_USER);
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        appendField(resp, nameAt(i));
+        resp.push_back(static_cast<unsigned char>(found[i] ? found[i]->status : UserStatus::DISCONNECTED));
+    }
+    return resp;
+}
+
+// Busca en el directorio los nombres de un GET_USER, en el mismo orden. Se llama antes de
+// tomar clients_mutex: find() puede tener que leer un usuario del nivel frío.
+PooledVector<const UserInfo *> resolveUsers(const PooledVector<PooledBytes> &names)
+{
+    PooledVector<const UserInfo *> found;
+    found.reserve(names.size());
+    for (const auto &name : names)
+        found.push_back(userDirectory.find(std::string_view(reinterpret_cast<const char *>(name.data()), name.size())));
+    return found;
+}
+
+// Respuesta a SEARCH_USERS: hasta limit usuarios registrados cuyo nombre empieza con el
+// prefijo, con su estado. Llamar con clients_mutex tomado.
+PooledBytes buildUserSearchResponse(const ParsedMessage &pm)
+{
+    std::string_view prefix;
+    if (!pm.fields.empty())
+        prefix = std::string_view(reinterpret_cast<const char *>(pm.fields[0].data()), pm.fields[0].size());
+    size_t limit = serverConfig.userSearchLimit;
+    if (pm.fields.size() > 1 && pm.fields[1][0] > 0)
+        limit = std::min<size_t>(limit, pm.fields[1][0]);
+
+    auto ids = userDirectory.findByPrefix(prefix, limit);
+    PooledBytes resp;
+    resp.push_back(MessageCode::RESPONSE_SEARCH_USERS);
+    resp.push_back(static_cast<unsigned char>(ids.size()));
+    for (uint32_t id : ids)
+    {
+        const UserInfo &info = userDirectory[id];
+        appendField(resp, info.username);
+        resp.push_back(static_cast<unsigned char>(info.status));
+    }
+    return resp;
+}
+
+// Un usuario recién desconectado todavía puede reanudar su sesión, así que se le siguen
+// guardando las notificaciones mientras esté dentro de la ventana.
+bool isResumable(const UserInfo &info)
+{
+    // Los del nivel frío ya pasaron la ventana (y su ventana de repetición está vacía)
+    return info.status == UserStatus::DISCONNECTED && !info.ws && !info.cold.load(std::memory_order_acquire)
+        && std::chrono::steady_clock::now() - info.session->detachedAt < std::chrono::seconds(serverConfig.resumeWindowSeconds);
+}
+
+// Construye la trama SESSION_INFO: secuencia (8 bytes, big endian) + bandera de reanudación
+PooledBytes buildSessionInfo(uint64_t seq, bool resumed)
+{
+    PooledBytes msg;
+    msg.push_back(MessageCode::SESSION_INFO);
+    for (int shift = 56; shift >= 0; shift -= 8)
+        msg.push_back(static_cast<unsigned char>(seq >> shift));
+    msg.push_back(resumed ? 1 : 0);
+    return msg;
+}
+
+// Asocia un socket nuevo a la sesión del usuario. Si el cliente indicó la última secuencia
+// que recibió y la ventana todavía la cubre, se reenvían solo las tramas posteriores;
+// si no, se le avisa que debe refrescar todo (lista de usuarios e historiales).
+bool attachSession(UserInfo &info, std::shared_ptr<websocket::stream<tcp::socket>> ws, std::optional<uint64_t> lastSeenSeq,
+                   std::shared_ptr<OutboundQueue> outbound)
+{
+    auto &session = *info.session;
+    std::lock_guard<std::mutex> lock(session.mutex);
+    info.ws = ws;
+    session.outbound = outbound;
+
+    uint64_t firstKept = session.replay.empty() ? session.lastSeq + 1 : session.replay.front().first;
+    bool resumed = lastSeenSeq
+        && *lastSeenSeq <= session.lastSeq
+        && *lastSeenSeq + 1 >= firstKept;
+
+    uint64_t from = resumed ? *lastSeenSeq : session.lastSeq;
+    writeFrame(info, buildSessionInfo(from, resumed));
+
+    if (resumed)
+    {
+        size_t replayed = 0;
+        for (auto &[seq, frame] : session.replay)
+        {
+            if (seq <= from) continue;
+            writeFrame(info, frame);
+            ++replayed;
+        }
+        std::cout << "Sesión de " << info.username << " reanudada desde seq " << from
+                  << " (" << replayed << " tramas reenviadas)" << std::endl;
+    }
+    else
+    {
+        // El cliente vuelve a pedir las listas y se suscribe de nuevo a lo que muestre
+        presenceIndex.clear(info.id);
+    }
+    return resumed;
+}
+
+// Suelta el socket del usuario dejando su ventana de repetición disponible para reanudar
+void detachSession(UserInfo &info)
+{
+    std::lock_guard<std::mutex> lock(info.session->mutex);
+    info.ws.reset();
+    if (info.session->outbound)
+    {
+        info.session->outbound->close();
+        recordSent(*info.session);
+        info.session->outbound.reset();
+    }
+    info.session->detachedAt = std::chrono::steady_clock::now();
+}
+
+// Envía la trama de cierre 1001 (going away) y corta el sentido de escritura. La trama se
+// escribe a mano porque el hilo de la sesión sigue bloqueado en read y beast no permite
+// cerrar desde otro hilo. Cuando el cliente responde el cierre, ese read termina solo.
+void closeSessionForShutdown(UserInfo &info)
+{
+    static const std::string reason = "Servidor apagándose";
+    std::lock_guard<std::mutex> lock(info.session->mutex);
+    if (!info.ws || !info.ws->next_layer().is_open())
+        return;
+
+    if (info.session->outbound)
+    {
+        // En modo corrutinas el cierre se inicia en el strand de la sesión con beast; la
+        // corrutina lectora recibe la respuesta del cliente y termina sola
+        asio::post(info.ws->get_executor(), [ws = info.ws] {
+            ws->async_close(websocket::close_reason(websocket::close_code::going_away, reason),
+                            [ws](const beast::error_code &) {});
+        });
+        return;
+    }
+
+    uint16_t code = static_cast<uint16_t>(websocket::close_code::going_away);
+    std::string frame;
+    frame.push_back(static_cast<char>(0x88)); // FIN + opcode close
+    frame.push_back(static_cast<char>(2 + reason.size()));
+    frame.push_back(static_cast<char>(code >> 8));
+    frame.push_back(static_cast<char>(code & 0xFF));
+    frame += reason;
+
+    beast::error_code ec;
+    asio::write(info.ws->next_layer(), asio::buffer(frame), ec);
+    info.ws->next_layer().shutdown(tcp::socket::shutdown_send, ec);
+}
+
+// Para clientes que no responden el cierre: cortar la lectura despierta al hilo de la sesión
+void abortSessionForShutdown(UserInfo &info)
+{
+    std::lock_guard<std::mutex> lock(info.session->mutex);
+    if (!info.ws || !info.ws->next_layer().is_open())
+        return;
+    auto abort = [ws = info.ws] {
+        beast::error_code ec;
+        ws->next_layer().shutdown(tcp::socket::shutdown_both, ec);
+    };
+    // En modo corrutinas el socket solo se toca desde su strand
+    if (info.session->outbound)
+        asio::post(info.ws->get_executor(), abort);
+    else
+        abort();
+}
+
+// Cierra todas las sesiones abiertas y espera (con límite) a que sus hilos terminen
+void drainSessions()
+{
+    size_t closing = 0;
+    userDirectory.forEach([&](UserInfo &info)
+    {
+        if (info.ws)
+        {
+            closeSessionForShutdown(info);
+            ++closing;
+        }
+    });
+    std::cout << "Cerrando " << closing << " sesiones..." << std::endl;
+
+    std::unique_lock<std::mutex> lock(sessionsMutex);
+    if (sessionsChanged.wait_for(lock, std::chrono::seconds(serverConfig.drainTimeoutSeconds), []{ return activeSessions == 0; }))
+        return;
+
+    std::cerr << "[ERROR] drainSessions: " << activeSessions << " conexiones no respondieron el cierre, se cortan." << std::endl;
+    lock.unlock();
+    userDirectory.forEach([](UserInfo &info) { abortSessionForShutdown(info); });
+    lock.lock();
+    sessionsChanged.wait_for(lock, std::chrono::seconds(1), []{ return activeSessions == 0; });
+}
+
 // Extrae el parámetro "name" de la URL de la request
 std::string extractUsername(const std::string &target)
 {
@@ -101,6 +662,20 @@ std::string extractUsername(const std::string &target)
     return "";
 }
 
+// Extrae el parámetro opcional "lastSeq" (última trama recibida antes de reconectarse)
+std::optional<uint64_t> extractLastSeq(const std::string &target)
+{
+    std::regex seq_regex("[?&]lastSeq=([0-9]+)");
+    std::smatch match;
+    if (std::regex_search(target, match, seq_regex))
+    {
+        try {
+            return std::stoull(match[1]);
+        } catch (const std::exception &) {}
+    }
+    return std::nullopt;
+}
+
 std::string extractUserIpAddress(const tcp::socket &socket)
 {
     return socket.remote_endpoint().address().to_string();
@@ -110,101 +685,97 @@ std::string extractUserIpAddress(const tcp::socket &socket)
 void broadcastTextMessage(const std::string &message)
 {
     std::lock_guard<std::mutex> lock(clients_mutex);
-    for (auto &[user, info] : connectedUsers)
+    userDirectory.forEach([&](UserInfo &info)
     {
-
-        std::string decodedUser = urlDecode(user);
-
         if ((info.status == UserStatus::ACTIVE || info.status == UserStatus::BUSY)
             && info.ws                                    // <-- no sea nullptr
             && info.ws->next_layer().is_open()           // <-- esté abierto
             && !message.empty())
         {
             try {
-                info.ws->binary(false);
-                info.ws->write(asio::buffer(message));
+                std::lock_guard<std::mutex> writeLock(info.session->mutex);
+                writeText(info, message);
             } catch(const std::exception &e) {
-                std::cerr << "[ERROR] broadcastTextMessage to " << user << ": " << e.what() << std::endl;
+                std::cerr << "[ERROR] broadcastTextMessage to " << info.username << ": " << e.what() << std::endl;
             }
         }
-    }
+    });
 }
 
 // Notificar a todos los clientes con ID 53
 void broadcastUserJoined(const std::string &username, const std::string &ipAddress)
 {
-    {
-        std::lock_guard<std::mutex> lock(clients_mutex);
-        for(auto &p : connectedUsers)
-            snapshot.push_back(p.second);
-    }
-    for (auto &[user, info] : connectedUsers)
+    auto binMsg = buildBinaryMessage(MessageCode::USER_REGISTERED, {username, ipAddress});
+    userDirectory.forEach([&](UserInfo &info)
     {
         // Solo se notifica si el usuario está en estado ACTIVE o BUSY.
-        if ((info.status == UserStatus::ACTIVE || info.status == UserStatus::BUSY) && !username.empty())
+        if ((info.status == UserStatus::ACTIVE || info.status == UserStatus::BUSY || isResumable(info)) && !username.empty())
         {
-            auto binMsg = buildBinaryMessage(MessageCode::USER_REGISTERED, {std::vector<unsigned char>(username.begin(), username.end()),
-                                                                            std::vector<unsigned char>(ipAddress.begin(), ipAddress.end())});
-            sendBinaryMessage(info.ws, binMsg); // Envía el mensaje binario
+            deliverToUser(info, binMsg); // Envía el mensaje binario
         }
-    }
+    });
 }
 
 // Notificar a todos los clientes con ID 54 cuando un usuario se desconecta
 void broadcastUserDisconnected(const std::string &username)
 {
-    {
-        std::lock_guard<std::mutex> lock(clients_mutex);
-        for(auto &p : connectedUsers)
-            snapshot.push_back(p.second);
-    }
-    for (auto &[user, info] : connectedUsers)
+    auto binMsg = buildBinaryMessage(MessageCode::USER_STATUS_CHANGED, {username});
+    userDirectory.forEach([&](UserInfo &info)
     {
         // Notificar solo a los usuarios con estado ACTIVE o BUSY.
-        if ((info.status == UserStatus::ACTIVE || info.status == UserStatus::BUSY) && !username.empty())
+        if ((info.status == UserStatus::ACTIVE || info.status == UserStatus::BUSY || isResumable(info)) && !username.empty())
         {
-            auto binMsg = buildBinaryMessage(MessageCode::USER_STATUS_CHANGED, {std::vector<unsigned char>(username.begin(), username.end())});
-            sendBinaryMessage(info.ws, binMsg); // Envía el mensaje binario
+            deliverToUser(info, binMsg); // Envía el mensaje binario
         }
-    }
+    });
 }
 
-// Notificar a todos los clientes con ID 54 cuando un usuario cambia de estado
-void broadcastUserStatusChanged(const std::string &username, UserStatus newStatus)
+// Notificar con ID 54 (y con una línea de texto) el cambio de estado de un usuario: le llega
+// a él mismo y a los usuarios suscritos a su presencia, no a todos los conectados
+void broadcastUserStatusChanged(UserInfo &changed, UserStatus newStatus)
 {
-    {
-        std::lock_guard<std::mutex> lock(clients_mutex);
-        for(auto &p : connectedUsers)
-            snapshot.push_back(p.second);
-    }
-    
-    std::vector<unsigned char> binMsg;
+    const std::string &username = changed.username;
+    PooledBytes binMsg;
     binMsg.push_back(MessageCode::USER_STATUS_CHANGED); // 0x36
     binMsg.push_back(static_cast<unsigned char>(username.size())); // Len username
     binMsg.insert(binMsg.end(), username.begin(), username.end()); // Username
     binMsg.push_back(static_cast<unsigned char>(newStatus)); // Status (sin longitud)
-    
-    // Solo se notifica a usuarios en ACTIVE o BUSY
-    for (auto &[user, info] : connectedUsers)
+    std::string text = "Usuario " + username + " se ha cambiado a estado " + userStatusToString(newStatus);
+
+    auto notify = [&](UserInfo &info)
     {
-        if (info.ws && info.ws->next_layer().is_open())
-        {
-            try {
-                sendBinaryMessage(info.ws, binMsg);
-            } catch(const std::exception &e) {
-                std::cerr << "[ERROR] broadcastUserStatusChanged to " << user << ": " << e.what() << std::endl;
+        try {
+            if ((info.ws && info.ws->next_layer().is_open()) || isResumable(info))
+                deliverToUser(info, binMsg);
+
+            // La línea de texto, como broadcastTextMessage, solo a los ACTIVE o BUSY conectados
+            std::lock_guard<std::mutex> lock(clients_mutex);
+            if ((info.status == UserStatus::ACTIVE || info.status == UserStatus::BUSY)
+                && info.ws && info.ws->next_layer().is_open())
+            {
+                std::lock_guard<std::mutex> writeLock(info.session->mutex);
+                writeText(info, text);
             }
+        } catch(const std::exception &e) {
+            std::cerr << "[ERROR] broadcastUserStatusChanged to " << info.username << ": " << e.what() << std::endl;
         }
-    }
+    };
+
+    notify(changed);
+    for (uint32_t id : presenceIndex.subscribersOf(changed.id))
+        notify(userDirectory[id]);
 }
 
-// Cambiar el estado de un usuario y notificar a los demás
-void setUserStatus(const std::string &username, UserStatus newStatus, bool forceNotify = false)
+// Trama USER_STATUS del cluster: nombre, estado e IP de un usuario de este nodo
+PooledBytes buildClusterStatus(const UserInfo &info)
 {
-    if (!connectedUsers.count(username)) return;
+    char status = static_cast<char>(info.status);
+    return buildBinaryMessage(ClusterCode::USER_STATUS, {info.username, std::string_view(&status, 1), info.ipAddress});
+}
 
-    auto &info = connectedUsers[username];
-    
+// Cambiar el estado de un usuario y notificar a los demás
+void setUserStatus(UserInfo &info, UserStatus newStatus, bool forceNotify = false)
+{
     if (info.status == newStatus && !forceNotify)
     {
         // Si no hay cambio, no hacemos nada
@@ -220,631 +791,1123 @@ void setUserStatus(const std::string &username, UserStatus newStatus, bool force
 
     info.status = newStatus;
 
-    // 1) Notificar por binario (ID 54)
-    broadcastUserStatusChanged(username, newStatus);
-
-    // 2) Notificar por texto: "Usuario X se ha cambiado a estado Y"
-    //DEBUG LOG: std::cerr << "[DEBUG] setUserStatus START: " << username << " from " << userStatusToString(info.status) << " to " << userStatusToString(newStatus) << std::endl;
-    // info.status = newStatus;
-    //DEBUG LOG: std::cerr << "[DEBUG] setUserStatus END: " << username << " now " << userStatusToString(info.status) << std::endl; 
+    // Notificar por binario (ID 54) y por texto: "Usuario X se ha cambiado a estado Y"
+    broadcastUserStatusChanged(info, newStatus);
 
-    broadcastTextMessage("Usuario " + username + " se ha cambiado a estado " + userStatusToString(newStatus));
+    // Los otros nodos replican el estado de los usuarios de este
+    if (info.node == 0 && clusterLink.enabled())
+        clusterLink.broadcast(buildClusterStatus(info));
 }
 
-void markUserDisconnected(const std::string &username)
+void markUserDisconnected(UserInfo &info)
 {
-    setUserStatus(username, UserStatus::DISCONNECTED, true);
+    setUserStatus(info, UserStatus::DISCONNECTED, true);
 }
 
-// Manejo de la conexión de un cliente mediante WebSockets
-void handleClient(std::shared_ptr<websocket::stream<tcp::socket>> ws, std::string username)
+// Asocia el socket a la sesión del usuario (nueva o reanudada), le da la bienvenida y avisa
+// a los demás. Es común a los dos modos de sesión; outbound solo existe en modo corrutinas.
+// self es el registro que checkHandshake reservó para esta conexión.
+UserInfo &openSession(std::shared_ptr<websocket::stream<tcp::socket>> ws, UserInfo &self, bool created,
+                      std::optional<uint64_t> lastSeenSeq, std::shared_ptr<OutboundQueue> outbound)
 {
-    try
+    // Todas las respuestas al propio cliente pasan por su sesión para quedar numeradas
+    const std::string &username = self.username;
     {
+        if (!created)
         {
-            {
-                std::lock_guard<std::mutex> lock(clients_mutex);
-                for(auto &p : connectedUsers)
-                    snapshot.push_back(p.second);
-            }            
-            auto it = connectedUsers.find(username);
-            if (it != connectedUsers.end())
-            {
-                // El usuario ya existía
-                auto &info = it->second;
+            // El usuario ya existía (quizás conectado antes en otro nodo del cluster)
+            auto &info = self;
+            info.node = 0;
 
-                // Si estaba DISCONNECTED, volvemos al estado anterior
-                if (info.status == UserStatus::DISCONNECTED)
-                {
-                    // Regresamos al estado que tenía antes de desconectarse
-                    // (Si era INACTIVE, se vuelve ACTIVE según tu regla)
-                    if (info.previousState == UserStatus::BUSY)
-                    {
-                        setUserStatus(username, UserStatus::BUSY, true);
-                    }
-                    else if (info.previousState == UserStatus::ACTIVE, true)
-                    {
-                        setUserStatus(username, UserStatus::ACTIVE, true);
-                    }
-                    else if (info.previousState == UserStatus::INACTIVE, true)
-                    {
-                        setUserStatus(username, UserStatus::ACTIVE, true);
-                    }
-                    else
-                    {
-                        // Por defecto, si no teníamos nada, lo ponemos en ACTIVE
-                        setUserStatus(username, UserStatus::ACTIVE, true);
-                    }
-                }
-                // Si no estaba DISCONNECTED, no forzamos nada. (Si estaba BUSY, se queda BUSY,
-                // si estaba ACTIVE, se queda ACTIVE, etc.)
+            // Reasociamos el socket antes de notificar el cambio de estado, así el cliente
+            // recibe primero las tramas que se perdió y luego las nuevas en orden
+            attachSession(info, ws, lastSeenSeq, outbound);
+            info.lastActivityTime = std::chrono::steady_clock::now();
 
-                // Actualizamos el socket y la hora de actividad
-                info.ws = ws;
-                info.lastActivityTime = std::chrono::steady_clock::now();
-            }
-            else
+            // Si estaba DISCONNECTED, volvemos al estado anterior
+            if (info.status == UserStatus::DISCONNECTED)
             {
-                // Usuario nuevo, lo creamos por primera vez
-                UserInfo newUser {
-                    username,
-                    ws,
-                    UserStatus::ACTIVE, // estado inicial
-                    extractUserIpAddress(ws->next_layer()),
-                    std::chrono::steady_clock::now(),
-                    UserStatus::ACTIVE // previousState inicial
-                };
-                connectedUsers[username] = newUser;
-
-                // Notificamos su estado inicial (ACTIVO)
-                setUserStatus(username, UserStatus::ACTIVE, true);
-                
+                // Regresamos al estado que tenía antes de desconectarse: BUSY sigue BUSY y
+                // cualquier otro (también INACTIVE) vuelve como ACTIVE
+                setUserStatus(info, info.previousState == UserStatus::BUSY ? UserStatus::BUSY : UserStatus::ACTIVE, true);
             }
+            // Si no estaba DISCONNECTED, no forzamos nada. (Si estaba BUSY, se queda BUSY,
+            // si estaba ACTIVE, se queda ACTIVE, etc.)
         }
+        else
+        {
+            // Usuario nuevo: el directorio ya le asignó su ID, completamos sus datos
+            self.status = UserStatus::ACTIVE; // estado inicial
+            self.ipAddress = extractUserIpAddress(ws->next_layer());
+            self.lastActivityTime = std::chrono::steady_clock::now();
+            self.previousState = UserStatus::ACTIVE; // previousState inicial
+            attachSession(self, ws, lastSeenSeq, outbound); // el socket se asocia aquí
+
+            // Notificamos su estado inicial (ACTIVO)
+            setUserStatus(self, UserStatus::ACTIVE, true);
+            
+        }
+    }
+
+    std::cout << "Usuario " << username << " conectado." << std::endl;
 
-        std::cout << "Usuario " << username << " conectado." << std::endl;
+    // Enviar mensaje de bienvenida en modo texto
+    {
+        std::lock_guard<std::mutex> writeLock(self.session->mutex);
+        writeText(self, "¡Bienvenido a YaPPuchino!");
+    }
 
-        // Enviar mensaje de bienvenida en modo texto
-        ws->binary(false);
-        ws->write(asio::buffer("¡Bienvenido a YaPPuchino!"));
+    // Notificar a los demás usuarios que se ha unido un nuevo usuario
+    broadcastUserJoined(username, self.ipAddress);
+    broadcastTextMessage("Usuario " + username + " se ha unido.");
+    if (clusterLink.enabled())
+        clusterLink.broadcast(buildBinaryMessage(ClusterCode::USER_JOINED, {username}));
 
-        // Notificar a los demás usuarios que se ha unido un nuevo usuario
-        broadcastUserJoined(username, connectedUsers[username].ipAddress);
-        broadcastTextMessage("Usuario " + username + " se ha unido.");
+    return self;
+}
 
-        beast::flat_buffer buffer;
-        while (true)
+// Reparte un mensaje del chat general a los usuarios de este nodo (remitente anónimo "~")
+void deliverGeneralMessage(const std::string &message)
+{
+    const std::string anon = "~"; // identificador anónimo
+    auto binOut = buildBinaryMessage(MessageCode::MESSAGE_RECEIVED, {anon, message});
+
+    userDirectory.forEach([&](UserInfo &info)
+    {
+        if (info.status == UserStatus::ACTIVE || info.status == UserStatus::BUSY || isResumable(info))
         {
-            buffer.consume(buffer.size());
-            try {
-                ws->read(buffer);
-            } catch(const std::exception &e) {
-                std::cerr << "[ERROR] read for " << username << ": " << e.what() << std::endl;
-                break;
-            }
+            deliverToUser(info, binOut);
+        }
+    });
+}
 
-            {
-                // Usamos un lock temporal solo para obtener la información necesaria
-                bool needReactivation = false;
-                {
-                    {
-                        std::lock_guard<std::mutex> lock(clients_mutex);
-                        for(auto &p : connectedUsers)
-                            snapshot.push_back(p.second);
-                    }
-                    auto &info = connectedUsers[username];
-                    info.lastActivityTime = std::chrono::steady_clock::now();
+// Guarda y reparte un mensaje de chat ya validado (UTF-8). @p dest es "~" para el chat
+// general o el nombre del destinatario. Lo usan SEND_MESSAGE y los mensajes de texto.
+void routeChatMessage(UserInfo &self, const std::string &dest, const std::string &message)
+{
+    const std::string &username = self.username;
 
-                    if (info.status == UserStatus::INACTIVE && ws->got_text())
-                    {
-                        std::string msg = beast::buffers_to_string(buffer.data());
-                        if (!msg.empty() && !std::all_of(msg.begin(), msg.end(), ::isspace)) {
-                            needReactivation = true;
-                        }
-                    }
-                } // Aquí se libera el mutex
+    if (message.empty())
+    {
+        auto errMsg = buildRawBinaryMessage(MessageCode::ERROR_RESPONSE, {{ErrorCode::EMPTY_MESSAGE}});
+        deliverToUser(self, errMsg);
+        return;
+    }
 
-                if (needReactivation)
-                {
-                    std::cout << "Reactivando usuario " << username << std::endl;
-                    // Reactivamos al usuario; setUserStatus internamente adquiere el mutex
-                    setUserStatus(username, UserStatus::ACTIVE, true);
-
-                    // Ahora, fuera del mutex, enviar un mensaje directo al cliente para confirmar la reactivación
-                    ws->binary(false);
-                    std::string reactivationMsg = "Se ha reactivado el estado de " + username + " a ACTIVO.";
-                    try {
-                        ws->write(asio::buffer(reactivationMsg));
-                        //DEBUG LOG: std::cerr << "[DEBUG] Enviado texto a " << reactivationMsg << std::endl;
-                    } catch (const std::exception &e) {
-                        //DEBUG LOG: std::cerr << "[ERROR] send to " << reactivationMsg << ": " << e.what() << std::endl;
-                    }                
-                }
-            }
+    // El destinatario se resuelve una sola vez; de ahí en adelante se usa su ID
+    UserInfo *destInfo = dest == "~" ? nullptr : userDirectory.find(dest);
+
+    if (dest == "~") {
+        appendToHistory("~", message);  // mensaje general
+    } else if (destInfo) {
+        appendPrivateHistory(privateConversationKey(self.id, destInfo->id), username, dest, message);  // mensaje privado
+    }
+
+    bool needReactivate = false;
+    {
+        std::lock_guard<std::mutex> lock(clients_mutex);
+        if (self.status == UserStatus::INACTIVE) {
+            needReactivate = true;
+        }
+    }
+
+    if (needReactivate) {
+        std::cout << "Reactivando usuario " << username << " por mensaje SEND_MESSAGE" << std::endl;
+        setUserStatus(self, UserStatus::ACTIVE, true);
+    }
+
+    // Si el mensaje es para el chat general, el destino es "~"
+    if (dest == "~")
+    {
+        deliverGeneralMessage(message);
+        if (clusterLink.enabled())
+            clusterLink.broadcast(buildBinaryMessage(ClusterCode::CHAT_GENERAL, {username, message}));
+        std::cout << "→ Mensaje de " << username << " enviado al chat general: " << message << std::endl;
+        return;
+    }
+
+    // Mensaje privado: solo a los activos, ocupados e inactivos
+    if (destInfo && (destInfo->status == UserStatus::ACTIVE || destInfo->status == UserStatus::BUSY || destInfo->status == UserStatus::INACTIVE))
+    {
+        auto binOut = buildBinaryMessage(MessageCode::MESSAGE_RECEIVED, {username, message});
+        if (destInfo->node != 0)
+            clusterLink.send(destInfo->node, buildBinaryMessage(ClusterCode::CHAT_PRIVATE, {username, dest, message}));
+        else
+            deliverToUser(*destInfo, binOut);
+        deliverToUser(self, binOut);
+        std::cout << "→ Mensaje de " << username << " enviado a " << dest << ": " << message << std::endl;
+    }
+    else
+    {
+        auto errMsg = buildRawBinaryMessage(MessageCode::ERROR_RESPONSE, {{static_cast<unsigned char>(ErrorCode::USER_DISCONNECTED)}});
+        deliverToUser(self, errMsg);
+        std::cerr << "[INFO] Usuario " << username << " intentó enviar mensaje a usuario desconectado: " << dest << std::endl;
+    }
+}
+
+// Procesa un mensaje recibido del usuario. Devuelve false si pidió salir con "/exit".
+bool handleIncomingMessage(UserInfo &self, bool text, const unsigned char *data, size_t size)
+{
+    const std::string &username = self.username;
+
+    // Una sola pasada sobre el texto: UTF-8 válido y si es solo espacios
+    TextScanResult scan{true, false};
+    if (text)
+        scan = scanText(data, size);
+
+    // Solo la sesión del propio usuario escribe su actividad
+    self.lastActivityTime = std::chrono::steady_clock::now();
+
+    // Un texto que no está en blanco reactiva al usuario inactivo
+    if (self.status == UserStatus::INACTIVE && text && !scan.allWhitespace)
+    {
+        std::cout << "Reactivando usuario " << username << std::endl;
+        setUserStatus(self, UserStatus::ACTIVE, true);
+
+        // Confirmación directa al cliente
+        std::string reactivationMsg = "Se ha reactivado el estado de " + username + " a ACTIVO.";
+        try {
+            std::lock_guard<std::mutex> writeLock(self.session->mutex);
+            writeText(self, reactivationMsg);
+        } catch (const std::exception &e) {
+            std::cerr << "[ERROR] send to " << username << ": " << e.what() << std::endl;
+        }
+    }
 
-            // Diferenciar si el mensaje recibido es de texto o binario
-            if (ws->got_text())
+    // Diferenciar si el mensaje recibido es de texto o binario
+    if (text)
+    {
+        // Evitar procesar mensajes vacíos o compuestos únicamente de espacios
+        if (scan.allWhitespace || !scan.validUtf8)
+        {
+            auto errMsg = buildRawBinaryMessage(MessageCode::ERROR_RESPONSE,
+                {{scan.validUtf8 ? ErrorCode::EMPTY_MESSAGE : ErrorCode::INVALID_TEXT}});
+            deliverToUser(self, errMsg);
+            return true;
+        }
+        std::string msg(reinterpret_cast<const char *>(data), size);
+        if (msg == "/exit")
+        {
+            std::cout << "Usuario " << username << " ha solicitado desconexión." << std::endl;
+            return false;
+        }
+        // Un texto suelto es un SEND_MESSAGE al chat general: mismo historial y mismo envío,
+        // así que tiene que entrar en un campo de MESSAGE_RECEIVED
+        if (msg.size() > 255)
+        {
+            auto errMsg = buildRawBinaryMessage(MessageCode::ERROR_RESPONSE, {{ErrorCode::MESSAGE_TOO_LONG}});
+            deliverToUser(self, errMsg);
+            return true;
+        }
+        routeChatMessage(self, "~", msg);
+    }
+    else
+    {
+        // Procesamiento de mensaje binario
+        try
+        {
+            ParsedMessage pm = parseBinaryMessage(data, size);
+
+            // Procesamiento según el código del mensaje
+            switch (pm.code)
+            {
+            case MessageCode::SEND_MESSAGE:
             {
-                std::string msg = beast::buffers_to_string(buffer.data());
-                // Evitar procesar mensajes vacíos o compuestos únicamente de espacios
-                if (msg.empty() || std::all_of(msg.begin(), msg.end(), ::isspace))
+
+                // Se esperan dos campos: destinatario y contenido del mensaje
+                if (pm.fields.size() < 2)
                 {
                     auto errMsg = buildRawBinaryMessage(MessageCode::ERROR_RESPONSE, {{ErrorCode::EMPTY_MESSAGE}});
-                    sendBinaryMessage(ws, errMsg);
-                    continue;
+                    deliverToUser(self, errMsg);
+                    break;
                 }
-                if (msg == "/exit")
+                // El cliente Qt decodifica el texto como UTF-8: lo inválido no se guarda ni se reenvía
+                if (!scanText(pm.fields[1].data(), pm.fields[1].size()).validUtf8)
                 {
-                    std::cout << "Usuario " << username << " ha solicitado desconexión." << std::endl;
-                    websocket::close_reason cr;
-                    cr.code = websocket::close_code::normal;
-                    cr.reason = "El usuario solicitó desconexión voluntaria";
-                    ws->close(cr);
-                    ws->next_layer().close();
+                    auto errMsg = buildRawBinaryMessage(MessageCode::ERROR_RESPONSE, {{ErrorCode::INVALID_TEXT}});
+                    deliverToUser(self, errMsg);
                     break;
                 }
-                std::cout << "Mensaje de texto recibido de " << username << ": " << msg << std::endl;
-                appendToHistory(username, msg);
-                broadcastTextMessage(username + ": " + msg);
+                std::string dest(pm.fields[0].begin(), pm.fields[0].end());
+                std::string message(pm.fields[1].begin(), pm.fields[1].end());
+                routeChatMessage(self, dest, message);
+                break;
             }
-            else
+            // Aquí  agregar casos para LIST_USERS, GET_USER, CHANGE_STATUS, GET_HISTORY, etc.
+            // List User: retorna el listado de usuarios y sus estados
+            case MessageCode::LIST_USERS:
             {
-                // Procesamiento de mensaje binario
-                auto data = buffer.data();
-
-                std::vector<unsigned char> binMsg(
-                    static_cast<const unsigned char *>(data.data()),
-                    static_cast<const unsigned char *>(data.data()) + data.size());
+                std::lock_guard<std::mutex> lock(clients_mutex);
 
-                try
-                {
-                    ParsedMessage pm = parseBinaryMessage(binMsg);
+                PooledBytes resp;
+                size_t count = buildUserLists(&resp, nullptr);
 
-                    // Procesamiento según el código del mensaje
-                    switch (pm.code)
-                    {
-                    case MessageCode::SEND_MESSAGE:
-                    {
+                deliverToUser(self, resp);
+                std::cout << "→ Enviado listado de " << count << " usuarios a " << username << "\n";
+                break;
+            }
 
-                        auto binMsg = buildBinaryMessage(MessageCode::SEND_MESSAGE, {pm.fields[0], pm.fields[1]});
-                        // sendBinaryMessage(ws, binMsg);
+            case MessageCode::LIST_ALL_USERS:
+            {
+                std::lock_guard<std::mutex> lock(clients_mutex);
 
-                        // Se esperan dos campos: destinatario y contenido del mensaje
-                        if (pm.fields.size() < 2)
-                        {
-                            auto errMsg = buildRawBinaryMessage(MessageCode::ERROR_RESPONSE, {{ErrorCode::EMPTY_MESSAGE}});
-                            sendBinaryMessage(ws, errMsg);
-                            break;
-                        }
-                        std::string dest(pm.fields[0].begin(), pm.fields[0].end());
-                        std::string message(pm.fields[1].begin(), pm.fields[1].end());
+                PooledBytes resp;
+                size_t count = buildUserLists(nullptr, &resp);
 
-                        if (dest == "~") {
-                            appendToHistory("~", message);  // mensaje general
-                        } else {
-                            appendPrivateHistory(username, dest, message);  // mensaje privado
-                        }                                            
+                deliverToUser(self, resp);
+                std::cout << "→ Enviado listado completo de " << count << " usuarios a " << username << "\n";
+                break;
+            }
 
-                        std::string mensajeTexto = username + ": " + message;
+            case MessageCode::BATCH:
+            {
+                // Sub-pedidos de consulta respondidos juntos en una sola trama, en el mismo orden.
+                // Las listas de usuarios salen de un único recorrido del directorio aunque se
+                // pidan las dos.
+                auto items = parseBatchMessage(data, size);
+                bool wantsConnected = false, wantsAll = false;
+                // Los nombres de los GET_USER se buscan antes de tomar clients_mutex
+                PooledVector<ParsedMessage> lookups(items.size());
+                PooledVector<PooledVector<const UserInfo *>> lookupUsers(items.size());
+                for (size_t i = 0; i < items.size(); ++i) {
+                    wantsConnected |= items[i].data[0] == MessageCode::LIST_USERS;
+                    wantsAll |= items[i].data[0] == MessageCode::LIST_ALL_USERS;
+                    if (items[i].data[0] == MessageCode::GET_USER) {
+                        lookups[i] = parseBinaryMessage(items[i].data, items[i].size);
+                        lookupUsers[i] = resolveUsers(lookups[i].fields);
+                    }
+                }
 
-                        if (message.empty())
-                        {
-                            auto errMsg = buildRawBinaryMessage(MessageCode::ERROR_RESPONSE, {{ErrorCode::EMPTY_MESSAGE}});
-                            sendBinaryMessage(ws, errMsg);
+                PooledBytes resp;
+                resp.push_back(MessageCode::RESPONSE_BATCH);
+                resp.push_back(static_cast<unsigned char>(items.size()));
+                // Cada respuesta va con 2 bytes de longitud: la que no entra (una lista de
+                // usuarios muy larga) se reemplaza por un error y el resto sale igual
+                auto appendItem = [&resp](const PooledBytes &frame) {
+                    if (frame.size() > 0xFFFF)
+                        appendBatchItem(resp, {MessageCode::ERROR_RESPONSE, ErrorCode::UNSUPPORTED_REQUEST});
+                    else
+                        appendBatchItem(resp, frame);
+                };
+                {
+                    std::lock_guard<std::mutex> lock(clients_mutex);
+                    PooledBytes connected, all;
+                    buildUserLists(wantsConnected ? &connected : nullptr, wantsAll ? &all : nullptr);
+
+                    for (size_t i = 0; i < items.size(); ++i) {
+                        const auto &item = items[i];
+                        switch (item.data[0]) {
+                        case MessageCode::LIST_USERS:
+                            appendItem(connected);
+                            break;
+                        case MessageCode::LIST_ALL_USERS:
+                            appendItem(all);
+                            break;
+                        case MessageCode::GET_USER:
+                            appendItem(buildUserInfoResponse(lookups[i].fields, lookupUsers[i]));
+                            break;
+                        case MessageCode::SEARCH_USERS:
+                            appendItem(buildUserSearchResponse(parseBinaryMessage(item.data, item.size)));
+                            break;
+                        default:
+                            // Los pedidos con efectos (mensajes, estado) o respuestas grandes van sueltos
+                            appendItem({MessageCode::ERROR_RESPONSE, ErrorCode::UNSUPPORTED_REQUEST});
                             break;
                         }
+                    }
+                }
 
-                        bool needReactivate = false;
-                        {
-                            std::lock_guard<std::mutex> lock(clients_mutex);
-                            auto &info = connectedUsers[username];
-                            if (info.status == UserStatus::INACTIVE) {
-                                needReactivate = true;
-                            }
-                        }
-                        
-                        if (needReactivate) {
-                            std::cout << "Reactivando usuario " << username << " por mensaje SEND_MESSAGE" << std::endl;
-                            setUserStatus(username, UserStatus::ACTIVE, true);
-                        }
+                deliverToUser(self, resp);
+                std::cout << "→ BATCH de " << items.size() << " pedidos respondido a " << username << std::endl;
+                break;
+            }
 
-                        // Si el mensaje es para el chat general, el destino es "~"
-                        if (dest == "~")
-                        {
-                            const std::string anon = "~"; // identificador anónimo
-                            auto binOut = buildBinaryMessage(MessageCode::MESSAGE_RECEIVED, {
-                                std::vector<unsigned char>(anon.begin(), anon.end()),
-                                std::vector<unsigned char>(message.begin(), message.end())
-                            });
+            case MessageCode::GET_USER:
+            {
+                auto found = resolveUsers(pm.fields);
+                std::lock_guard<std::mutex> lock(clients_mutex);
+                PooledBytes resp = buildUserInfoResponse(pm.fields, found);
 
-                            for (auto &[user, info] : connectedUsers)
-                            {
-                                if (info.status == UserStatus::ACTIVE || info.status == UserStatus::BUSY)
-                                {
-                                    sendBinaryMessage(info.ws, binOut);
-                                }
-                            }
-                        }
+                deliverToUser(self, resp);
+                if (resp[0] == MessageCode::RESPONSE_GET_USER && pm.fields.size() == 1)
+                    std::cout << "→ GET_USER: enviado info de " << std::string(pm.fields[0].begin(), pm.fields[0].end()) << std::endl;
+                else if (resp[0] == MessageCode::RESPONSE_GET_USER)
+                    std::cout << "→ GET_USER: enviado info de " << pm.fields.size() << " usuarios a " << username << std::endl;
+                break;
+            }
 
-                        else
-                        {
-                            // Mensaje privado
-                            {
-                                std::lock_guard<std::mutex> lock(clients_mutex);
-                                for(auto &p : connectedUsers)
-                                    snapshot.push_back(p.second);
-                            }
+            case MessageCode::SEARCH_USERS:
+            {
+                std::lock_guard<std::mutex> lock(clients_mutex);
+                PooledBytes resp = buildUserSearchResponse(pm);
 
-                            // Solo envia mensajes a los activos y ocupadsos
-                            if (connectedUsers.count(dest) && connectedUsers[dest].status == UserStatus::ACTIVE || connectedUsers[dest].status == UserStatus::BUSY || connectedUsers[dest].status == UserStatus::INACTIVE)
-                            {
-                                auto binOut = buildBinaryMessage(MessageCode::MESSAGE_RECEIVED, {std::vector<unsigned char>(username.begin(), username.end()),
-                                                                                                 std::vector<unsigned char>(message.begin(), message.end())});
-                                sendBinaryMessage(connectedUsers[dest].ws, binOut);
-                                sendBinaryMessage(ws, binOut);
-                            }
-                            else
-                            {
-                                auto errMsg = buildRawBinaryMessage(MessageCode::ERROR_RESPONSE, {{static_cast<unsigned char>(ErrorCode::USER_DISCONNECTED)}});
-                                sendBinaryMessage(ws, errMsg);
-                                std::cerr << "[INFO] Usuario " << username << " intentó enviar mensaje a usuario desconectado: " << dest << std::endl;
-                            }
-                        }
+                deliverToUser(self, resp);
+                std::cout << "→ SEARCH_USERS: " << static_cast<int>(resp[1]) << " coincidencias para " << username << std::endl;
+                break;
+            }
 
+            case MessageCode::SUBSCRIBE_PRESENCE:
+            case MessageCode::UNSUBSCRIBE_PRESENCE:
+            {
+                // Los nombres que nunca se registraron se ignoran
+                PooledVector<uint32_t> ids;
+                ids.reserve(pm.fields.size());
+                for (const auto &field : pm.fields) {
+                    if (UserInfo *target = userDirectory.find(std::string_view(reinterpret_cast<const char *>(field.data()), field.size())))
+                        ids.push_back(target->id);
+                }
 
-                        if (dest == "~"){
-                            std::cout << "→ Mensaje de " << username << " enviado al chat general: " << message << std::endl;    
-                            
-                        } else {
-                            std::cout << "→ Mensaje de " << username << " enviado a " << dest << ": " << message << std::endl;
+                if (pm.code == MessageCode::UNSUBSCRIBE_PRESENCE) {
+                    if (pm.fields.empty())
+                        presenceIndex.clear(self.id);
+                    else
+                        presenceIndex.unsubscribe(self.id, ids);
+                    break;
+                }
 
-                        }
+                // Se suscribe antes de leer los estados, así ningún cambio queda entre la foto y
+                // las notificaciones
+                auto accepted = presenceIndex.subscribe(self.id, ids);
+                PooledBytes resp;
+                resp.push_back(MessageCode::RESPONSE_PRESENCE);
+                {
+                    std::lock_guard<std::mutex> lock(clients_mutex);
+                    for (uint32_t id : accepted) {
+                        const UserInfo &target = userDirectory[id];
+                        appendField(resp, target.username);
+                        resp.push_back(static_cast<unsigned char>(target.status));
+                    }
+                }
+                deliverToUser(self, resp);
+                std::cout << "→ " << username << " sigue la presencia de " << accepted.size() << " usuarios ("
+                          << presenceIndex.size() << " suscripciones en total)" << std::endl;
+                break;
+            }
 
+            case MessageCode::GET_HISTORY:
+            case MessageCode::GET_HISTORY_STREAM:
+            {
+                if (pm.fields.empty()) {
+                    PooledBytes err = { MessageCode::ERROR_RESPONSE, ErrorCode::USER_NOT_FOUND };
+                    deliverToUser(self, err);
+                    break;
+                }
+                std::string target(pm.fields[0].begin(), pm.fields[0].end());
+
+                // Sólo hay historial con usuarios registrados; la conversación se identifica por los IDs
+                std::optional<uint64_t> conversation;
+                if (target != "~") {
+                    const UserInfo *other = userDirectory.find(target);
+                    if (!other) {
+                        PooledBytes err = { MessageCode::ERROR_RESPONSE, ErrorCode::USER_NOT_FOUND };
+                        deliverToUser(self, err);
                         break;
                     }
-                    // Aquí  agregar casos para LIST_USERS, GET_USER, CHANGE_STATUS, GET_HISTORY, etc.
-                    // List User: retorna el listado de usuarios y sus estados
-                    case MessageCode::LIST_USERS:
-                    {
-                        std::lock_guard<std::mutex> lock(clients_mutex);
-
-                        std::vector<unsigned char> resp;
-                        resp.push_back(MessageCode::RESPONSE_LIST_USERS); // Código 0x33
+                    conversation = privateConversationKey(self.id, other->id);
+                }
 
-                        size_t count = 0;
-                        for (const auto &[_, info] : connectedUsers) {
-                            if (info.status != UserStatus::DISCONNECTED)
-                                ++count;
+                if (pm.code == MessageCode::GET_HISTORY_STREAM) {
+                    if (historyPool) {
+                        // Modo corrutinas: se abre y se envía por partes desde el pool de
+                        // historial, a medida que la cola de salida tiene lugar
+                        std::shared_ptr<OutboundQueue> outbound;
+                        {
+                            std::lock_guard<std::mutex> lock(self.session->mutex);
+                            outbound = self.session->outbound;
                         }
-                        resp.push_back(static_cast<unsigned char>(count));
-
-                        for (const auto &[_, info] : connectedUsers) {
-                            if (info.status == UserStatus::DISCONNECTED)
-                                continue;
+                        if (outbound)
+                            postHistoryRead(self.session, HistoryRead(HistoryStream{self, self.session, outbound, conversation, target, nullptr}));
+                        break;
+                    }
 
-                            resp.push_back(static_cast<unsigned char>(info.username.size()));
-                            resp.insert(resp.end(), info.username.begin(), info.username.end());
+                    // Modo hilos: cada escritura bloquea hasta que el socket la acepta, así
+                    // que se envía todo de una vez
+                    HistoryCursor cursor;
+                    if (!openHistoryCursor(cursor, conversation, username, target)) {
+                        PooledBytes err = { MessageCode::ERROR_RESPONSE, ErrorCode::USER_NOT_FOUND };
+                        deliverToUser(self, err);
+                        break;
+                    }
+                    std::cout << "→ Historial por partes para " << username
+                            << " target=" << target << ")" << std::endl;
+                    do
+                        deliverToUser(self, buildHistoryChunk(cursor));
+                    while (!cursor.atEnd());
+                    std::cout << "→ Historial de " << cursor.recordsRead() << " mensajes enviado a "
+                              << username << " por partes" << std::endl;
+                    break;
+                }
 
-                            resp.push_back(static_cast<unsigned char>(info.status)); // casteo a byte
-                        }
+                if (historyPool) {
+                    // Modo corrutinas: la lectura (que puede esperar al disco) corre en el pool de
+                    // historial y la respuesta se encola desde ahí, si la sesión sigue siendo la misma
+                    postHistoryRead(self.session, [&self, session = self.session, conversation, username, target] {
+                        PooledBytes resp = buildHistoryResponse(conversation, username, target);
+                        std::lock_guard<std::mutex> lock(clients_mutex);
+                        if (self.session == session)
+                            deliverToUser(self, resp);
+                    });
+                    break;
+                }
+                deliverToUser(self, buildHistoryResponse(conversation, username, target));
+                break;
+            }
 
-                        sendBinaryMessage(ws, resp);
-                        std::cout << "→ Enviado listado de " << count << " usuarios a " << username << "\n";
+            case MessageCode::SEARCH_HISTORY:
+            {
+                std::string target(pm.fields[0].begin(), pm.fields[0].end());
+                std::string query(pm.fields[1].begin(), pm.fields[1].end());
+                size_t limit = serverConfig.historySearchLimit;
+                if (pm.fields.size() > 2 && pm.fields[2][0] > 0)
+                    limit = std::min<size_t>(limit, pm.fields[2][0]);
+
+                std::optional<uint64_t> conversation;
+                if (target != "~") {
+                    const UserInfo *other = userDirectory.find(target);
+                    if (!other) {
+                        PooledBytes err = { MessageCode::ERROR_RESPONSE, ErrorCode::USER_NOT_FOUND };
+                        deliverToUser(self, err);
                         break;
                     }
+                    conversation = privateConversationKey(self.id, other->id);
+                }
 
-                    case MessageCode::LIST_ALL_USERS:
-                    {
+                if (historyPool) {
+                    // Leer los mensajes encontrados puede esperar al disco, como GET_HISTORY
+                    postHistoryRead(self.session, [&self, session = self.session, conversation, username, target, query, limit] {
+                        PooledBytes resp = buildHistorySearchResponse(conversation, username, target, query, limit);
                         std::lock_guard<std::mutex> lock(clients_mutex);
+                        if (self.session == session)
+                            deliverToUser(self, resp);
+                    });
+                    break;
+                }
+                deliverToUser(self, buildHistorySearchResponse(conversation, username, target, query, limit));
+                break;
+            }
 
-                        std::vector<unsigned char> resp;
-                        resp.push_back(MessageCode::RESPONSE_ALL_USERS); // o RESPONSE_LIST_ALL_USERS si querés diferenciar
+            case MessageCode::CHANGE_STATUS:
+            {
+                std::cerr << "[DEBUG] CHANGE_STATUS fields.size(): " << pm.fields.size()
+                << " field[0].size(): " << pm.fields[0].size()
+                << " field[1].size(): " << pm.fields[1].size() << std::endl;
 
-                        size_t count = connectedUsers.size();
-                        resp.push_back(static_cast<unsigned char>(count));
+                if (pm.fields.size() < 2 || pm.fields[0].empty() || pm.fields[1].empty()) {
+                    auto errMsg = buildRawBinaryMessage(MessageCode::ERROR_RESPONSE, {{ErrorCode::EMPTY_MESSAGE}});
+                    deliverToUser(self, errMsg);
+                    break;
+                }
 
-                        for (const auto &[_, info] : connectedUsers) {
-                            resp.push_back(static_cast<unsigned char>(info.username.size()));
-                            resp.insert(resp.end(), info.username.begin(), info.username.end());
-                            resp.push_back(static_cast<unsigned char>(info.status));
-                        }
+                std::string targetUser(pm.fields[0].begin(), pm.fields[0].end());
+                uint8_t rawStatus = pm.fields[1][0];
 
-                        sendBinaryMessage(ws, resp);
-                        std::cout << "→ Enviado listado completo de " << count << " usuarios a " << username << "\n";
-                        break;
-                    }
+                // Validar status: solo 1 (ACTIVO), 2 (OCUPADO) o 3 (INACTIVO)
+                if (rawStatus < 1 || rawStatus > 3) {
+                    auto errMsg = buildRawBinaryMessage(MessageCode::ERROR_RESPONSE, {{ErrorCode::INVALID_STATUS}});
+                    deliverToUser(self, errMsg);
+                    std::cerr << "[ERROR] Usuario " << targetUser << " envió estado inválido: " << (int)rawStatus << std::endl;
+                    break;
+                }
 
-                    case MessageCode::GET_USER:
-                    {
-                        std::string target(pm.fields[0].begin(), pm.fields[0].end());
-                        std::lock_guard<std::mutex> lock(clients_mutex);
-                        auto it = connectedUsers.find(target);
-
-                        if (it == connectedUsers.end() || it->second.status == UserStatus::DISCONNECTED) {
-                            std::vector<unsigned char> errResp;
-                            errResp.push_back(MessageCode::ERROR_RESPONSE);       
-                            errResp.push_back(ErrorCode::USER_NOT_FOUND);         
-                            sendBinaryMessage(ws, errResp);
-                        } else {
-                            std::vector<unsigned char> resp;
-                            resp.push_back(MessageCode::RESPONSE_GET_USER);          // TIPO
-                            resp.push_back(static_cast<unsigned char>(target.size())); // LEN_USER
-                            resp.insert(resp.end(), target.begin(), target.end());   // USERNAME
-                            resp.push_back(static_cast<unsigned char>(it->second.status)); // STATUS 
-
-                            sendBinaryMessage(ws, resp);
-                            std::cout << "→ GET_USER: enviado info de " << target << std::endl;
-                        }
-                        break;
-                    }
+                UserStatus newStatus = static_cast<UserStatus>(rawStatus);
 
-                    case MessageCode::GET_HISTORY:
-                    {
+                UserInfo *targetInfo = userDirectory.find(targetUser);
+                if (!targetInfo) {
+                    auto errMsg = buildRawBinaryMessage(MessageCode::ERROR_RESPONSE, {{ErrorCode::USER_NOT_FOUND}});
+                    deliverToUser(self, errMsg);
+                    break;
+                }
 
-                        std::string target(pm.fields[0].begin(), pm.fields[0].end());
+                setUserStatus(*targetInfo, newStatus, true);
+                break;
+            }
 
-                        std::vector<std::pair<std::string, std::string>> history;
+            default:
+            {
+                std::cout << "Código de mensaje binario no reconocido: " << (int)pm.code << std::endl;
+                auto errMsg = buildRawBinaryMessage(MessageCode::ERROR_RESPONSE, {{ErrorCode::EMPTY_MESSAGE}});
+                deliverToUser(self, errMsg);
+                break;
+            }
+            }
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Error al procesar mensaje binario de " << username << ": " << e.what() << std::endl;
+            auto errMsg = buildRawBinaryMessage(MessageCode::ERROR_RESPONSE, {{ErrorCode::EMPTY_MESSAGE}});
+            deliverToUser(self, errMsg);
+        }
+    }
 
-                        if (target == "~"){
-                            history = loadHistory();
-                        } else {
-                            // Sólo permite historial si quien pide es parte de la conversación
-                            if (username != target && !connectedUsers.count(username)) {
-                                // Usuario no existe o no es parte → error
-                                std::vector<unsigned char> err = { MessageCode::ERROR_RESPONSE, ErrorCode::USER_NOT_FOUND };
-                                sendBinaryMessage(ws, err);
-                                break;
-                            }
-                            std::string path = privateHistoryPath(username, target);
-                            std::ifstream fin(path);
-                            if (!fin.good()) {
-                                std::vector<unsigned char> err = { MessageCode::ERROR_RESPONSE, ErrorCode::USER_NOT_FOUND };
-                                sendBinaryMessage(ws, err);
-                                break;
-                            }
-                            history = loadPrivateHistory(username, target);
-                        }
+    return true;
+}
 
+// Motivo de cierre cuando el cliente envía "/exit"
+websocket::close_reason exitCloseReason()
+{
+    websocket::close_reason cr;
+    cr.code = websocket::close_code::normal;
+    cr.reason = "El usuario solicitó desconexión voluntaria";
+    return cr;
+}
 
+// Marca al usuario como desconectado y avisa a los demás
+void closeSession(UserInfo &self)
+{
+    if (shuttingDown)
+    {
+        // Todos se están desconectando; no tiene sentido avisar a los demás
+        self.status = UserStatus::DISCONNECTED;
+        detachSession(self);
+        return;
+    }
 
-                        std::vector<std::vector<unsigned char>> fields;
+    setUserStatus(self, UserStatus::DISCONNECTED, true);
+    detachSession(self);
+    broadcastTextMessage("Usuario " + self.username + " se ha desconectado.");
+}
 
+// Un nodo del cluster quedó conectado (le mandamos el estado de nuestros usuarios) o se
+// cortó su enlace (sus usuarios pasan a desconectados hasta que vuelva)
+void handleClusterPeer(uint16_t node, bool up)
+{
+    std::vector<uint32_t> ids;
+    userDirectory.forEach([&](UserInfo &info)
+    {
+        if (info.status != UserStatus::DISCONNECTED && info.node == (up ? 0 : node))
+            ids.push_back(info.id);
+    });
 
-                        fields.push_back({ static_cast<unsigned char>(history.size()) });
+    if (up)
+    {
+        for (uint32_t id : ids)
+            clusterLink.send(node, buildClusterStatus(userDirectory[id]));
+        return;
+    }
+    for (uint32_t id : ids)
+    {
+        UserInfo &info = userDirectory[id];
+        setUserStatus(info, UserStatus::DISCONNECTED, true);
+        broadcastTextMessage("Usuario " + info.username + " se ha desconectado.");
+    }
+    if (!ids.empty())
+        std::cout << "[CLUSTER] " << ids.size() << " usuarios del nodo " << node << " pasados a desconectados" << std::endl;
+}
 
-                        for (auto &hm : history)
-                        {
+// Procesa una trama recibida de otro nodo del cluster (desde el hilo del enlace)
+void handleClusterFrame(uint16_t node, const unsigned char *data, size_t size)
+{
+    ParsedMessage pm = parseBinaryMessage(data, size);
+    auto field = [&](size_t i) { return std::string(pm.fields[i].begin(), pm.fields[i].end()); };
 
-                            fields.push_back(
-                                std::vector<unsigned char>(hm.first.begin(), hm.first.end())
-                            );
-                            fields.push_back(
-                                std::vector<unsigned char>(hm.second.begin(), hm.second.end())
-                            );
-                        }
+    switch (pm.code)
+    {
+    case ClusterCode::USER_STATUS:
+    {
+        if (pm.fields.size() < 3 || pm.fields[1].size() != 1 || pm.fields[1][0] > static_cast<uint8_t>(UserStatus::INACTIVE))
+            throw std::runtime_error("USER_STATUS inválido.");
+        std::string username = field(0);
+        if (!isValidUsername(username))
+            throw std::runtime_error("Nombre de usuario inválido.");
+        auto status = static_cast<UserStatus>(pm.fields[1][0]);
+        UserInfo &info = userDirectory.intern(username);
+        {
+            std::lock_guard<std::mutex> lock(clients_mutex);
+            if (info.node == 0 && info.status != UserStatus::DISCONNECTED)
+            {
+                // Se conectó a la vez en los dos nodos: aquí sigue valiendo la sesión local
+                if (status != UserStatus::DISCONNECTED)
+                    std::cerr << "[ERROR] Usuario " << username << " conectado también en el nodo " << node << std::endl;
+                break;
+            }
+            // Se pasó a otro nodo y el aviso de salida del anterior llegó tarde
+            if (info.node != node && info.status != UserStatus::DISCONNECTED && status == UserStatus::DISCONNECTED)
+                break;
+            info.node = node;
+            info.ipAddress = field(2);
+        }
+        setUserStatus(info, status, true);
+        if (status == UserStatus::DISCONNECTED)
+            broadcastTextMessage("Usuario " + username + " se ha desconectado.");
+        break;
+    }
+    case ClusterCode::USER_JOINED:
+    {
+        UserInfo *info = pm.fields.empty() ? nullptr : userDirectory.find(field(0));
+        if (!info || info->node != node)
+            break;
+        broadcastUserJoined(info->username, info->ipAddress);
+        broadcastTextMessage("Usuario " + info->username + " se ha unido.");
+        break;
+    }
+    case ClusterCode::CHAT_GENERAL:
+    {
+        if (pm.fields.size() < 2)
+            throw std::runtime_error("CHAT_GENERAL inválido.");
+        // Cada nodo guarda su copia del chat general: GET_HISTORY no depende de dónde se conecte
+        std::string message = field(1);
+        appendToHistory("~", message);
+        deliverGeneralMessage(message);
+        std::cout << "→ Mensaje de " << field(0) << " (nodo " << node << ") enviado al chat general: " << message << std::endl;
+        break;
+    }
+    case ClusterCode::CHAT_PRIVATE:
+    {
+        if (pm.fields.size() < 3)
+            throw std::runtime_error("CHAT_PRIVATE inválido.");
+        std::string from = field(0), dest = field(1), message = field(2);
+        UserInfo *destInfo = userDirectory.find(dest);
+        if (!isValidUsername(from) || !destInfo || destInfo->node != 0
+            || !(destInfo->status == UserStatus::ACTIVE || destInfo->status == UserStatus::BUSY || destInfo->status == UserStatus::INACTIVE))
+        {
+            std::cerr << "[INFO] Mensaje de " << from << " (nodo " << node << ") para " << dest << " descartado: no está en este nodo" << std::endl;
+            break;
+        }
+        UserInfo &fromInfo = userDirectory.intern(from);
+        appendPrivateHistory(privateConversationKey(fromInfo.id, destInfo->id), from, dest, message);
+        deliverToUser(*destInfo, buildBinaryMessage(MessageCode::MESSAGE_RECEIVED, {from, message}));
+        std::cout << "→ Mensaje de " << from << " (nodo " << node << ") enviado a " << dest << ": " << message << std::endl;
+        break;
+    }
+    default:
+        throw std::runtime_error("Código desconocido.");
+    }
+}
 
-                        auto responseMsg = buildBinaryMessage(MessageCode::RESPONSE_HISTORY, fields, true);
+// Manejo de la conexión de un cliente mediante WebSockets (modo hilos)
+void handleClient(std::shared_ptr<websocket::stream<tcp::socket>> ws, UserInfo &claimed, bool created,
+                  std::optional<uint64_t> lastSeenSeq)
+{
+    const std::string &username = claimed.username;
+    try
+    {
+        UserInfo &self = openSession(ws, claimed, created, lastSeenSeq, nullptr);
 
-                        sendBinaryMessage(ws, responseMsg);
+        // El buffer de lectura se reutiliza entre mensajes y crece dentro del pool del hilo
+        beast::basic_flat_buffer<PoolAllocator<char>> buffer;
+        while (true)
+        {
+            buffer.consume(buffer.size());
+            try {
+                ws->read(buffer);
+            } catch(const std::exception &e) {
+                std::cerr << "[ERROR] read for " << username << ": " << e.what() << std::endl;
+                break;
+            }
 
-                        std::cout << "→ Historial de " << history.size() 
-                                << " mensajes enviado a " << username
-                                << " target=" << target << ")" << std::endl;
+            auto data = buffer.data();
+            if (!handleIncomingMessage(self, ws->got_text(), static_cast<const unsigned char *>(data.data()), data.size()))
+            {
+                ws->close(exitCloseReason());
+                ws->next_layer().close();
+                break;
+            }
+        }
 
-                        break;
-                    }
+        closeSession(self);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error con el cliente " << username << ": " << e.what() << std::endl;
+        if (UserInfo *info = userDirectory.find(username))
+        {
+            setUserStatus(*info, UserStatus::DISCONNECTED, true);
+            detachSession(*info);
+        }
+        broadcastTextMessage("Usuario " + username + " se ha desconectado.");
+    }
+}
 
-                    case MessageCode::CHANGE_STATUS:
-                    {
-                        std::cerr << "[DEBUG] CHANGE_STATUS fields.size(): " << pm.fields.size()
-                        << " field[0].size(): " << pm.fields[0].size()
-                        << " field[1].size(): " << pm.fields[1].size() << std::endl;
+// Valida la request del handshake. Devuelve la respuesta HTTP de rechazo, o nada si se
+// puede aceptar la conexión WebSocket.
+// Rechazo del handshake. El cliente Qt solo ve el código y la frase de estado (QWebSocket los
+// pone en errorString()); el encabezado X-YaPPuccino-Reject es para otros clientes.
+static http::response<http::string_body> rejectHandshake(http::status status, const char *reason,
+                                                         const char *code, const char *body, unsigned version)
+{
+    http::response<http::string_body> res{status, version};
+    res.reason(reason);
+    res.set("X-YaPPuccino-Reject", code);
+    res.set(http::field::content_type, "text/plain; charset=utf-8");
+    res.body() = body;
+    res.prepare_payload();
+    return res;
+}
 
-                        if (pm.fields.size() < 2 || pm.fields[0].empty() || pm.fields[1].empty()) {
-                            auto errMsg = buildRawBinaryMessage(MessageCode::ERROR_RESPONSE, {{ErrorCode::EMPTY_MESSAGE}});
-                            sendBinaryMessage(ws, errMsg);
-                            break;
-                        }
+// Suelta el nombre reservado por checkHandshake al terminar la conexión, pase lo que pase
+struct SessionClaim
+{
+    UserInfo *info = nullptr;
+    bool created = false;
 
-                        std::string targetUser(pm.fields[0].begin(), pm.fields[0].end());
-                        uint8_t rawStatus = pm.fields[1][0];
+    SessionClaim() = default;
+    SessionClaim(const SessionClaim &) = delete;
+    SessionClaim &operator=(const SessionClaim &) = delete;
+    ~SessionClaim()
+    {
+        if (info)
+            info->inSession.store(false);
+    }
+};
 
-                        // Validar status: solo 1 (ACTIVO), 2 (OCUPADO) o 3 (INACTIVO)
-                        if (rawStatus < 1 || rawStatus > 3) {
-                            auto errMsg = buildRawBinaryMessage(MessageCode::ERROR_RESPONSE, {{ErrorCode::INVALID_STATUS}});
-                            sendBinaryMessage(ws, errMsg);
-                            std::cerr << "[ERROR] Usuario " << targetUser << " envió estado inválido: " << (int)rawStatus << std::endl;
-                            break;
-                        }
+// Valida el handshake y, si se acepta, reserva el nombre en @p claim: dos conexiones con el
+// mismo nombre no pueden pasar las dos, la que pierde recibe el 409
+std::optional<http::response<http::string_body>> checkHandshake(const http::request<http::string_body> &req, const std::string &username,
+                                                                SessionClaim &claim)
+{
+    // Durante el apagado se rechaza todo lo que llegue
+    if (shuttingDown)
+    {
+        auto res = rejectHandshake(http::status::service_unavailable, "Shutting Down", "shutting_down",
+                                   "Servidor apagándose", req.version());
+        res.set(http::field::retry_after, std::to_string(serverConfig.drainTimeoutSeconds + 1));
+        return res;
+    }
 
-                        UserStatus newStatus = static_cast<UserStatus>(rawStatus);
+    // Consulta previa por HTTP de clientes anteriores: el cliente actual se conecta directo y
+    // recibe el rechazo en el mismo handshake. Es solo informativa, no reserva nada.
+    auto connHdr = req[http::field::connection].to_string();
+    auto upgHdr  = req[http::field::upgrade].to_string();
+    if (upgHdr.empty() || connHdr.find("Upgrade") == std::string::npos) {
+        const UserInfo *existing = userDirectory.find(username);
+        bool inUse = existing && (existing->status != UserStatus::DISCONNECTED || existing->inSession.load());
+        http::response<http::string_body> res{http::status::ok, req.version()};
+        if (inUse) {
+            res.result(http::status::bad_request);
+            res.body() = "Usuario ya conectado";
+        }
+        res.prepare_payload();
+        return res;
+    }
 
-                        if (!connectedUsers.count(targetUser)) {
-                            auto errMsg = buildRawBinaryMessage(MessageCode::ERROR_RESPONSE, {{ErrorCode::USER_NOT_FOUND}});
-                            sendBinaryMessage(ws, errMsg);
-                            break;
-                        }
+    if (!isValidUsername(username))
+        return rejectHandshake(http::status::bad_request, "Invalid Name", "invalid_name",
+                               "Nombre de usuario inválido", req.version());
+
+    // Si el usuario NO está en estado DISCONNECTED, o otra conexión ya se quedó con el nombre,
+    // se rechaza la conexión
+    claim.info = userDirectory.claim(username, &claim.created);
+    if (!claim.info)
+        return rejectHandshake(http::status::conflict, "Name In Use", "name_in_use",
+                               "Usuario ya conectado", req.version());
+    return std::nullopt;
+}
 
-                        setUserStatus(targetUser, newStatus, true);
-                        break;
-                    }
+// Aplica al stream los límites de buffer de la configuración
+void configureStream(websocket::stream<tcp::socket> &ws)
+{
+    ws.read_message_max(serverConfig.maxMessageBytes);
+    ws.write_buffer_bytes(serverConfig.writeBufferBytes);
+}
 
-                    default:
-                    {
-                        std::cout << "Código de mensaje binario no reconocido: " << (int)pm.code << std::endl;
-                        auto errMsg = buildRawBinaryMessage(MessageCode::ERROR_RESPONSE, {{ErrorCode::EMPTY_MESSAGE}});
-                        sendBinaryMessage(ws, errMsg);
-                        break;
-                    }
-                    }
-                }
-                catch (const std::exception &e)
-                {
-                    std::cerr << "Error al procesar mensaje binario de " << username << ": " << e.what() << std::endl;
-                    auto errMsg = buildRawBinaryMessage(MessageCode::ERROR_RESPONSE, {{ErrorCode::EMPTY_MESSAGE}});
-                    sendBinaryMessage(ws, errMsg);
-                }
-            }
+// Atiende una conexión aceptada en su propio hilo: lee el handshake, lo valida y, si
+// corresponde, pasa a la sesión WebSocket
+void serveConnection(tcp::socket socket)
+{
+    SessionCounter counter;
+    SessionClaim claim;
+    std::string username;
+    try
+    {
+        // Leer la request HTTP para obtener la información del handshake
+        beast::flat_buffer buffer;
+        http::request<http::string_body> req;
+        http::read(socket, buffer, req);
+        std::string target = req.target().to_string();
+        username = extractUsername(target);
+        std::optional<uint64_t> lastSeenSeq = extractLastSeq(target);
+
+        if (auto rejection = checkHandshake(req, username, claim))
+        {
+            http::write(socket, *rejection);
+            return;
         }
 
+        auto ws = std::make_shared<websocket::stream<tcp::socket>>(std::move(socket));
+        configureStream(*ws);
+        ws->accept(req);
+        handleClient(ws, *claim.info, claim.created, lastSeenSeq);
+    }
+    catch (const std::exception& e) 
+    {
+        std::cerr << "Error en el hilo para " << username << ": " << e.what() << std::endl;
+    }
+}
+
+#ifdef YAPP_HAS_COROUTINES
+// Lo mismo que serveConnection + handleClient, pero como corrutina sobre el io_context
+// compartido: cada espera es un co_await en lugar de un hilo bloqueado. Corre en el
+// strand del socket; las escrituras pasan por la OutboundQueue de la sesión.
+asio::awaitable<void> coroutineSession(tcp::socket socket)
+{
+    SessionCounter counter;
+    SessionClaim claim;
+    std::string username;
+    UserInfo *self = nullptr;
+    try
+    {
+        beast::flat_buffer handshakeBuffer;
+        http::request<http::string_body> req;
+        co_await http::async_read(socket, handshakeBuffer, req, asio::use_awaitable);
+        std::string target = req.target().to_string();
+        username = extractUsername(target);
+        std::optional<uint64_t> lastSeenSeq = extractLastSeq(target);
+
+        if (auto rejection = checkHandshake(req, username, claim))
         {
+            co_await http::async_write(socket, *rejection, asio::use_awaitable);
+            co_return;
+        }
+
+        auto ws = std::make_shared<websocket::stream<tcp::socket>>(std::move(socket));
+        configureStream(*ws);
+        co_await ws->async_accept(req, asio::use_awaitable);
+
+        auto outbound = std::make_shared<OutboundQueue>(ws->get_executor());
+        asio::co_spawn(ws->get_executor(), outbound->run(ws), asio::detached);
+        self = &openSession(ws, *claim.info, claim.created, lastSeenSeq, outbound);
+
+        beast::basic_flat_buffer<PoolAllocator<char>> buffer;
+        while (true)
+        {
+            // Backpressure: no se lee otro pedido mientras las respuestas no salgan. Si la
+            // cola se cerró (cliente lento cortado o error de escritura) la sesión terminó
+            if (!co_await outbound->waitUntilWritable())
+                break;
+
+            buffer.consume(buffer.size());
+            beast::error_code ec;
+            co_await ws->async_read(buffer, asio::redirect_error(asio::use_awaitable, ec));
+            if (ec)
             {
-                std::lock_guard<std::mutex> lock(clients_mutex);
-                for(auto &p : connectedUsers)
-                    snapshot.push_back(p.second);
+                std::cerr << "[ERROR] read for " << username << ": " << ec.message() << std::endl;
+                break;
             }
-            if (connectedUsers.count(username))
+
+            auto data = buffer.data();
+            if (!handleIncomingMessage(*self, ws->got_text(), static_cast<const unsigned char *>(data.data()), data.size()))
             {
-                setUserStatus(username, UserStatus::DISCONNECTED, true);
-                connectedUsers[username].ws.reset();
+                co_await ws->async_close(exitCloseReason(), asio::redirect_error(asio::use_awaitable, ec));
+                break;
             }
         }
-        broadcastTextMessage("Usuario " + username + " se ha desconectado.");
+
+        closeSession(*self);
     }
     catch (const std::exception &e)
     {
         std::cerr << "Error con el cliente " << username << ": " << e.what() << std::endl;
-        {
-            {
-                std::lock_guard<std::mutex> lock(clients_mutex);
-                for(auto &p : connectedUsers)
-                    snapshot.push_back(p.second);
-            }
-            if (connectedUsers.count(username))
-            {
-                setUserStatus(username, UserStatus::DISCONNECTED, true);
-                connectedUsers[username].ws.reset();
-            }
-        }
-        broadcastTextMessage("Usuario " + username + " se ha desconectado.");
+        if (self)
+            closeSession(*self);
     }
 }
+#endif
 
-int main()
+int main(int argc, char **argv)
 {
+    if (!parseCommandLine(argc, argv, serverConfig))
+        return 1;
+
+#ifndef YAPP_HAS_COROUTINES
+    if (serverConfig.sessionMode == SessionMode::Coroutines)
+    {
+        std::cerr << "[ERROR] session_mode=coroutines requiere compilar con C++20 (co_await)." << std::endl;
+        return 1;
+    }
+#endif
+
+    if (serverConfig.clusterNodeId != 0 && serverConfig.clusterSecret.empty())
+    {
+        std::cerr << "[ERROR] cluster_node_id requiere cluster_secret (la misma clave en todos los nodos)." << std::endl;
+        return 1;
+    }
+
     try
     {
         asio::io_context io_context;
-        tcp::acceptor acceptor(io_context, tcp::endpoint(tcp::v4(), 5000));
-
-        std::cout << "Servidor WebSockets en ws://localhost:5000" << std::endl;
+        tcp::acceptor acceptor(io_context, tcp::endpoint(tcp::v4(), serverConfig.port));
+
+        // Recuperar el registro guardado en el último apagado (IDs, estados y secuencias)
+        const std::string checkpointFile = serverConfig.checkpointFile();
+        userDirectory.openColdTier(serverConfig.coldRegistryFile());
+        size_t restored = userDirectory.loadCheckpoint(checkpointFile);
+        if (restored > 0)
+            std::cout << "Registro restaurado: " << restored << " usuarios desde " << checkpointFile << std::endl;
+
+        if (!selectTextScanKernel(serverConfig.textScanKernel))
+            std::cerr << "[ERROR] text_scan_kernel = " << serverConfig.textScanKernel
+                      << " no está disponible en este procesador, se usa " << textScanKernel() << std::endl;
+
+        // El índice del historial se reconstruye leyendo los segmentos del log
+        if (!openHistory())
+            return 1;
+        if (serverConfig.sessionMode == SessionMode::Coroutines)
+            historyPool = std::make_unique<asio::thread_pool>(serverConfig.historyIoThreads);
+
+        // Cluster: los enlaces con los otros nodos se abren antes de aceptar clientes
+        if (serverConfig.clusterNodeId != 0)
+        {
+            if (!clusterLink.start(serverConfig.clusterNodeId, serverConfig.clusterBind, serverConfig.clusterPort,
+                                   serverConfig.clusterSecret, serverConfig.clusterPeers, handleClusterFrame, handleClusterPeer))
+                return 1;
+            // La lista puede ser la misma en todos los nodos: cada uno se saltea a sí mismo
+            auto others = std::count_if(serverConfig.clusterPeers.begin(), serverConfig.clusterPeers.end(),
+                                        [](const ClusterPeer &peer) { return peer.id != serverConfig.clusterNodeId; });
+            std::cout << "[CLUSTER] Nodo " << serverConfig.clusterNodeId << " en " << serverConfig.clusterBind << ":" << serverConfig.clusterPort
+                      << ", " << others << " nodos más" << std::endl;
+        }
 
-        const int INACTIVITY_THRESHOLD = 25;
+        std::cout << "Servidor WebSockets en ws://localhost:" << serverConfig.port
+                  << (serverConfig.sessionMode == SessionMode::Coroutines ? " (corrutinas, " : " (hilos, ")
+                  << serverConfig.ioThreads << " io_threads, texto " << textScanKernel() << ")" << std::endl;
 
-        std::thread([&]{
+        std::thread sweeper([&]{
+            int sweeps = 0;
             while (true)
             {
-                std::this_thread::sleep_for(std::chrono::seconds(5)); // cada 5 seg
-                std::vector<std::string> usersToSetInactive;  // lista de usuarios a actualizar
-        
                 {
+                    // Cada sweep_interval seg, o antes si se pide el apagado
+                    std::unique_lock<std::mutex> lock(sessionsMutex);
+                    if (sessionsChanged.wait_for(lock, std::chrono::seconds(serverConfig.sweepIntervalSeconds), []{ return shuttingDown.load(); }))
+                        break;
+                }
+
+                // Cada minuto (aprox.) se reportan las estadísticas del pool de buffers
+                if (++sweeps % std::max(1, 60 / serverConfig.sweepIntervalSeconds) == 0)
+                {
+                    BufferPoolStats stats = bufferPoolStats();
+                    std::cout << "[POOL] asignaciones=" << stats.allocations
+                              << " reutilizadas=" << stats.reused
+                              << " slabs=" << stats.slabRefills
+                              << " grandes=" << stats.oversize
+                              << " reservado=" << stats.bytesReserved / 1024 << " KiB" << std::endl;
+                    if (serverConfig.sessionMode == SessionMode::Coroutines)
                     {
-                        std::lock_guard<std::mutex> lock(clients_mutex);
-                        for(auto &p : connectedUsers)
-                            snapshot.push_back(p.second);
+                        OutboundStats out = outboundStats();
+                        std::cout << "[SALIDA] tramas=" << out.frames << " encolado=" << out.queuedBytes / 1024 << " KiB pausas=" << out.readerPauses
+                                  << " cortados=" << out.overflows << std::endl;
                     }
+                }
+                std::vector<uint32_t> usersToSetInactive;  // IDs de los usuarios a actualizar
+        
+                {
                     auto now = std::chrono::steady_clock::now();
         
-                    for (auto &[u, info] : connectedUsers)
+                    userDirectory.forEach([&](UserInfo &info)
                     {
-                        // Solo los que están en ACTIVE o BUSY se vuelven INACTIVE tras X seg
-                        if (info.status == UserStatus::ACTIVE)
+                        // Solo los que están en ACTIVE o BUSY se vuelven INACTIVE tras X seg (los
+                        // de otro nodo los revisa su propio nodo)
+                        if (info.status == UserStatus::ACTIVE && info.node == 0)
                         {
                             auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(
                                 now - info.lastActivityTime
                             ).count();
         
-                            if (elapsed >= INACTIVITY_THRESHOLD)
+                            if (elapsed >= serverConfig.inactivityThresholdSeconds)
                             {
-                                usersToSetInactive.push_back(u);
+                                usersToSetInactive.push_back(info.id);
                             }
                         }
-                    }
+                    });
                 }
         
                 // Fuera del lock, se actualiza el estado para cada usuario identificado.
-                for (const auto &username : usersToSetInactive)
+                for (uint32_t id : usersToSetInactive)
                 {
-                    setUserStatus(username, UserStatus::INACTIVE, true);
-                    std::cout << "Usuario " << username << " pasó a INACTIVE por inactividad.\n";
+                    UserInfo &info = userDirectory[id];
+                    setUserStatus(info, UserStatus::INACTIVE, true);
+                    std::cout << "Usuario " << info.username << " pasó a INACTIVE por inactividad.\n";
                 }
-            }
-        }).detach();
 
-        while (true)
-        {
-            auto socket = std::make_shared<tcp::socket>(io_context);
-            acceptor.accept(*socket);
-
-            // Leer la request HTTP para obtener la información del handshake
-            beast::flat_buffer buffer;
-            http::request<http::string_body> req;
-            http::read(*socket, buffer, req);
-            std::string target = req.target().to_string();
-            std::string username = extractUsername(target);
-
-            auto connHdr = req[http::field::connection].to_string();
-            auto upgHdr  = req[http::field::upgrade].to_string();
-            if (upgHdr.empty() || connHdr.find("Upgrade") == std::string::npos) {
-                http::response<http::string_body> res{http::status::ok, req.version()};
-                if (connectedUsers.count(username) && connectedUsers[username].status != UserStatus::DISCONNECTED) {
-                    res.result(http::status::bad_request);
-                    res.body() = "Usuario ya conectado";
+                // Cada registry_evict_interval seg se pasan al disco los desconectados hace mucho
+                // (nunca antes de que venza su ventana de reanudación)
+                if (sweeps % std::max(1, serverConfig.registryEvictIntervalSeconds / serverConfig.sweepIntervalSeconds) == 0)
+                {
+                    auto coldAfter = std::chrono::seconds(std::max(serverConfig.registryColdAfterSeconds, serverConfig.resumeWindowSeconds));
+                    auto evicted = userDirectory.evictIdle(coldAfter);
+                    for (uint32_t id : evicted)
+                        presenceIndex.clear(id);
+                    if (!evicted.empty())
+                        std::cout << "[REGISTRO] " << evicted.size() << " usuarios pasados al directorio en disco" << std::endl;
                 }
-                res.prepare_payload();
-                http::write(*socket, res);
-                continue;
             }
+        });
 
-
-            // Validar el nombre de usuario
-            if (!isValidUsername(username) ||
-            (connectedUsers.count(username) && connectedUsers[username].status != UserStatus::DISCONNECTED)) 
+        // SIGINT/SIGTERM: dejar de aceptar y despertar al hilo principal para drenar
+        asio::signal_set signals(io_context, SIGINT, SIGTERM);
+        signals.async_wait([&](const beast::error_code &ec, int signo)
+        {
+            if (ec)
+                return;
+            std::cout << "Señal " << signo << " recibida, apagando servidor..." << std::endl;
             {
-                http::response<http::string_body> res{http::status::bad_request, req.version()};
-                res.body() = "Usuario ya conectado";
-                res.prepare_payload();
-                http::write(*socket, res);
-                continue;
+                std::lock_guard<std::mutex> lock(sessionsMutex);
+                shuttingDown = true;
             }
+            sessionsChanged.notify_all();
+            beast::error_code ignored;
+            acceptor.close(ignored);
+        });
 
+        std::function<void()> acceptNext = [&]
+        {
+            // Cada conexión recibe su propio strand; en modo corrutinas serializa su lectura,
+            // su escritor y los cierres iniciados desde otros hilos
+            acceptor.async_accept(asio::make_strand(io_context), [&](const beast::error_code &ec, tcp::socket socket)
             {
+                if (shuttingDown)
+                    return;
+                if (ec)
                 {
-                    std::lock_guard<std::mutex> lock(clients_mutex);
-                    for(auto &p : connectedUsers)
-                        snapshot.push_back(p.second);
+                    std::cerr << "[ERROR] accept: " << ec.message() << std::endl;
                 }
-                if (connectedUsers.count(username))
+                else
                 {
-                    auto &info = connectedUsers[username];
-                    // Si el usuario NO está en estado DISCONNECTED y el socket existe y está abierto, se rechaza la conexión.
-                    if (info.status != UserStatus::DISCONNECTED && info.ws && info.ws->next_layer().is_open())
+                    // Se cuenta antes de crear la sesión para que el apagado no se la salte
+                    {
+                        std::lock_guard<std::mutex> lock(sessionsMutex);
+                        ++activeSessions;
+                    }
+#ifdef YAPP_HAS_COROUTINES
+                    if (serverConfig.sessionMode == SessionMode::Coroutines)
                     {
-                        http::response<http::string_body> res{http::status::bad_request, req.version()};
-                        res.set(http::field::content_type, "text/plain");
-                        res.body() = "Usuario ya conectado";
-                        res.prepare_payload();
-                        http::write(*socket, res);
-                        continue;
+                        auto executor = socket.get_executor();
+                        asio::co_spawn(executor, coroutineSession(std::move(socket)), asio::detached);
                     }
+                    else
+#endif
+                    // Crear un hilo para manejar la conexión del cliente
+                    std::thread(serveConnection, std::move(socket)).detach();
                 }
-            }                 
+                acceptNext();
+            });
+        };
+        acceptNext();
 
-            // Crear un hilo para manejar la conexión del cliente
-            std::thread([socket, req, username]() mutable
-            {
-                try 
-                {
-                    auto ws = std::make_shared<websocket::stream<tcp::socket>>(std::move(*socket));
-                    ws->accept(req);
-                    handleClient(ws, username);
-                } 
-                catch (const std::exception& e) 
-                {
-                    std::cerr << "Error en el hilo para " << username << ": " << e.what() << std::endl;
-                } 
-            }).detach();
+        // En modo corrutinas las sesiones viven en estos hilos; en modo hilos solo atienden
+        // la aceptación y las señales
+        std::vector<std::thread> ioThreads;
+        for (unsigned i = 0; i < serverConfig.ioThreads; ++i)
+            ioThreads.emplace_back([&] { io_context.run(); });
+
+        {
+            std::unique_lock<std::mutex> lock(sessionsMutex);
+            sessionsChanged.wait(lock, [] { return shuttingDown.load(); });
         }
+
+        // Apagado ordenado: sesiones, historial y por último el registro. El io_context
+        // sigue corriendo durante el drenado para completar los cierres asíncronos.
+        sweeper.join();
+        drainSessions();
+        clusterLink.stop(); // Los otros nodos ven el corte y dan por desconectados a nuestros usuarios
+        io_context.stop();
+        for (auto &t : ioThreads)
+            t.join();
+        if (historyPool)
+            historyPool->join();
+        flushHistory();
+        size_t saved = userDirectory.saveCheckpoint(checkpointFile);
+        std::cout << "Registro guardado: " << saved << " usuarios en " << checkpointFile << std::endl;
     }
     catch (const std::exception &e)
     {